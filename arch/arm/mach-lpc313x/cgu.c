@@ -368,6 +368,83 @@ u32 cgu_fdiv_reset(u32 fdId)
 	CGU_SB->base_fdc[fdId]  = conf;
 	CGU_SB->base_fdc[fdId]  = conf&(~CGU_SB_FDC_RESET); /* remove the reset (and small delay) */
 }
+/***********************************************************************
+* Read back the setting of a fractional divider. Returns -1 if the
+* divider is not running.
+**********************************************************************/
+int cgu_fdiv_get(u32 fdId, CGU_FDIV_SETUP_T *fdivCfg)
+{
+	int msub, madd;
+	u32 fdcVal;
+
+	/* read frac div control register value */
+	fdcVal = CGU_SB->base_fdc[fdId];
+
+	if (!(fdcVal & CGU_SB_FDC_RUN)) /* Is the fracdiv enabled ?*/
+		return -1;
+
+	/* Yes, so reverse calculation of madd and msub */
+	if (fdId != CGU_SB_BASE7_FDIV_LOW_ID)
+	{
+		msub = CGU_SB_FDC_MSUB_GET(fdcVal);
+		madd = CGU_SB_FDC_MADD_GET(fdcVal);
+	}
+	else
+	{
+		msub = CGU_SB_FDC17_MSUB_GET(fdcVal);
+		madd = CGU_SB_FDC17_MADD_GET(fdcVal);
+	}
+
+	/* remove trailing zeros */
+	while (madd && !(msub & 1)  && !(madd & 1))
+	{
+		madd = madd >> 1;
+		msub = msub >> 1;
+	}
+	/* compute m and n values */
+	fdivCfg->n = - msub;
+	fdivCfg->m = madd + fdivCfg->n;
+	fdivCfg->stretch = (fdcVal & CGU_SB_FDC_STRETCH) ? 1 : 0;
+
+	return 0;
+}
+
+/***********************************************************************
+* Reprogram several fractional dividers of a domain at once. The domain
+* runs from FFAST meanwhile and the dividers restart together, so the
+* clocks derived from them keep their phase relation.
+**********************************************************************/
+void cgu_set_domain_fdivs(CGU_DOMAIN_ID_T domainId, u32 fdmask,
+	const CGU_FDIV_SETUP_T *fdivCfg)
+{
+	u32 base_freq, bcrId, fdId;
+
+	/* store base freq */
+	base_freq = CGU_SB_SSR_FS_GET(CGU_SB->base_ssr[domainId]);
+	/* switch domain to FFAST */
+	cgu_set_base_freq(domainId, CGU_FIN_SELECT_FFAST);
+	/* check if the domain has a BCR*/
+	bcrId = cgu_DomainId2bcrid(domainId);
+	/* disable all BCRs */
+	if (bcrId != CGU_INVALID_ID)
+	{
+		CGU_SB->base_bcr[bcrId] = 0;
+	}
+	/* change fractional dividers */
+	for (fdId = 0; fdId < CGU_SB_NR_FRACDIV; fdId++)
+	{
+		if (fdmask & _BIT(fdId))
+			cgu_fdiv_config(fdId, fdivCfg[fdId], 1);
+	}
+	/* enable BCRs */
+	if (bcrId != CGU_INVALID_ID)
+	{
+		CGU_SB->base_bcr[bcrId] = CGU_SB_BCR_FD_RUN;
+	}
+	/* switch domain to original base frequency */
+	cgu_set_base_freq(domainId, base_freq);
+}
+
 /***********************************************************************
 * CGU driver public functions
 ***********************************************************************/
@@ -558,8 +635,7 @@ u32 cgu_get_clk_freq(CGU_CLOCK_ID_T clkid)
 	u32 freq = 0;
 	CGU_DOMAIN_ID_T domainId;
 	u32 subDomainId;
-	int n, m;
-	u32 fdcVal;
+	CGU_FDIV_SETUP_T fdiv_cfg;
 
 	/* get domain and frac div info for the clock */
 	cgu_ClkId2DomainId(clkid, &domainId, &subDomainId);
@@ -572,43 +648,15 @@ u32 cgu_get_clk_freq(CGU_CLOCK_ID_T clkid)
 	{
 		return freq;
 	}
-	/* read frac div control register value */
-	fdcVal = CGU_SB->base_fdc[subDomainId];
-
-	if (fdcVal & CGU_SB_FDC_RUN) /* Is the fracdiv enabled ?*/
+	if (cgu_fdiv_get(subDomainId, &fdiv_cfg) == 0)
 	{
-		/* Yes, so reverse calculation of madd and msub */
-		{
-			int msub, madd;
-
-			if (subDomainId != CGU_SB_BASE7_FDIV_LOW_ID)
-			{
-				msub = CGU_SB_FDC_MSUB_GET(fdcVal);
-				madd = CGU_SB_FDC_MADD_GET(fdcVal);
-			}
-			else
-			{
-				msub = CGU_SB_FDC17_MSUB_GET(fdcVal);
-				madd = CGU_SB_FDC17_MADD_GET(fdcVal);
-			}
-
-			/* remove trailing zeros */
-			while (!(msub & 1)  && !(madd & 1))
-			{
-				madd = madd >> 1;
-				msub = msub >> 1;
-			}
-			/* compute m and n values */
-			n = - msub;
-			m = madd + n;
-		}
 		/* check m and n are non-zero values */
-		if ((n == 0) || (m == 0))
+		if ((fdiv_cfg.n == 0) || (fdiv_cfg.m == 0))
 		{
 			return 0;
 		}
 		/* calculate the frequency based on m and n values */
-		freq = (freq * n) / m ;
+		freq = (freq * fdiv_cfg.n) / fdiv_cfg.m ;
 	}
 	/* else There is no fractional divider in the clocks path */
 
@@ -760,3 +808,5 @@ EXPORT_SYMBOL(cgu_get_pll_freq);
 EXPORT_SYMBOL(cgu_set_subdomain_freq);
 EXPORT_SYMBOL(cgu_hpll_config);
 EXPORT_SYMBOL(cgu_clk_set_exten);
+EXPORT_SYMBOL(cgu_fdiv_get);
+EXPORT_SYMBOL(cgu_set_domain_fdivs);
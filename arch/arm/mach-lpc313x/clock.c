@@ -0,0 +1,737 @@
+/*  arch/arm/mach-lpc313x/clock.c
+ *
+ * <linux/clk.h> API for LPC313x & LPC315x, on top of cgu.c.
+ *
+ * The clock tree mirrors the CGU: the CGU inputs (FFAST, the I2S inputs
+ * and the two HPLLs) feed the base domains, each base domain feeds its
+ * fractional dividers, and every clock of a domain runs either from one
+ * of these dividers or directly from the base, as selected by its ESR.
+ * Clocks are named after their CGU_SB_*_ID without prefix and suffix,
+ * in lower case, e.g. "nandflash_nand_clk".
+ *
+ * An enabled clock holds one reference on its parent. Only the clocks
+ * at the leaves are gated in hardware, when their count drops to zero;
+ * domains, dividers and inputs are counted so that the tree shows what
+ * keeps them busy. Rates are always read back from the CGU, so a change
+ * of a divider or of a domain input shows in every clock below it.
+ * Clocks still switched with cgu_clk_en_dis() are not counted.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/err.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/clk.h>
+#include <linux/debugfs.h>
+
+#include <asm/div64.h>
+
+#include <mach/hardware.h>
+#include <mach/cgu.h>
+
+enum {
+	CLK_TYPE_INPUT,		/* id = CGU_FIN_SELECT_* */
+	CLK_TYPE_BASE,		/* id = CGU_DOMAIN_ID_T */
+	CLK_TYPE_FDIV,		/* id = fractional divider */
+	CLK_TYPE_LEAF,		/* id = CGU_CLOCK_ID_T */
+};
+
+/* Counted, but never gated: the system can't run without them */
+#define CLK_FLAG_NOGATE		_BIT(0)
+
+struct clk {
+	const char *name;
+	u8 type;
+	u8 flags;
+	u16 id;
+	struct clk *parent;
+	u32 usecount;
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *dent;
+#endif
+};
+
+static DEFINE_SPINLOCK(clocks_lock);
+
+static struct clk lpc313x_inputs[CGU_FIN_SELECT_MAX] = {
+	[CGU_FIN_SELECT_FFAST] = { .name = "ffast" },
+	[CGU_FIN_SELECT_XT_DAI_BCK0] = { .name = "xt_dai_bck0" },
+	[CGU_FIN_SELECT_XT_DAI_WS0] = { .name = "xt_dai_ws0" },
+	[CGU_FIN_SELECT_XT_DAI_BCK1] = { .name = "xt_dai_bck1" },
+	[CGU_FIN_SELECT_XT_DAI_WS1] = { .name = "xt_dai_ws1" },
+	[CGU_FIN_SELECT_HPPLL0] = { .name = "hpll0" },
+	[CGU_FIN_SELECT_HPPLL1] = { .name = "hpll1" },
+};
+
+static struct clk lpc313x_bases[CGU_SB_NR_BASE] = {
+	[CGU_SB_SYS_BASE_ID] = { .name = "sys_base" },
+	[CGU_SB_AHB0_APB0_BASE_ID] = { .name = "ahb0_apb0_base" },
+	[CGU_SB_AHB0_APB1_BASE_ID] = { .name = "ahb0_apb1_base" },
+	[CGU_SB_AHB0_APB2_BASE_ID] = { .name = "ahb0_apb2_base" },
+	[CGU_SB_AHB0_APB3_BASE_ID] = { .name = "ahb0_apb3_base" },
+	[CGU_SB_IPINT_BASE_ID] = { .name = "ipint_base" },
+	[CGU_SB_UARTCLK_BASE_ID] = { .name = "uartclk_base" },
+	[CGU_SB_CLK1024FS_BASE_ID] = { .name = "clk1024fs_base" },
+	[CGU_SB_I2SRX_BCK0_BASE_ID] = { .name = "i2srx_bck0_base" },
+	[CGU_SB_I2SRX_BCK1_BASE_ID] = { .name = "i2srx_bck1_base" },
+	[CGU_SB_SPI_CLK_BASE_ID] = { .name = "spi_clk_base" },
+	[CGU_SB_SYSCLK_O_BASE_ID] = { .name = "sysclk_o_base" },
+};
+
+/* First fractional divider of each domain, CGU_INVALID_ID if none */
+static const u16 lpc313x_fdiv_low[CGU_SB_NR_BASE] = {
+	[CGU_SB_SYS_BASE_ID] = CGU_SB_BASE0_FDIV_LOW_ID,
+	[CGU_SB_AHB0_APB0_BASE_ID] = CGU_SB_BASE1_FDIV_LOW_ID,
+	[CGU_SB_AHB0_APB1_BASE_ID] = CGU_SB_BASE2_FDIV_LOW_ID,
+	[CGU_SB_AHB0_APB2_BASE_ID] = CGU_SB_BASE3_FDIV_LOW_ID,
+	[CGU_SB_AHB0_APB3_BASE_ID] = CGU_SB_BASE4_FDIV_LOW_ID,
+	[CGU_SB_IPINT_BASE_ID] = CGU_SB_BASE5_FDIV_LOW_ID,
+	[CGU_SB_UARTCLK_BASE_ID] = CGU_SB_BASE6_FDIV_LOW_ID,
+	[CGU_SB_CLK1024FS_BASE_ID] = CGU_SB_BASE7_FDIV_LOW_ID,
+	[CGU_SB_I2SRX_BCK0_BASE_ID] = CGU_INVALID_ID,
+	[CGU_SB_I2SRX_BCK1_BASE_ID] = CGU_INVALID_ID,
+	[CGU_SB_SPI_CLK_BASE_ID] = CGU_SB_BASE10_FDIV_LOW_ID,
+	[CGU_SB_SYSCLK_O_BASE_ID] = CGU_INVALID_ID,
+};
+
+static struct clk lpc313x_fdivs[CGU_SB_NR_FRACDIV] = {
+	{ .name = "sys_fdiv0" },
+	{ .name = "sys_fdiv1" },
+	{ .name = "sys_fdiv2" },
+	{ .name = "sys_fdiv3" },
+	{ .name = "sys_fdiv4" },
+	{ .name = "sys_fdiv5" },
+	{ .name = "sys_fdiv6" },
+	{ .name = "ahb0_apb0_fdiv0" },
+	{ .name = "ahb0_apb0_fdiv1" },
+	{ .name = "ahb0_apb1_fdiv0" },
+	{ .name = "ahb0_apb1_fdiv1" },
+	{ .name = "ahb0_apb2_fdiv0" },
+	{ .name = "ahb0_apb2_fdiv1" },
+	{ .name = "ahb0_apb2_fdiv2" },
+	{ .name = "ahb0_apb3_fdiv0" },
+	{ .name = "ipint_fdiv0" },
+	{ .name = "uartclk_fdiv0" },
+	{ .name = "clk1024fs_fdiv0" },
+	{ .name = "clk1024fs_fdiv1" },
+	{ .name = "clk1024fs_fdiv2" },
+	{ .name = "clk1024fs_fdiv3" },
+	{ .name = "clk1024fs_fdiv4" },
+	{ .name = "clk1024fs_fdiv5" },
+	{ .name = "spi_clk_fdiv0" },
+};
+
+static const char *lpc313x_clk_names[CGU_SB_NR_CLK] = {
+	[CGU_SB_APB0_CLK_ID] = "apb0_clk",
+	[CGU_SB_APB1_CLK_ID] = "apb1_clk",
+	[CGU_SB_APB2_CLK_ID] = "apb2_clk",
+	[CGU_SB_APB3_CLK_ID] = "apb3_clk",
+	[CGU_SB_APB4_CLK_ID] = "apb4_clk",
+	[CGU_SB_AHB2INTC_CLK_ID] = "ahb2intc_clk",
+	[CGU_SB_AHB0_CLK_ID] = "ahb0_clk",
+	[CGU_SB_EBI_CLK_ID] = "ebi_clk",
+	[CGU_SB_DMA_PCLK_ID] = "dma_pclk",
+	[CGU_SB_DMA_CLK_GATED_ID] = "dma_clk_gated",
+	[CGU_SB_NANDFLASH_S0_CLK_ID] = "nandflash_s0_clk",
+	[CGU_SB_NANDFLASH_ECC_CLK_ID] = "nandflash_ecc_clk",
+	[CGU_SB_NANDFLASH_AES_CLK_ID] = "nandflash_aes_clk",
+	[CGU_SB_NANDFLASH_NAND_CLK_ID] = "nandflash_nand_clk",
+	[CGU_SB_NANDFLASH_PCLK_ID] = "nandflash_pclk",
+	[CGU_SB_CLOCK_OUT_ID] = "clock_out",
+	[CGU_SB_ARM926_CORE_CLK_ID] = "arm926_core_clk",
+	[CGU_SB_ARM926_BUSIF_CLK_ID] = "arm926_busif_clk",
+	[CGU_SB_ARM926_RETIME_CLK_ID] = "arm926_retime_clk",
+	[CGU_SB_SD_MMC_HCLK_ID] = "sd_mmc_hclk",
+	[CGU_SB_SD_MMC_CCLK_IN_ID] = "sd_mmc_cclk_in",
+	[CGU_SB_USB_OTG_AHB_CLK_ID] = "usb_otg_ahb_clk",
+	[CGU_SB_ISRAM0_CLK_ID] = "isram0_clk",
+	[CGU_SB_RED_CTL_RSCLK_ID] = "red_ctl_rsclk",
+	[CGU_SB_ISRAM1_CLK_ID] = "isram1_clk",
+	[CGU_SB_ISROM_CLK_ID] = "isrom_clk",
+	[CGU_SB_MPMC_CFG_CLK_ID] = "mpmc_cfg_clk",
+	[CGU_SB_MPMC_CFG_CLK2_ID] = "mpmc_cfg_clk2",
+	[CGU_SB_MPMC_CFG_CLK3_ID] = "mpmc_cfg_clk3",
+	[CGU_SB_INTC_CLK_ID] = "intc_clk",
+	[CGU_SB_AHB2APB0_ASYNC_PCLK_ID] = "ahb2apb0_async_pclk",
+	[CGU_SB_EVENT_ROUTER_PCLK_ID] = "event_router_pclk",
+	[CGU_SB_ADC_PCLK_ID] = "adc_pclk",
+	[CGU_SB_ADC_CLK_ID] = "adc_clk",
+	[CGU_SB_WDOG_PCLK_ID] = "wdog_pclk",
+	[CGU_SB_IOCONF_PCLK_ID] = "ioconf_pclk",
+	[CGU_SB_CGU_PCLK_ID] = "cgu_pclk",
+	[CGU_SB_SYSCREG_PCLK_ID] = "syscreg_pclk",
+	[CGU_SB_OTP_PCLK_ID] = "otp_pclk",
+	[CGU_SB_RNG_PCLK_ID] = "rng_pclk",
+	[CGU_SB_AHB2APB1_ASYNC_PCLK_ID] = "ahb2apb1_async_pclk",
+	[CGU_SB_TIMER0_PCLK_ID] = "timer0_pclk",
+	[CGU_SB_TIMER1_PCLK_ID] = "timer1_pclk",
+	[CGU_SB_TIMER2_PCLK_ID] = "timer2_pclk",
+	[CGU_SB_TIMER3_PCLK_ID] = "timer3_pclk",
+	[CGU_SB_PWM_PCLK_ID] = "pwm_pclk",
+	[CGU_SB_PWM_PCLK_REGS_ID] = "pwm_pclk_regs",
+	[CGU_SB_PWM_CLK_ID] = "pwm_clk",
+	[CGU_SB_I2C0_PCLK_ID] = "i2c0_pclk",
+	[CGU_SB_I2C1_PCLK_ID] = "i2c1_pclk",
+	[CGU_SB_AHB2APB2_ASYNC_PCLK_ID] = "ahb2apb2_async_pclk",
+	[CGU_SB_PCM_PCLK_ID] = "pcm_pclk",
+	[CGU_SB_PCM_APB_PCLK_ID] = "pcm_apb_pclk",
+	[CGU_SB_UART_APB_CLK_ID] = "uart_apb_clk",
+	[CGU_SB_LCD_PCLK_ID] = "lcd_pclk",
+	[CGU_SB_LCD_CLK_ID] = "lcd_clk",
+	[CGU_SB_SPI_PCLK_ID] = "spi_pclk",
+	[CGU_SB_SPI_PCLK_GATED_ID] = "spi_pclk_gated",
+	[CGU_SB_AHB2APB3_ASYNC_PCLK_ID] = "ahb2apb3_async_pclk",
+	[CGU_SB_I2S_CFG_PCLK_ID] = "i2s_cfg_pclk",
+	[CGU_SB_EDGE_DET_PCLK_ID] = "edge_det_pclk",
+	[CGU_SB_I2STX_FIFO_0_PCLK_ID] = "i2stx_fifo_0_pclk",
+	[CGU_SB_I2STX_IF_0_PCLK_ID] = "i2stx_if_0_pclk",
+	[CGU_SB_I2STX_FIFO_1_PCLK_ID] = "i2stx_fifo_1_pclk",
+	[CGU_SB_I2STX_IF_1_PCLK_ID] = "i2stx_if_1_pclk",
+	[CGU_SB_I2SRX_FIFO_0_PCLK_ID] = "i2srx_fifo_0_pclk",
+	[CGU_SB_I2SRX_IF_0_PCLK_ID] = "i2srx_if_0_pclk",
+	[CGU_SB_I2SRX_FIFO_1_PCLK_ID] = "i2srx_fifo_1_pclk",
+	[CGU_SB_I2SRX_IF_1_PCLK_ID] = "i2srx_if_1_pclk",
+	[CGU_SB_RSVD69_ID] = "rsvd69",
+	[CGU_SB_AHB2APB3_RSVD_ID] = "ahb2apb3_rsvd",
+	[CGU_SB_PCM_CLK_IP_ID] = "pcm_clk_ip",
+	[CGU_SB_UART_U_CLK_ID] = "uart_u_clk",
+	[CGU_SB_I2S_EDGE_DETECT_CLK_ID] = "i2s_edge_detect_clk",
+	[CGU_SB_I2STX_BCK0_N_ID] = "i2stx_bck0_n",
+	[CGU_SB_I2STX_WS0_ID] = "i2stx_ws0",
+	[CGU_SB_I2STX_CLK0_ID] = "i2stx_clk0",
+	[CGU_SB_I2STX_BCK1_N_ID] = "i2stx_bck1_n",
+	[CGU_SB_I2STX_WS1_ID] = "i2stx_ws1",
+	[CGU_SB_CLK_256FS_ID] = "clk_256fs",
+	[CGU_SB_I2SRX_BCK0_N_ID] = "i2srx_bck0_n",
+	[CGU_SB_I2SRX_WS0_ID] = "i2srx_ws0",
+	[CGU_SB_I2SRX_BCK1_N_ID] = "i2srx_bck1_n",
+	[CGU_SB_I2SRX_WS1_ID] = "i2srx_ws1",
+	[CGU_SB_RSVD84_ID] = "rsvd84",
+	[CGU_SB_RSVD85_ID] = "rsvd85",
+	[CGU_SB_RSVD86_ID] = "rsvd86",
+	[CGU_SB_I2SRX_BCK0_ID] = "i2srx_bck0",
+	[CGU_SB_I2SRX_BCK1_ID] = "i2srx_bck1",
+	[CGU_SB_SPI_CLK_ID] = "spi_clk",
+	[CGU_SB_SPI_CLK_GATED_ID] = "spi_clk_gated",
+	[CGU_SB_SYSCLK_O_ID] = "sysclk_o",
+};
+
+static const CGU_CLOCK_ID_T lpc313x_nogate_clks[] = {
+	CGU_SB_APB0_CLK_ID,
+	CGU_SB_APB1_CLK_ID,
+	CGU_SB_APB2_CLK_ID,
+	CGU_SB_APB3_CLK_ID,
+	CGU_SB_APB4_CLK_ID,
+	CGU_SB_AHB2INTC_CLK_ID,
+	CGU_SB_AHB0_CLK_ID,
+	CGU_SB_ARM926_CORE_CLK_ID,
+	CGU_SB_ARM926_BUSIF_CLK_ID,
+	CGU_SB_ARM926_RETIME_CLK_ID,
+	CGU_SB_ISRAM0_CLK_ID,
+	CGU_SB_MPMC_CFG_CLK_ID,
+	CGU_SB_MPMC_CFG_CLK2_ID,
+	CGU_SB_MPMC_CFG_CLK3_ID,
+	CGU_SB_INTC_CLK_ID,
+	CGU_SB_AHB2APB0_ASYNC_PCLK_ID,
+	CGU_SB_EVENT_ROUTER_PCLK_ID,
+	CGU_SB_IOCONF_PCLK_ID,
+	CGU_SB_CGU_PCLK_ID,
+	CGU_SB_SYSCREG_PCLK_ID,
+	CGU_SB_AHB2APB1_ASYNC_PCLK_ID,
+	CGU_SB_TIMER0_PCLK_ID,
+	CGU_SB_TIMER1_PCLK_ID,
+	CGU_SB_AHB2APB2_ASYNC_PCLK_ID,
+	CGU_SB_AHB2APB3_ASYNC_PCLK_ID,
+};
+
+static struct clk lpc313x_clks[CGU_SB_NR_CLK];
+
+static inline CGU_DOMAIN_ID_T lpc313x_fdiv_domain(u32 fd)
+{
+	int domain = CGU_SB_BASE_LAST;
+
+	while (lpc313x_fdiv_low[domain] == CGU_INVALID_ID ||
+			lpc313x_fdiv_low[domain] > fd)
+		domain--;
+
+	return domain;
+}
+
+/* Parent of a clock as currently set in the CGU */
+static struct clk *lpc313x_clk_hw_parent(struct clk *clk)
+{
+	CGU_DOMAIN_ID_T domain;
+	u32 fd;
+
+	switch (clk->type) {
+	case CLK_TYPE_BASE:
+		return &lpc313x_inputs[CGU_SB_SSR_FS_GET(CGU_SB->base_ssr[clk->id])];
+
+	case CLK_TYPE_FDIV:
+		return &lpc313x_bases[lpc313x_fdiv_domain(clk->id)];
+
+	case CLK_TYPE_LEAF:
+		cgu_ClkId2DomainId(clk->id, &domain, &fd);
+		if (fd == CGU_INVALID_ID)
+			return &lpc313x_bases[domain];
+		return &lpc313x_fdivs[fd];
+	}
+
+	return NULL;
+}
+
+static unsigned long lpc313x_clk_rate(struct clk *clk)
+{
+	CGU_FDIV_SETUP_T cfg;
+	u64 rate;
+
+	switch (clk->type) {
+	case CLK_TYPE_INPUT:
+		if (clk->id == CGU_FIN_SELECT_FFAST)
+			return FFAST_CLOCK;
+		if (clk->id >= CGU_FIN_SELECT_HPPLL0) {
+			rate = cgu_get_pll_freq(clk->id - CGU_FIN_SELECT_HPPLL0,
+				FFAST_CLOCK);
+			return rate == (u32)-1 ? 0 : rate;
+		}
+		return g_clkin_freq[clk->id];
+
+	case CLK_TYPE_FDIV:
+		rate = lpc313x_clk_rate(lpc313x_clk_hw_parent(clk));
+		if (cgu_fdiv_get(clk->id, &cfg) == 0 && cfg.m) {
+			rate *= cfg.n;
+			do_div(rate, cfg.m);
+		}
+		return rate;
+
+	default:
+		return lpc313x_clk_rate(lpc313x_clk_hw_parent(clk));
+	}
+}
+
+static void __clk_enable(struct clk *clk)
+{
+	if (clk->usecount++)
+		return;
+
+	if (clk->parent)
+		__clk_enable(clk->parent);
+	if (clk->type == CLK_TYPE_LEAF)
+		CGU_SB->clk_pcr[clk->id] |= CGU_SB_PCR_RUN;
+}
+
+static void __clk_disable(struct clk *clk)
+{
+	if (WARN_ON(clk->usecount == 0))
+		return;
+	if (--clk->usecount)
+		return;
+
+	if (clk->type == CLK_TYPE_LEAF && !(clk->flags & CLK_FLAG_NOGATE))
+		CGU_SB->clk_pcr[clk->id] &= ~CGU_SB_PCR_RUN;
+	if (clk->parent)
+		__clk_disable(clk->parent);
+}
+
+/*
+ * Best n/m for rate from parent, not above rate. Returns the rate
+ * reached, 0 if there is none.
+ */
+static unsigned long lpc313x_fdiv_best(u32 fd, unsigned long parent,
+		unsigned long rate, CGU_FDIV_SETUP_T *cfg)
+{
+	u32 maxm, m, width = CGU_SB_BASE0_FDIV0_W;
+	unsigned long best = 0;
+	u64 n, r;
+
+	if (fd == CGU_SB_BASE7_FDIV_LOW_ID)
+		width = CGU_SB_BASE7_FDIV0_W;
+	maxm = (1 << width) - 1;
+
+	if (rate >= parent) {
+		cfg->n = cfg->m = 1;
+		return parent;
+	}
+
+	for (m = 2; m <= maxm && best != rate; m++) {
+		n = (u64)rate * m;
+		do_div(n, parent);
+		if (n == 0)
+			continue;
+
+		r = (u64)parent * n;
+		do_div(r, m);
+		if (r > best) {
+			best = r;
+			cfg->n = n;
+			cfg->m = m;
+		}
+	}
+
+	return best;
+}
+
+static int lpc313x_fdiv_shared(struct clk *clk, struct clk *fdiv)
+{
+	CGU_DOMAIN_ID_T domain;
+	u32 fd;
+	int i;
+
+	for (i = 0; i < CGU_SB_NR_CLK; i++) {
+		if (&lpc313x_clks[i] == clk ||
+			!(CGU_SB->clk_pcr[i] & CGU_SB_PCR_RUN))
+			continue;
+		cgu_ClkId2DomainId(i, &domain, &fd);
+		if (fd == fdiv->id)
+			return 1;
+	}
+
+	return 0;
+}
+
+struct clk *clk_get(struct device *dev, const char *id)
+{
+	int i;
+
+	if (id == NULL)
+		return ERR_PTR(-ENOENT);
+
+	for (i = 0; i < CGU_SB_NR_CLK; i++)
+		if (lpc313x_clks[i].name && !strcmp(id, lpc313x_clks[i].name))
+			return &lpc313x_clks[i];
+	for (i = 0; i < CGU_SB_NR_FRACDIV; i++)
+		if (!strcmp(id, lpc313x_fdivs[i].name))
+			return &lpc313x_fdivs[i];
+	for (i = 0; i < CGU_SB_NR_BASE; i++)
+		if (!strcmp(id, lpc313x_bases[i].name))
+			return &lpc313x_bases[i];
+	for (i = 0; i < CGU_FIN_SELECT_MAX; i++)
+		if (!strcmp(id, lpc313x_inputs[i].name))
+			return &lpc313x_inputs[i];
+
+	return ERR_PTR(-ENOENT);
+}
+EXPORT_SYMBOL(clk_get);
+
+void clk_put(struct clk *clk)
+{
+}
+EXPORT_SYMBOL(clk_put);
+
+int clk_enable(struct clk *clk)
+{
+	unsigned long flags;
+
+	if (clk == NULL || IS_ERR(clk))
+		return -EINVAL;
+
+	spin_lock_irqsave(&clocks_lock, flags);
+	__clk_enable(clk);
+	spin_unlock_irqrestore(&clocks_lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL(clk_enable);
+
+void clk_disable(struct clk *clk)
+{
+	unsigned long flags;
+
+	if (clk == NULL || IS_ERR(clk))
+		return;
+
+	spin_lock_irqsave(&clocks_lock, flags);
+	__clk_disable(clk);
+	spin_unlock_irqrestore(&clocks_lock, flags);
+}
+EXPORT_SYMBOL(clk_disable);
+
+unsigned long clk_get_rate(struct clk *clk)
+{
+	if (clk == NULL || IS_ERR(clk))
+		return 0;
+
+	return lpc313x_clk_rate(clk);
+}
+EXPORT_SYMBOL(clk_get_rate);
+
+/*
+ * Only clocks which have a fractional divider can change their rate,
+ * by reprogramming the divider. The largest rate not above the
+ * requested one is used.
+ */
+long clk_round_rate(struct clk *clk, unsigned long rate)
+{
+	struct clk *fdiv;
+	CGU_FDIV_SETUP_T cfg;
+
+	if (clk == NULL || IS_ERR(clk) || clk->type != CLK_TYPE_LEAF)
+		return -EINVAL;
+
+	fdiv = lpc313x_clk_hw_parent(clk);
+	if (fdiv->type != CLK_TYPE_FDIV ||
+			lpc313x_fdiv_domain(fdiv->id) == CGU_SB_SYS_BASE_ID)
+		return lpc313x_clk_rate(clk);
+
+	return lpc313x_fdiv_best(fdiv->id,
+		lpc313x_clk_rate(lpc313x_clk_hw_parent(fdiv)), rate, &cfg);
+}
+EXPORT_SYMBOL(clk_round_rate);
+
+/*
+ * The divider must not feed any other running clock, or their rates
+ * would change behind their drivers' backs. The SYS domain dividers
+ * clock the CPU, the buses and the SDRAM controller; they belong to
+ * cpufreq, which rescales MPMC_DYNREF around every switch.
+ */
+int clk_set_rate(struct clk *clk, unsigned long rate)
+{
+	CGU_FDIV_SETUP_T cfg[CGU_SB_NR_FRACDIV], cur;
+	unsigned long flags;
+	struct clk *fdiv;
+	CGU_DOMAIN_ID_T domain;
+	int ret = 0;
+
+	if (clk == NULL || IS_ERR(clk) || clk->type != CLK_TYPE_LEAF ||
+			rate == 0)
+		return -EINVAL;
+
+	spin_lock_irqsave(&clocks_lock, flags);
+
+	fdiv = lpc313x_clk_hw_parent(clk);
+	if (fdiv->type != CLK_TYPE_FDIV) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (lpc313x_fdiv_shared(clk, fdiv)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	domain = lpc313x_fdiv_domain(fdiv->id);
+	if (domain == CGU_SB_SYS_BASE_ID) {
+		ret = -EBUSY;
+		goto out;
+	}
+	if (!lpc313x_fdiv_best(fdiv->id, lpc313x_clk_rate(&lpc313x_bases[domain]),
+			rate, &cfg[fdiv->id])) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* an integer divider keeps a 50% duty cycle */
+	if (cgu_fdiv_get(fdiv->id, &cur) == 0)
+		cfg[fdiv->id].stretch = cur.stretch;
+	else
+		cfg[fdiv->id].stretch = (cfg[fdiv->id].n == 1 &&
+			cfg[fdiv->id].m > 1);
+
+	cgu_set_domain_fdivs(domain, _BIT(fdiv->id), cfg);
+
+out:
+	spin_unlock_irqrestore(&clocks_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(clk_set_rate);
+
+struct clk *clk_get_parent(struct clk *clk)
+{
+	if (clk == NULL || IS_ERR(clk))
+		return NULL;
+
+	return clk->parent;
+}
+EXPORT_SYMBOL(clk_get_parent);
+
+#ifdef CONFIG_DEBUG_FS
+static void lpc313x_clk_debugfs_reparent(struct clk *clk);
+#else
+static inline void lpc313x_clk_debugfs_reparent(struct clk *clk) {}
+#endif
+
+/*
+ * A domain can take any CGU input, a clock can run from the base or any
+ * fractional divider of its domain.
+ */
+int clk_set_parent(struct clk *clk, struct clk *parent)
+{
+	CGU_DOMAIN_ID_T domain;
+	unsigned long flags;
+	u32 fd, esr;
+
+	if (clk == NULL || IS_ERR(clk) || parent == NULL || IS_ERR(parent))
+		return -EINVAL;
+
+	spin_lock_irqsave(&clocks_lock, flags);
+
+	switch (clk->type) {
+	case CLK_TYPE_BASE:
+		/* SYS belongs to cpufreq, see clk_set_rate() */
+		if (parent->type != CLK_TYPE_INPUT ||
+				clk->id == CGU_SB_SYS_BASE_ID)
+			goto err;
+		cgu_set_base_freq(clk->id, parent->id);
+		break;
+
+	case CLK_TYPE_LEAF:
+		esr = cgu_clkid2esrid(clk->id);
+		if (esr == CGU_INVALID_ID)
+			goto err;
+		cgu_ClkId2DomainId(clk->id, &domain, &fd);
+		if (domain == CGU_SB_SYS_BASE_ID)
+			goto err;
+		if (parent == &lpc313x_bases[domain])
+			CGU_SB->clk_esr[esr] = 0;
+		else if (parent->type == CLK_TYPE_FDIV &&
+				lpc313x_fdiv_domain(parent->id) == domain)
+			CGU_SB->clk_esr[esr] = CGU_SB_ESR_ENABLE |
+				CGU_SB_ESR_SELECT(parent->id -
+					lpc313x_fdiv_low[domain]);
+		else
+			goto err;
+		break;
+
+	default:
+		goto err;
+	}
+
+	if (clk->usecount) {
+		__clk_enable(parent);
+		__clk_disable(clk->parent);
+	}
+	clk->parent = parent;
+
+	spin_unlock_irqrestore(&clocks_lock, flags);
+
+	lpc313x_clk_debugfs_reparent(clk);
+
+	return 0;
+
+err:
+	spin_unlock_irqrestore(&clocks_lock, flags);
+
+	return -EINVAL;
+}
+EXPORT_SYMBOL(clk_set_parent);
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * debugfs "clock": one directory per clock below its parent's, with the
+ * use count, the rate and, for the leaves, whether the CGU runs it.
+ */
+static struct dentry *lpc313x_clk_debugfs_root;
+
+static int lpc313x_clk_rate_get(void *data, u64 *val)
+{
+	*val = lpc313x_clk_rate(data);
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lpc313x_clk_rate_fops, lpc313x_clk_rate_get,
+	NULL, "%llu\n");
+
+static int lpc313x_clk_running_get(void *data, u64 *val)
+{
+	struct clk *clk = data;
+
+	*val = (CGU_SB->clk_pcr[clk->id] & CGU_SB_PCR_RUN) ? 1 : 0;
+
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(lpc313x_clk_running_fops, lpc313x_clk_running_get,
+	NULL, "%llu\n");
+
+static void lpc313x_clk_debugfs_add(struct clk *clk)
+{
+	struct dentry *parent = clk->parent ? clk->parent->dent :
+		lpc313x_clk_debugfs_root;
+
+	clk->dent = debugfs_create_dir(clk->name, parent);
+	if (!clk->dent)
+		return;
+
+	debugfs_create_u32("usecount", S_IRUGO, clk->dent, &clk->usecount);
+	debugfs_create_file("rate", S_IRUGO, clk->dent, clk,
+		&lpc313x_clk_rate_fops);
+	if (clk->type == CLK_TYPE_LEAF)
+		debugfs_create_file("running", S_IRUGO, clk->dent, clk,
+			&lpc313x_clk_running_fops);
+}
+
+static void lpc313x_clk_debugfs_reparent(struct clk *clk)
+{
+	if (clk->dent && clk->parent->dent)
+		debugfs_rename(clk->dent->d_parent, clk->dent,
+			clk->parent->dent, clk->name);
+}
+
+static void __init lpc313x_clk_debugfs_init(void)
+{
+	int i;
+
+	lpc313x_clk_debugfs_root = debugfs_create_dir("clock", NULL);
+	if (!lpc313x_clk_debugfs_root)
+		return;
+
+	for (i = 0; i < CGU_FIN_SELECT_MAX; i++)
+		lpc313x_clk_debugfs_add(&lpc313x_inputs[i]);
+	for (i = 0; i < CGU_SB_NR_BASE; i++)
+		lpc313x_clk_debugfs_add(&lpc313x_bases[i]);
+	for (i = 0; i < CGU_SB_NR_FRACDIV; i++)
+		lpc313x_clk_debugfs_add(&lpc313x_fdivs[i]);
+	for (i = 0; i < CGU_SB_NR_CLK; i++)
+		if (lpc313x_clks[i].name)
+			lpc313x_clk_debugfs_add(&lpc313x_clks[i]);
+}
+#else
+static inline void lpc313x_clk_debugfs_init(void) {}
+#endif
+
+static int __init lpc313x_clk_init(void)
+{
+	struct clk *clk;
+	int i;
+
+	for (i = 0; i < CGU_FIN_SELECT_MAX; i++) {
+		lpc313x_inputs[i].type = CLK_TYPE_INPUT;
+		lpc313x_inputs[i].id = i;
+	}
+
+	for (i = 0; i < CGU_SB_NR_BASE; i++) {
+		clk = &lpc313x_bases[i];
+		clk->type = CLK_TYPE_BASE;
+		clk->id = i;
+		clk->parent = lpc313x_clk_hw_parent(clk);
+	}
+
+	for (i = 0; i < CGU_SB_NR_FRACDIV; i++) {
+		clk = &lpc313x_fdivs[i];
+		clk->type = CLK_TYPE_FDIV;
+		clk->id = i;
+		clk->parent = lpc313x_clk_hw_parent(clk);
+	}
+
+	for (i = 0; i < CGU_SB_NR_CLK; i++) {
+		clk = &lpc313x_clks[i];
+		clk->name = lpc313x_clk_names[i];
+		clk->type = CLK_TYPE_LEAF;
+		clk->id = i;
+		clk->parent = lpc313x_clk_hw_parent(clk);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nogate_clks); i++)
+		lpc313x_clks[lpc313x_nogate_clks[i]].flags |= CLK_FLAG_NOGATE;
+
+	lpc313x_clk_debugfs_init();
+
+	return 0;
+}
+arch_initcall(lpc313x_clk_init);
@@ -0,0 +1,251 @@
+/*  arch/arm/mach-lpc313x/cpufreq.c
+ *
+ * CPU frequency scaling for LPC313x & LPC315x.
+ *
+ * The ARM core and the AHB side of the SYS domain are clocked from HPLL1
+ * through the SYS fractional dividers. Frequencies are changed by
+ * dividing all of those dividers by the same integer, so HPLL1 keeps
+ * running, the core/bus ratios set by the boot loader are preserved and
+ * the domains UART, I2S, SPI and the timers run from are not touched.
+ * The MCI card clock input, which also comes from a SYS divider, is left
+ * on its own divider. SDRAM refresh is rescaled with the bus clock.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cpufreq.h>
+#include <linux/slab.h>
+
+#include <mach/hardware.h>
+#include <mach/cgu.h>
+
+/* Largest divisor tried, and the lowest AHB clock the table may use */
+#define LPC313X_CPUFREQ_MAX_DIV	8
+static unsigned int min_bus_khz = 30000;	/* USB OTG needs 30MHz */
+module_param(min_bus_khz, uint, 0444);
+
+/* SYS domain clocks which keep their frequency */
+static const CGU_CLOCK_ID_T lpc313x_fixed_clks[] = {
+	CGU_SB_SD_MMC_CCLK_IN_ID,
+	CGU_SB_CLOCK_OUT_ID,
+};
+
+static struct lpc313x_cpufreq {
+	u32 fdmask;			/* SYS dividers which are scaled */
+	CGU_FDIV_SETUP_T boot[CGU_SB_NR_FRACDIV];
+	CGU_FDIV_SETUP_T cfg[CGU_SB_NR_FRACDIV];
+	unsigned int max_khz;		/* core clock with boot settings */
+	u32 refresh;			/* MPMC_DYNREF with boot settings */
+	unsigned int div;		/* current divisor */
+	struct cpufreq_frequency_table table[LPC313X_CPUFREQ_MAX_DIV + 1];
+} lpc313x_cpufreq;
+
+static int lpc313x_cpufreq_is_fixed(CGU_CLOCK_ID_T clkid)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lpc313x_fixed_clks); i++)
+		if (lpc313x_fixed_clks[i] == clkid)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Find the dividers to scale: those of every running SYS clock but the
+ * fixed ones. A running clock without a divider, or a divider shared
+ * with a fixed clock, would not follow and makes scaling impossible.
+ */
+static int __init lpc313x_cpufreq_probe(void)
+{
+	struct lpc313x_cpufreq *c = &lpc313x_cpufreq;
+	CGU_DOMAIN_ID_T domain;
+	u32 fixed = 0, fd;
+	int clk;
+
+	for (clk = CGU_SYS_FIRST; clk <= CGU_SYS_LAST; clk++) {
+		cgu_ClkId2DomainId(clk, &domain, &fd);
+		if (lpc313x_cpufreq_is_fixed(clk)) {
+			if (fd != CGU_INVALID_ID)
+				fixed |= _BIT(fd);
+			continue;
+		}
+
+		if (!(CGU_SB->clk_pcr[clk] & CGU_SB_PCR_RUN))
+			continue;
+
+		if (fd == CGU_INVALID_ID) {
+			printk(KERN_INFO "cpufreq: SYS clock %d has no "
+				"fractional divider\n", clk);
+			return -ENODEV;
+		}
+		c->fdmask |= _BIT(fd);
+	}
+
+	cgu_ClkId2DomainId(CGU_SB_ARM926_CORE_CLK_ID, &domain, &fd);
+	if (fd == CGU_INVALID_ID || (c->fdmask & fixed)) {
+		printk(KERN_INFO "cpufreq: core clock divider can't be "
+			"scaled\n");
+		return -ENODEV;
+	}
+
+	for (fd = 0; fd < CGU_SB_NR_FRACDIV; fd++) {
+		if (!(c->fdmask & _BIT(fd)))
+			continue;
+		if (cgu_fdiv_get(fd, &c->boot[fd]) || !c->boot[fd].m)
+			return -ENODEV;
+	}
+
+	return 0;
+}
+
+/* Can every scaled divider be divided by div? */
+static int lpc313x_cpufreq_div_ok(unsigned int div)
+{
+	struct lpc313x_cpufreq *c = &lpc313x_cpufreq;
+	u32 fd;
+
+	for (fd = 0; fd < CGU_SB_NR_FRACDIV; fd++)
+		if ((c->fdmask & _BIT(fd)) &&
+			c->boot[fd].m * div > (1 << CGU_SB_BASE0_FDIV0_W) - 1)
+			return 0;
+
+	return 1;
+}
+
+/* Called with interrupts off */
+static void lpc313x_cpufreq_set_div(unsigned int div)
+{
+	struct lpc313x_cpufreq *c = &lpc313x_cpufreq;
+	u32 fd;
+
+	for (fd = 0; fd < CGU_SB_NR_FRACDIV; fd++) {
+		if (!(c->fdmask & _BIT(fd)))
+			continue;
+		c->cfg[fd] = c->boot[fd];
+		c->cfg[fd].m *= div;
+		/* an integer divider keeps a 50% duty cycle */
+		if (c->cfg[fd].n == 1 && c->cfg[fd].m > 1)
+			c->cfg[fd].stretch = 1;
+	}
+
+	/*
+	 * The refresh interval is counted in bus clocks: shorten it before
+	 * slowing down, lengthen it after speeding up, so the SDRAM is
+	 * never refreshed less often than with the boot settings.
+	 */
+	if (div > c->div)
+		MPMC_DYNREF = c->refresh / div;
+
+	cgu_set_domain_fdivs(CGU_SB_SYS_BASE_ID, c->fdmask, c->cfg);
+
+	if (div < c->div)
+		MPMC_DYNREF = c->refresh / div;
+
+	c->div = div;
+}
+
+static int lpc313x_cpufreq_verify(struct cpufreq_policy *policy)
+{
+	return cpufreq_frequency_table_verify(policy, lpc313x_cpufreq.table);
+}
+
+static unsigned int lpc313x_cpufreq_get(unsigned int cpu)
+{
+	return lpc313x_cpufreq.max_khz / lpc313x_cpufreq.div;
+}
+
+static int lpc313x_cpufreq_target(struct cpufreq_policy *policy,
+			      unsigned int target_freq,
+			      unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned long flags;
+	unsigned int div;
+	int idx;
+
+	if (cpufreq_frequency_table_target(policy, lpc313x_cpufreq.table,
+				target_freq, relation, &idx))
+		return -EINVAL;
+
+	div = lpc313x_cpufreq.table[idx].index;
+
+	freqs.old = lpc313x_cpufreq_get(0);
+	freqs.new = lpc313x_cpufreq.table[idx].frequency;
+	freqs.cpu = policy->cpu;
+
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+
+	local_irq_save(flags);
+	lpc313x_cpufreq_set_div(div);
+	local_irq_restore(flags);
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+
+	return 0;
+}
+
+static int lpc313x_cpufreq_init(struct cpufreq_policy *policy)
+{
+	struct lpc313x_cpufreq *c = &lpc313x_cpufreq;
+	unsigned int bus_khz, div;
+	int n = 0;
+
+	if (policy->cpu != 0)
+		return -EINVAL;
+
+	c->max_khz = cgu_get_clk_freq(CGU_SB_ARM926_CORE_CLK_ID) / 1000;
+	bus_khz = cgu_get_clk_freq(CGU_SB_AHB0_CLK_ID) / 1000;
+	c->refresh = MPMC_DYNREF;
+	c->div = 1;
+
+	for (div = 1; div <= LPC313X_CPUFREQ_MAX_DIV; div++) {
+		if (div > 1 && bus_khz / div < min_bus_khz)
+			break;
+		if (!lpc313x_cpufreq_div_ok(div))
+			break;
+		c->table[n].index = div;
+		c->table[n].frequency = c->max_khz / div;
+		n++;
+	}
+	c->table[n].frequency = CPUFREQ_TABLE_END;
+
+	policy->cur = c->max_khz;
+	/* domain switch and divider restart, a few FFAST cycles */
+	policy->cpuinfo.transition_latency = 50 * 1000;
+
+	printk(KERN_INFO "cpufreq: LPC313x %u - %u kHz, %d steps\n",
+		c->table[n - 1].frequency, c->max_khz, n);
+
+	return cpufreq_frequency_table_cpuinfo(policy, c->table);
+}
+
+static struct cpufreq_driver lpc313x_cpufreq_driver = {
+	.flags		= CPUFREQ_STICKY,
+	.verify		= lpc313x_cpufreq_verify,
+	.target		= lpc313x_cpufreq_target,
+	.get		= lpc313x_cpufreq_get,
+	.init		= lpc313x_cpufreq_init,
+	.name		= "lpc313x",
+};
+
+static int __init lpc313x_cpufreq_module_init(void)
+{
+	int ret;
+
+	ret = lpc313x_cpufreq_probe();
+	if (ret)
+		return ret;
+
+	return cpufreq_register_driver(&lpc313x_cpufreq_driver);
+}
+module_init(lpc313x_cpufreq_module_init);
@@ -0,0 +1,282 @@
+/*  arch/arm/mach-lpc313x/cpuidle.c
+ *
+ * CPU idle states for LPC313x & LPC315x.
+ *
+ * Three states, each one adding to the previous:
+ *  - WFI:   wait for interrupt.
+ *  - FFAST: the SYS base domain (core, AHB, SDRAM) runs from FFAST
+ *           instead of HPLL1 while waiting.
+ *  - SR:    the SDRAM is also put in self-refresh, the wait runs from
+ *           ISRAM.
+ * The deeper states fall back to a lighter one while the SYS clock or
+ * the SDRAM is needed by another bus master: USB needs the AHB above
+ * 30MHz and DMA transfers may target SDRAM.
+ *
+ * Exit latencies are measured at init by running the exit path once.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/cpuidle.h>
+
+#include <asm/proc-fns.h>
+#include <asm/cacheflush.h>
+#include <asm/div64.h>
+
+#include <mach/hardware.h>
+#include <mach/cgu.h>
+#include <mach/dma.h>
+
+/* The self-refresh code is kept in its ISRAM0 slot */
+#define LPC313X_IDLE_SR_SZ	ISRAM0_IDLE_SIZE
+#define LPC313X_IDLE_SR_VA	(io_p2v(ISRAM0_PHYS) + ISRAM0_IDLE_OFS)
+
+/* USB OTG run/stop */
+#define USB_DEV_USBCMD		__REG(USBOTG_PHYS + 0x140)
+#define USBCMD_RS		_BIT(0)
+
+/* Exit latency (us) of the SR state when it can't be measured */
+#define LPC313X_IDLE_SR_LATENCY	100
+
+extern void lpc313x_idle_sr(int wfi);
+extern int lpc313x_idle_sr_sz;
+
+enum {
+	LPC313X_IDLE_WFI,
+	LPC313X_IDLE_FFAST,
+	LPC313X_IDLE_SR,
+	LPC313X_IDLE_NR_STATES,
+};
+
+static struct cpuidle_driver lpc313x_idle_driver = {
+	.name	= "lpc313x_idle",
+	.owner	= THIS_MODULE,
+};
+
+static DEFINE_PER_CPU(struct cpuidle_device, lpc313x_idle_dev);
+
+static void (*lpc313x_idle_sr_ptr)(int wfi);
+
+/* MPMC_DYNREF scale for FFAST, 8 bit fraction */
+static u32 lpc313x_idle_ffast_scale;
+
+static inline int lpc313x_idle_usb_active(void)
+{
+	return (CGU_SB->clk_pcr[CGU_SB_USB_OTG_AHB_CLK_ID] & CGU_SB_PCR_RUN) &&
+		(USB_DEV_USBCMD & USBCMD_RS);
+}
+
+static inline int lpc313x_idle_dma_active(void)
+{
+	int chn;
+
+	for (chn = 0; chn < DMA_MAX_CHANNELS; chn++)
+		if (dma_channel_enabled(chn))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Switch the SYS domain to FFAST. The SDRAM refresh interval is counted
+ * in bus clocks, so unless the external refresh generator is used it is
+ * shortened first. Returns the input to switch back to.
+ */
+static u32 lpc313x_idle_sys_ffast(u32 *dynref)
+{
+	u32 sel = CGU_SB_SSR_FS_GET(CGU_SB->base_ssr[CGU_SB_SYS_BASE_ID]);
+
+	*dynref = MPMC_DYNREF;
+	if (!lpc313x_ext_refresh_enabled())
+		MPMC_DYNREF = max_t(u32, (*dynref * lpc313x_idle_ffast_scale) >> 8, 1);
+
+	cgu_set_base_freq(CGU_SB_SYS_BASE_ID, CGU_FIN_SELECT_FFAST);
+
+	return sel;
+}
+
+static void lpc313x_idle_sys_restore(u32 sel, u32 dynref)
+{
+	cgu_set_base_freq(CGU_SB_SYS_BASE_ID, sel);
+	MPMC_DYNREF = dynref;
+}
+
+/* The external refresh generator must not run during self-refresh */
+static void lpc313x_idle_sdram_sr(int wfi)
+{
+	int ext_refresh = lpc313x_ext_refresh_enabled();
+
+	if (ext_refresh)
+		lpc313x_ext_refresh_en(0);
+
+	lpc313x_idle_sr_ptr(wfi);
+
+	if (ext_refresh)
+		lpc313x_ext_refresh_en(1);
+}
+
+static inline int lpc313x_idle_ns_to_us(unsigned long long ns)
+{
+	do_div(ns, NSEC_PER_USEC);
+
+	return ns > INT_MAX ? INT_MAX : (int)ns;
+}
+
+static int lpc313x_enter_idle(struct cpuidle_device *dev,
+			      struct cpuidle_state *state)
+{
+	int idx = state - dev->states;
+	unsigned long long t;
+	u32 sel, dynref;
+
+	local_irq_disable();
+	if (need_resched()) {
+		local_irq_enable();
+		return 0;
+	}
+
+	if (idx >= LPC313X_IDLE_FFAST && lpc313x_idle_usb_active())
+		idx = LPC313X_IDLE_WFI;
+	else if (idx == LPC313X_IDLE_SR && lpc313x_idle_dma_active())
+		idx = LPC313X_IDLE_FFAST;
+	dev->last_state = &dev->states[idx];
+
+	t = sched_clock();
+
+	switch (idx) {
+	case LPC313X_IDLE_WFI:
+		cpu_do_idle();
+		break;
+
+	case LPC313X_IDLE_FFAST:
+		sel = lpc313x_idle_sys_ffast(&dynref);
+		cpu_do_idle();
+		lpc313x_idle_sys_restore(sel, dynref);
+		break;
+
+	case LPC313X_IDLE_SR:
+		sel = lpc313x_idle_sys_ffast(&dynref);
+		lpc313x_idle_sdram_sr(1);
+		lpc313x_idle_sys_restore(sel, dynref);
+		break;
+	}
+
+	t = sched_clock() - t;
+	local_irq_enable();
+
+	return lpc313x_idle_ns_to_us(t);
+}
+
+static void lpc313x_idle_wait_ffast(void)
+{
+	int tmo = 1000;
+
+	while (CGU_SB_SSR_FS_GET(CGU_SB->base_ssr[CGU_SB_SYS_BASE_ID]) !=
+			CGU_FIN_SELECT_FFAST && --tmo)
+		;
+}
+
+/*
+ * Time the way back from the FFAST and SR states, the part of the exit
+ * latency which runs at FFAST speed. Waking from WFI itself only takes
+ * a few cycles. Returns the exit latencies in us, rounded up.
+ */
+static void __init lpc313x_idle_measure(unsigned int *ffast, unsigned int *sr)
+{
+	unsigned long long t;
+	unsigned long flags;
+	u32 sel, dynref;
+
+	local_irq_save(flags);
+
+	sel = lpc313x_idle_sys_ffast(&dynref);
+	lpc313x_idle_wait_ffast();
+	t = sched_clock();
+	lpc313x_idle_sys_restore(sel, dynref);
+	*ffast = lpc313x_idle_ns_to_us(sched_clock() - t + NSEC_PER_USEC - 1);
+
+	*sr = LPC313X_IDLE_SR_LATENCY;
+	if (!lpc313x_idle_usb_active() && !lpc313x_idle_dma_active()) {
+		sel = lpc313x_idle_sys_ffast(&dynref);
+		lpc313x_idle_wait_ffast();
+		t = sched_clock();
+		lpc313x_idle_sdram_sr(0);
+		lpc313x_idle_sys_restore(sel, dynref);
+		*sr = lpc313x_idle_ns_to_us(sched_clock() - t +
+			NSEC_PER_USEC - 1);
+	}
+
+	local_irq_restore(flags);
+}
+
+static void __init lpc313x_idle_state(struct cpuidle_device *dev, int idx,
+		const char *name, const char *desc, unsigned int flags,
+		unsigned int exit_latency)
+{
+	struct cpuidle_state *state = &dev->states[idx];
+
+	strcpy(state->name, name);
+	strcpy(state->desc, desc);
+	state->flags = CPUIDLE_FLAG_TIME_VALID | flags;
+	state->exit_latency = exit_latency + 1;
+	/* entering costs about as much as leaving */
+	state->target_residency = 4 * state->exit_latency;
+	state->enter = lpc313x_enter_idle;
+}
+
+static int __init lpc313x_idle_init(void)
+{
+	struct cpuidle_device *dev = &per_cpu(lpc313x_idle_dev, 0);
+	unsigned int ffast_lat, sr_lat;
+	u32 sys_khz;
+
+	if (lpc313x_idle_sr_sz > LPC313X_IDLE_SR_SZ) {
+		printk(KERN_ERR "cpuidle: self-refresh code too large\n");
+		return -ENOMEM;
+	}
+	memcpy((void *)LPC313X_IDLE_SR_VA, &lpc313x_idle_sr,
+			lpc313x_idle_sr_sz);
+	flush_icache_range(LPC313X_IDLE_SR_VA,
+			LPC313X_IDLE_SR_VA + lpc313x_idle_sr_sz);
+	lpc313x_idle_sr_ptr = (void *)LPC313X_IDLE_SR_VA;
+
+	sys_khz = cgu_get_base_freq(CGU_SB_SYS_BASE_ID) / 1000;
+	lpc313x_idle_ffast_scale = ((FFAST_CLOCK / 1000) << 8) / sys_khz;
+
+	lpc313x_idle_measure(&ffast_lat, &sr_lat);
+
+	cpuidle_register_driver(&lpc313x_idle_driver);
+
+	dev->cpu = 0;
+	lpc313x_idle_state(dev, LPC313X_IDLE_WFI, "WFI",
+		"Wait for interrupt", CPUIDLE_FLAG_SHALLOW, 0);
+	lpc313x_idle_state(dev, LPC313X_IDLE_FFAST, "FFAST",
+		"WFI, SYS clock on FFAST", CPUIDLE_FLAG_BALANCED, ffast_lat);
+	lpc313x_idle_state(dev, LPC313X_IDLE_SR, "SR",
+		"WFI, FFAST, SDRAM self-refresh",
+		CPUIDLE_FLAG_DEEP | CPUIDLE_FLAG_CHECK_BM, sr_lat);
+	dev->state_count = LPC313X_IDLE_NR_STATES;
+	dev->safe_state = &dev->states[LPC313X_IDLE_WFI];
+
+	printk(KERN_INFO "cpuidle: LPC313x exit latencies %u/%u/%u us\n",
+		dev->states[LPC313X_IDLE_WFI].exit_latency,
+		dev->states[LPC313X_IDLE_FFAST].exit_latency,
+		dev->states[LPC313X_IDLE_SR].exit_latency);
+
+	if (cpuidle_register_device(dev)) {
+		printk(KERN_ERR "cpuidle: can't register device\n");
+		cpuidle_unregister_driver(&lpc313x_idle_driver);
+		return -EIO;
+	}
+
+	return 0;
+}
+device_initcall(lpc313x_idle_init);
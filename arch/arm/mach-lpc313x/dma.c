@@ -24,55 +24,154 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/errno.h>
+#include <linux/err.h>
 #include <linux/ioport.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/dmapool.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/irq.h>
 #include <asm/dma.h>
 #include <mach/cgu.h>
+#include <mach/isram.h>
 
 
-static spinlock_t driver_lock = SPIN_LOCK_UNLOCKED; /* to guard state variables */
+/*
+ * Channel ownership is a bitmap claimed with atomic bitops, so requesting
+ * and releasing a channel never serializes against the other channels.
+ * driver_lock only guards the shared read-modify-write state: the IRQ
+ * mask register copy, the soft IRQ owner and the clock usage count.
+ */
+static DEFINE_SPINLOCK(driver_lock);
 
-static inline void lpc313x_dma_lock(void)
-{
-	spin_lock(&driver_lock);
-}
+static unsigned long dma_chan_map;	/* one bit per allocated channel */
 
-static inline void lpc313x_dma_unlock(void)
-{
-	spin_unlock(&driver_lock);
-}
+static struct dma_pool *dma_lli_pool;	/* linked list entries */
 
 static struct dma_channel {
 	char *name;
 	dma_cb_t callback_handler;
 	void *data;
+	unsigned long irqs[DMA_IRQ_DMAABORT + 1];	/* per dma_irq_type_t */
 } dma_channels[DMA_MAX_CHANNELS];
 
 static unsigned int     dma_irq_mask = 0xFFFFFFFF;
-static int sg_higher_channel[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-static int softirqmask[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-static int softirqen = 0;
+static int dma_softirq_chn = -1;	/* SG channel getting the soft IRQ */
 
 static int dma_channels_requested = 0;
 
+/* Channel finished/halfway bits of the status and mask registers */
+#define DMA_IRQS_CHANNELS	((1 << (2 * DMA_MAX_CHANNELS)) - 1)
+
 static inline void dma_increment_usage(void)
 {
+	unsigned long flags;
+
+	spin_lock_irqsave(&driver_lock, flags);
 	if (!dma_channels_requested++) {
 		cgu_clk_en_dis(CGU_SB_DMA_CLK_GATED_ID, 1);
 		cgu_clk_en_dis(CGU_SB_DMA_PCLK_ID, 1);
 	}
+	spin_unlock_irqrestore(&driver_lock, flags);
 }
 static inline void dma_decrement_usage(void)
 {
+	unsigned long flags;
+
+	spin_lock_irqsave(&driver_lock, flags);
 	if (!--dma_channels_requested) {
 		cgu_clk_en_dis(CGU_SB_DMA_CLK_GATED_ID, 0);
 		cgu_clk_en_dis(CGU_SB_DMA_PCLK_ID, 0);
 	}
+	spin_unlock_irqrestore(&driver_lock, flags);
+}
+
+/* Set and clear bits of the IRQ mask register */
+static void dma_update_irq_mask(unsigned int set, unsigned int clear)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&driver_lock, flags);
+	dma_irq_mask = (dma_irq_mask | set) & ~clear;
+	DMACH_IRQ_MASK = dma_irq_mask;
+	spin_unlock_irqrestore(&driver_lock, flags);
+}
+
+/*
+ * Channel budget. There are only DMA_MAX_CHANNELS (12) and an SG pair
+ * costs two of them, so boards have to add up what their drivers take.
+ * On the ea313x with everything built in:
+ *
+ *	NAND		1	dma_request_channel() at probe
+ *	MMC		2	one SG pair at probe
+ *	SPI		4	TX and RX SG pairs at probe
+ *	PCM		4	TX and RX SG pairs at first prepare
+ *			--
+ *			11 of 12
+ *
+ * The AES engine wants channel 10 but takes any free one if a pair got
+ * there first, and runs on the CPU if none is left. The dmaengine driver
+ * claims its channels only when a client first uses them, from whatever
+ * is left over. Pairs are claimed lowest first, so a board adding a
+ * driver that needs one has to give something else up.
+ */
+
+/* Claim any free channel, returns its number or -EBUSY */
+static int dma_claim_channel(void)
+{
+	int chn;
+
+	do {
+		chn = find_first_zero_bit(&dma_chan_map, DMA_MAX_CHANNELS);
+		if (chn >= DMA_MAX_CHANNELS)
+			return -EBUSY;
+	} while (test_and_set_bit(chn, &dma_chan_map));
+
+	return chn;
+}
+
+/* Claim two consecutive channels, returns the higher one or -EBUSY */
+static int dma_claim_pair(void)
+{
+	int chn;
+
+	for (chn = 0; chn < DMA_MAX_CHANNELS - 1; chn++) {
+		if (test_and_set_bit(chn, &dma_chan_map))
+			continue;
+		if (!test_and_set_bit(chn + 1, &dma_chan_map))
+			return chn + 1;
+		clear_bit(chn, &dma_chan_map);
+	}
+
+	return -EBUSY;
+}
+
+static inline void dma_unclaim_channel(unsigned int chn)
+{
+	smp_mb__before_clear_bit();
+	clear_bit(chn, &dma_chan_map);
+}
+
+static void dma_setup_channel(unsigned int chn, char *name, dma_cb_t cb,
+	void *data)
+{
+	dma_channels[chn].callback_handler = cb;
+	dma_channels[chn].data = cb ? data : NULL;
+	memset(dma_channels[chn].irqs, 0, sizeof(dma_channels[chn].irqs));
+	dma_channels[chn].name = name;
+}
+
+static void dma_clear_channel(unsigned int chn)
+{
+	dma_channels[chn].name = NULL;
+	dma_channels[chn].callback_handler = NULL;
+	dma_channels[chn].data = NULL;
 }
 
 static inline int dma_valid_config(const dma_setup_t *dma_setup)
@@ -102,101 +201,70 @@ int dma_prog_channel (unsigned int chn, dma_setup_t *dma_setup)
 	return 0;
 }
 
-int dma_request_channel (char *name, dma_cb_t cb, void *data)
+/* Common tail of the channel requests: channel chn is claimed already */
+static int dma_request_claimed(unsigned int chn, char *name, dma_cb_t cb,
+	void *data)
 {
-	unsigned int mask;
-	unsigned int chn;
-	unsigned long flags;
 	dma_setup_t  dma_setup;
 
+	memset(&dma_setup, 0, sizeof(dma_setup));
+
+	dma_increment_usage();
+	dma_setup_channel(chn, name, cb, data);
+	dma_prog_channel (chn, &dma_setup);
+
+	/* enable the finished IRQ: default behavior */
+	dma_update_irq_mask(0, 1 << (2 * chn));
+
+	return chn;
+}
+
+int dma_request_channel (char *name, dma_cb_t cb, void *data)
+{
+	int chn;
+
 	if (!name)
 		return -EINVAL;
 
-	lpc313x_dma_lock();
-
-	memset(&dma_setup, 0, sizeof(dma_setup));
+	chn = dma_claim_channel();
+	if (chn < 0)
+		return chn;
 
-	for (chn = 0, mask = 1; chn < DMA_MAX_CHANNELS; chn++) 
-	{
-		if (!dma_channels[chn].name) 
-		{
-			dma_increment_usage();
-			dma_channels[chn].name = name;
-			if (cb) {
-				dma_channels[chn].callback_handler = cb;
-				dma_channels[chn].data = data;
-			}
-			dma_prog_channel (chn, &dma_setup);
-			local_irq_save(flags);
-		        dma_irq_mask &= ~mask;  /* enable the IRQ: dafault behavior */
-			DMACH_IRQ_MASK = dma_irq_mask;
-			local_irq_restore(flags);
-			lpc313x_dma_unlock();
-			return chn;
-		}
-		mask = mask << 2;
-	}
-	lpc313x_dma_unlock();
-	return -EBUSY;
+	return dma_request_claimed(chn, name, cb, data);
 }
 
 
 int dma_request_specific_channel (int chn, char *name, void (*cb)(int, dma_irq_type_t, void *), void *data)
 {
-	unsigned long flags;
-	dma_setup_t  dma_setup;
-
-	if (chn >= DMA_MAX_CHANNELS || !name)
+	if (chn < 0 || chn >= DMA_MAX_CHANNELS || !name)
 		return -EINVAL;
 
-	if (dma_channels[chn].name) 
+	if (test_and_set_bit(chn, &dma_chan_map))
 		return -EBUSY;
 
-	lpc313x_dma_lock();
-
-	memset(&dma_setup, 0, sizeof(dma_setup));
-
-	dma_increment_usage();
-	dma_channels[chn].name = name;
-	if (cb) {
-		dma_channels[chn].callback_handler = cb;
-		dma_channels[chn].data = data;
-	}
-	dma_prog_channel (chn, &dma_setup);
-	local_irq_save(flags);
-	dma_irq_mask &= ~(1 << (2 * chn));  /* enable the IRQ: dafault behavior */
-	DMACH_IRQ_MASK = dma_irq_mask;
-	local_irq_restore(flags);
-	lpc313x_dma_unlock();
-	return chn;
+	return dma_request_claimed(chn, name, cb, data);
 }
 
 
 int dma_set_irq_mask(unsigned int chn, int half_int, int fin_int)
 {
-	unsigned long flags;
+	unsigned int set = 0, clear = 0;
 
 	if (chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name) {
 		return -EINVAL;
 	}
 
-	lpc313x_dma_lock();
-	local_irq_save(flags);
-
 	if (fin_int)
-		dma_irq_mask |= (1 << (chn * 2));
+		set |= (1 << (chn * 2));
 	else
-		dma_irq_mask &= ~(1 << (chn * 2));
+		clear |= (1 << (chn * 2));
 
 	if  (half_int)
-		dma_irq_mask |= (1 << (chn * 2 + 1));
+		set |= (1 << (chn * 2 + 1));
 	else
-		dma_irq_mask &= ~(1 << (chn * 2 + 1));
-
-	DMACH_IRQ_MASK = dma_irq_mask;
+		clear |= (1 << (chn * 2 + 1));
 
-	local_irq_restore(flags);
-	lpc313x_dma_unlock();
+	dma_update_irq_mask(set, clear);
 
 	return 0;
 }
@@ -235,78 +303,69 @@ int dma_stop_channel_sg (unsigned int chn)
 int dma_release_channel (unsigned int chn)
 {
 	unsigned int mask = (0x3 << (chn * 2));
-	unsigned long flags;
 
 	if (chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name) {
 		return -EINVAL;
 	}
 
-	lpc313x_dma_lock();
-	
-	local_irq_save(flags);
-
 	/* Otherwise an unexpected interrupt can occur when the channel is reallocated for another purpose */
+	dma_update_irq_mask(mask, 0);
 	DMACH_IRQ_STATUS = mask;
-	dma_irq_mask |= mask;
-	DMACH_IRQ_MASK = dma_irq_mask;
 	/* reset counter */
 	DMACH_TCNT(chn) = 0;
-	local_irq_restore(flags);
-
-	dma_channels[chn].name = NULL;
-	dma_channels[chn].callback_handler = NULL;
-	dma_channels[chn].data = NULL;
 
-	lpc313x_dma_unlock();
+	dma_clear_channel(chn);
+	dma_unclaim_channel(chn);
 	dma_decrement_usage();
 	
 	return 0;
 }
 
+static inline void dma_dispatch(unsigned int chn, dma_irq_type_t type)
+{
+	struct dma_channel *ch = &dma_channels[chn];
+
+	ch->irqs[type]++;
+	if (ch->callback_handler)
+		ch->callback_handler(chn, type, ch->data);
+}
+
+/*
+ * Only the channels with a pending, unmasked bit are visited: the status
+ * is acknowledged in one write and then walked lowest bit first, so a
+ * busy channel costs the others one __ffs() and not a scan of all twelve.
+ */
 static irqreturn_t dma_irq_handler (int irq, void *dev_id)
 {
-	unsigned int mask;
-	unsigned int chn;
 	unsigned int dma_irq_status;
+	unsigned int pending;
+	unsigned int bit;
+	unsigned int chn;
 
 	dma_irq_status = DMACH_IRQ_STATUS;
 	dma_irq_status &= ~dma_irq_mask;
+	DMACH_IRQ_STATUS = dma_irq_status;
 
-	for (chn = 0, mask = 1; chn < DMA_MAX_CHANNELS; chn++) {
-		if (dma_irq_status & mask) {
-			DMACH_IRQ_STATUS = mask;
-			if (dma_channels[chn].callback_handler)
-				(dma_channels[chn].callback_handler) 
-					(chn, DMA_IRQ_FINISHED, dma_channels[chn].data);
-		}
-		mask = mask << 1;
-		if (dma_irq_status & mask) {
-			DMACH_IRQ_STATUS = mask;
-			if (dma_channels[chn].callback_handler)
-				(dma_channels[chn].callback_handler) 
-					(chn, DMA_IRQ_HALFWAY, dma_channels[chn].data);
-		}
-		mask = mask << 1;
+	pending = dma_irq_status & DMA_IRQS_CHANNELS;
+	while (pending) {
+		bit = __ffs(pending);
+		pending &= pending - 1;
+		dma_dispatch(bit >> 1, (bit & 1) ? DMA_IRQ_HALFWAY : DMA_IRQ_FINISHED);
 	}
 
 	if (dma_irq_status & DMA_IRQS_SOFT) { /* Soft int */ 
-		DMACH_IRQ_STATUS = DMA_IRQS_SOFT;
-		for (chn = 0; chn < DMA_MAX_CHANNELS; chn++) {
-			if (sg_higher_channel[chn] && softirqmask[chn] &&
-				dma_channels[sg_higher_channel[chn]].callback_handler)
-			(dma_channels[sg_higher_channel[chn]].callback_handler)
-				(sg_higher_channel[chn], DMA_IRQ_SOFTINT,
-				dma_channels[sg_higher_channel[chn]].data);
-		}
+		if (dma_softirq_chn >= 0)
+			dma_dispatch(dma_softirq_chn, DMA_IRQ_SOFTINT);
 	}
 
 	if (dma_irq_status & DMA_IRQS_ABORT) { /* DMA abort */
 		printk(KERN_WARNING "DMA abort signalled\n");
-		DMACH_IRQ_STATUS = DMA_IRQS_ABORT;
-		for (chn = 0; chn < DMA_MAX_CHANNELS; chn++)
-			if (dma_channels[chn].callback_handler)
-				(dma_channels[chn].callback_handler) 
-					(chn, DMA_IRQ_DMAABORT, dma_channels[chn].data);
+		pending = dma_chan_map;
+		while (pending) {
+			chn = __ffs(pending);
+			pending &= pending - 1;
+			dma_dispatch(chn, DMA_IRQ_DMAABORT);
+		}
 	}
 
 	return IRQ_HANDLED;
@@ -352,114 +411,89 @@ int dma_current_state (unsigned int   chn,
 	return 0;
 }
 
-int dma_request_sg_channel (char *name, dma_cb_t cb, void *data, int usesoftirq)
+/* Take the soft IRQ for SG channel chn, only one channel may have it */
+static int dma_claim_softirq(int chn)
 {
-	unsigned int chn;
 	unsigned long flags;
-	dma_setup_t  dma_setup;
-
-	if (!name)
-		return -EINVAL;
+	int ret = 0;
 
-	if (softirqen & usesoftirq)
-		return -EBUSY;
+	spin_lock_irqsave(&driver_lock, flags);
+	if (dma_softirq_chn >= 0) {
+		ret = -EBUSY;
+	} else {
+		dma_softirq_chn = chn;
+		dma_irq_mask &= ~DMA_IRQS_SOFT;  /* enable the soft IRQ */
+		DMACH_IRQ_MASK = dma_irq_mask;
+	}
+	spin_unlock_irqrestore(&driver_lock, flags);
 
-	lpc313x_dma_lock();
+	return ret;
+}
 
-	for (chn = 0; chn < DMA_MAX_CHANNELS - 1; chn++) 
-		if (!dma_channels[chn].name && !dma_channels[chn + 1].name) {
-			sg_higher_channel[chn] = chn + 1;
-			break;
-		}
+/* Common tail of the SG requests: channels chn - 1 and chn are claimed */
+static int dma_request_sg_claimed(int chn, char *name, dma_cb_t cb, void *data,
+	int usesoftirq)
+{
+	dma_setup_t  dma_setup;
 
-	if (!sg_higher_channel[chn]) {
-		lpc313x_dma_unlock();
+	if (usesoftirq && dma_claim_softirq(chn)) {
+		dma_unclaim_channel(chn - 1);
+		dma_unclaim_channel(chn);
 		return -EBUSY;
 	}
 
 	memset(&dma_setup, 0, sizeof(dma_setup));
 
 	dma_increment_usage();
-	dma_channels[sg_higher_channel[chn]].name = name;
-	dma_channels[sg_higher_channel[chn] - 1].name = name;
+	dma_setup_channel(chn - 1, name, NULL, NULL);
+	dma_setup_channel(chn, name, cb, data);
+	dma_prog_channel (chn, &dma_setup);
 
-	if (cb) {
-		dma_channels[sg_higher_channel[chn]].callback_handler = cb;
-		dma_channels[sg_higher_channel[chn]].data = data;
-	}
-	dma_prog_channel (sg_higher_channel[chn], &dma_setup);
+	return chn;
+}
 
-	if (usesoftirq) {
-		local_irq_save(flags);
-		softirqen = 1;
-		softirqmask[chn] = 1;
-		dma_irq_mask &= ~DMA_IRQS_SOFT;  /* enable the soft IRQ */
-		DMACH_IRQ_MASK = dma_irq_mask;
-		local_irq_restore(flags);
-	}
+int dma_request_sg_channel (char *name, dma_cb_t cb, void *data, int usesoftirq)
+{
+	int chn;
 
-	lpc313x_dma_unlock();
+	if (!name)
+		return -EINVAL;
 
-	return sg_higher_channel[chn];
+	chn = dma_claim_pair();
+	if (chn < 0)
+		return chn;
+
+	return dma_request_sg_claimed(chn, name, cb, data, usesoftirq);
 }
 
 int dma_request_specific_sg_channel (int chn, char *name, dma_cb_t cb, void *data, int usesoftirq)
 {
-	unsigned long flags;
-	dma_setup_t  dma_setup;
-
-	if (!name)
+	if (!name || chn < 1 || chn >= DMA_MAX_CHANNELS)
 		return -EINVAL;
 
-	if (softirqen & usesoftirq)
+	if (test_and_set_bit(chn, &dma_chan_map))
 		return -EBUSY;
-
-	if (sg_higher_channel[chn] || dma_channels[chn].name || dma_channels[chn - 1].name)
+	if (test_and_set_bit(chn - 1, &dma_chan_map)) {
+		dma_unclaim_channel(chn);
 		return -EBUSY;
-
-	lpc313x_dma_lock();
-	
-	sg_higher_channel[chn] = chn;
-
-	memset(&dma_setup, 0, sizeof(dma_setup));
-
-	dma_increment_usage();
-	dma_channels[sg_higher_channel[chn]].name = name;
-	dma_channels[sg_higher_channel[chn] - 1].name = name;
-
-	if (cb) {
-		dma_channels[sg_higher_channel[chn]].callback_handler = cb;
-		dma_channels[sg_higher_channel[chn]].data = data;
 	}
-	dma_prog_channel (sg_higher_channel[chn], &dma_setup);
 
-	if (usesoftirq) {
-		local_irq_save(flags);
-		softirqen = 1;
-		softirqmask[chn] = 1;
-		dma_irq_mask &= ~DMA_IRQS_SOFT;  /* enable the soft IRQ */
-		DMACH_IRQ_MASK = dma_irq_mask;
-		local_irq_restore(flags);
-	}
-
-	return sg_higher_channel[chn];
+	return dma_request_sg_claimed(chn, name, cb, data, usesoftirq);
 }
 
 int dma_prog_sg_channel(int chn, u32 dma_sg_list)
 {
 	u32 dma_config;
 
-	if (chn >= DMA_MAX_CHANNELS)
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS)
 		return -EINVAL;
 
 	dma_config = DMA_CFG_CMP_CH_EN | DMA_CFG_CMP_CH_NR(chn - 1);
 
-	lpc313x_dma_lock();
 	DMACH_SRC_ADDR(chn) = dma_sg_list;
 	DMACH_DST_ADDR(chn) = DMACH_ALT_PHYS(chn - 1);
 	DMACH_LEN(chn) = 0x4;
 	DMACH_CFG(chn) = dma_config;
-	lpc313x_dma_unlock();
 
 	return 0;
 }
@@ -469,6 +503,38 @@ int dma_channel_enabled(unsigned int chn)
 	return DMACH_EN(chn);
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int dma_stats_show(struct seq_file *s, void *unused)
+{
+	struct dma_channel *ch;
+	int chn;
+
+	seq_printf(s, "chn %-16s %10s %10s %10s %10s\n", "owner",
+		"finished", "halfway", "soft", "abort");
+	for (chn = 0; chn < DMA_MAX_CHANNELS; chn++) {
+		ch = &dma_channels[chn];
+		seq_printf(s, "%3d %-16s %10lu %10lu %10lu %10lu\n", chn,
+			ch->name ? ch->name : "-",
+			ch->irqs[DMA_IRQ_FINISHED], ch->irqs[DMA_IRQ_HALFWAY],
+			ch->irqs[DMA_IRQ_SOFTINT], ch->irqs[DMA_IRQ_DMAABORT]);
+	}
+
+	return 0;
+}
+
+static int dma_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dma_stats_show, inode->i_private);
+}
+
+static const struct file_operations dma_stats_fops = {
+	.open		= dma_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+#endif
+
 static int __init lpc313x_dma_init (void)
 {
 	int ret = 0;
@@ -477,10 +543,21 @@ static int __init lpc313x_dma_init (void)
 
 	dma_irq_mask = 0xFFFFFFFF;
 	DMACH_IRQ_MASK = dma_irq_mask;
+
+	dma_lli_pool = dma_pool_create("lpc313x_lli", NULL, sizeof(dma_lli_t),
+		32, 0);
+	if (!dma_lli_pool)
+		return -ENOMEM;
+
 	ret = request_irq (IRQ_DMA, dma_irq_handler, 0, "DMAC", NULL);
 	if (ret)
 		printk (KERN_ERR "request_irq() returned error %d\n", ret);
 
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("lpc313x_dma", S_IRUGO, NULL, NULL,
+		&dma_stats_fops);
+#endif
+
 	return ret;
 }
 
@@ -488,40 +565,332 @@ int dma_release_sg_channel (unsigned int chn)
 {
 	unsigned long flags;
 
-	if (chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name) {
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name) {
 		return -EINVAL;
 	}
 
-	lpc313x_dma_lock();
-
-	if (softirqmask[chn] != 0) {
-		local_irq_save(flags);
-		softirqen = 0;
-		softirqmask[chn] = 0;
+	spin_lock_irqsave(&driver_lock, flags);
+	if (dma_softirq_chn == chn) {
+		dma_softirq_chn = -1;
 		dma_irq_mask |= DMA_IRQS_SOFT;
 		DMACH_IRQ_MASK = dma_irq_mask;
-		local_irq_restore(flags);
 	}
+	spin_unlock_irqrestore(&driver_lock, flags);
 	
-	dma_channels[chn].name = NULL;
-	dma_channels[chn].callback_handler = NULL;
-	dma_channels[chn].data = NULL;
-	
-	chn--;
-	dma_channels[chn].name = NULL;
-	dma_channels[chn].callback_handler = NULL;
-	dma_channels[chn].data = NULL;
-	
-	sg_higher_channel[chn] = 0;
+	dma_clear_channel(chn);
+	dma_clear_channel(chn - 1);
+	dma_unclaim_channel(chn);
+	dma_unclaim_channel(chn - 1);
 
-	lpc313x_dma_unlock();
 	dma_decrement_usage();
 	return 0;
 }
-int dma_prepare_sg_list(int n, dma_sg_ll_t * sg)
+/* Companion bits of a list entry followed by another one */
+#define DMA_CFG_CMP_MASK	(DMA_CFG_CMP_CH_EN | DMA_CFG_CMP_CH_NR(7))
+
+/*
+ * The list is an array: every entry with a next_entry is chained to the
+ * loader channel, the last one (next_entry == 0) ends the transfer.
+ */
+int dma_prepare_sg_list(int chn, dma_sg_ll_t *sg)
+{
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || !sg)
+		return -EINVAL;
+
+	for (;; sg++) {
+		sg->setup.cfg &= ~DMA_CFG_CMP_MASK;
+		if (!sg->next_entry)
+			break;
+		sg->setup.cfg |= DMA_CFG_CMP_CH_EN | DMA_CFG_CMP_CH_NR(chn);
+	}
+
+	return 0;
+}
+
+/*
+ * Entries come from ISRAM while there is room, the controller fetches
+ * them there without competing with SDRAM traffic.
+ */
+dma_lli_t *dma_lli_alloc(gfp_t flags)
+{
+	dma_lli_t *lli;
+	dma_addr_t dma;
+
+	lli = lpc313x_isram_alloc(sizeof(dma_lli_t), &dma);
+	if (!lli)
+		lli = dma_pool_alloc(dma_lli_pool, flags, &dma);
+	if (lli) {
+		lli->next = NULL;
+		lli->dma = dma;
+		lli->ll.next_entry = 0;
+	}
+
+	return lli;
+}
+
+void dma_lli_free(dma_lli_t *first)
+{
+	dma_lli_t *lli = first, *next;
+
+	while (lli) {
+		next = lli->next;
+		if (lpc313x_isram_owns(lli))
+			lpc313x_isram_free(lli, sizeof(dma_lli_t));
+		else
+			dma_pool_free(dma_lli_pool, lli, lli->dma);
+		if (next == first)
+			break;
+		lli = next;
+	}
+}
+
+/* log2 of the bytes moved per transfer unit of a channel configuration */
+static inline unsigned int dma_cfg_unit_shift(u32 cfg)
+{
+	static const unsigned char shift[] = { 2, 1, 0, 4 };
+
+	return shift[(cfg >> 10) & 0x3];
+}
+
+/* Append an entry to the list ending at *last */
+static dma_lli_t *dma_lli_append(dma_lli_t **first, dma_lli_t **last,
+	u32 src, u32 dst, u32 units, u32 cfg, gfp_t flags)
+{
+	dma_lli_t *lli = dma_lli_alloc(flags);
+
+	if (!lli)
+		return NULL;
+
+	lli->ll.setup.src_address = src;
+	lli->ll.setup.dest_address = dst;
+	lli->ll.setup.trans_length = units - 1;
+	lli->ll.setup.cfg = cfg;
+
+	if (*last) {
+		(*last)->next = lli;
+		(*last)->ll.next_entry = lli->dma;
+	} else {
+		*first = lli;
+	}
+	*last = lli;
+
+	return lli;
+}
+
+dma_lli_t *dma_lli_from_sg(int chn, struct scatterlist *sgl, int nents,
+	u32 dev_addr, u32 cfg, int to_dev, int softirq, gfp_t flags)
+{
+	unsigned int shift = dma_cfg_unit_shift(cfg);
+	dma_lli_t *first = NULL, *last = NULL;
+	struct scatterlist *sg;
+	u32 mem, len, units;
+	int i, ret = -ENOMEM;
+
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || !nents)
+		return ERR_PTR(-EINVAL);
+
+	cfg &= ~DMA_CFG_CMP_MASK;
+	cfg |= DMA_CFG_CMP_CH_EN | DMA_CFG_CMP_CH_NR(chn);
+
+	for_each_sg(sgl, sg, nents, i) {
+		mem = sg_dma_address(sg);
+		len = sg_dma_len(sg);
+		if (len & ((1 << shift) - 1)) {
+			ret = -EINVAL;
+			goto err;
+		}
+
+		while (len) {
+			units = min(len >> shift, (u32) DMA_MAX_TRANSFERS + 1);
+			if (!dma_lli_append(&first, &last,
+				to_dev ? mem : dev_addr, to_dev ? dev_addr : mem,
+				units, cfg, flags))
+				goto err;
+			mem += units << shift;
+			len -= units << shift;
+		}
+	}
+
+	/* Nothing to transfer */
+	if (!first)
+		return ERR_PTR(-EINVAL);
+
+	if (softirq) {
+		/* Any readable address will do as source */
+		if (!dma_lli_append(&first, &last, first->dma,
+			DMACH_SOFT_INT_PHYS, 2, 0, flags))
+			goto err;
+	} else {
+		last->ll.setup.cfg &= ~DMA_CFG_CMP_MASK;
+	}
+
+	return first;
+
+err:
+	dma_lli_free(first);
+	return ERR_PTR(ret);
+}
+
+dma_lli_t *dma_lli_cyclic(int chn, dma_addr_t buf, size_t period, int periods,
+	u32 dev_addr, u32 cfg, int to_dev, gfp_t flags)
+{
+	unsigned int shift = dma_cfg_unit_shift(cfg);
+	dma_lli_t *first = NULL, *last = NULL;
+	u32 units = period >> shift;
+	int i;
+
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || periods < 1 ||
+		!units || units > DMA_MAX_TRANSFERS + 1 ||
+		(period & ((1 << shift) - 1)))
+		return ERR_PTR(-EINVAL);
+
+	cfg &= ~DMA_CFG_CMP_MASK;
+	cfg |= DMA_CFG_CMP_CH_EN | DMA_CFG_CMP_CH_NR(chn);
+
+	for (i = 0; i < periods; i++, buf += period) {
+		if (!dma_lli_append(&first, &last,
+			to_dev ? buf : dev_addr, to_dev ? dev_addr : buf,
+			units, cfg, flags)) {
+			dma_lli_free(first);
+			return ERR_PTR(-ENOMEM);
+		}
+	}
+
+	/* Wrap end of list back to start */
+	last->next = first;
+	last->ll.next_entry = first->dma;
+
+	return first;
+}
+
+/* Linked list transfer state, indexed by SG channel */
+static struct dma_cyclic {
+	dma_period_cb_t cb;
+	dma_cb_t done;
+	void *data;
+	int period;
+	int periods;
+} dma_cyclic[DMA_MAX_CHANNELS];
+
+/* Finished interrupt of the data channel of a cyclic pair */
+static void dma_cyclic_irq(int chn, dma_irq_type_t type, void *data)
+{
+	struct dma_cyclic *c = data;
+	int period;
+
+	if (type != DMA_IRQ_FINISHED)
+		return;
+
+	period = c->period;
+	if (++c->period == c->periods)
+		c->period = 0;
+
+	if (c->cb)
+		c->cb(chn + 1, period, c->data);
+}
+
+/*
+ * Finished interrupt of the data channel running a list. It comes for
+ * every entry, and two entries can finish before it is served. Only the
+ * last entry runs without a companion, so the list is done once that
+ * one is loaded and the channel has stopped.
+ */
+static void dma_list_irq(int chn, dma_irq_type_t type, void *data)
+{
+	struct dma_cyclic *c = data;
+
+	if (type != DMA_IRQ_FINISHED)
+		return;
+
+	if ((DMACH_CFG(chn) & DMA_CFG_CMP_CH_EN) || DMACH_EN(chn))
+		return;
+
+	if (c->done)
+		c->done(chn + 1, DMA_IRQ_FINISHED, c->data);
+}
+
+/* Hook the data channel of a pair and start the loader on a list */
+static int dma_start_pair(int chn, dma_lli_t *first, dma_cb_t handler)
+{
+	dma_channels[chn - 1].data = &dma_cyclic[chn];
+	dma_channels[chn - 1].callback_handler = handler;
+
+	dma_prog_sg_channel(chn, first->dma);
+	dma_update_irq_mask(0, 1 << (2 * (chn - 1)));
+
+	return dma_start_channel(chn);
+}
+
+static int dma_stop_pair(int chn)
+{
+	unsigned int mask;
+
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name)
+		return -EINVAL;
+
+	mask = 0x3 << (2 * (chn - 1));
+
+	DMACH_EN(chn) = 0;
+	DMACH_EN(chn - 1) = 0;
+	dma_update_irq_mask(mask, 0);
+	DMACH_IRQ_STATUS = mask;
+
+	dma_channels[chn - 1].callback_handler = NULL;
+	dma_channels[chn - 1].data = NULL;
+	dma_cyclic[chn].cb = NULL;
+	dma_cyclic[chn].done = NULL;
+
+	return 0;
+}
+
+int dma_start_cyclic(int chn, dma_lli_t *first, dma_period_cb_t cb, void *data)
+{
+	struct dma_cyclic *c;
+	dma_lli_t *lli;
+
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name ||
+		!first)
+		return -EINVAL;
+
+	c = &dma_cyclic[chn];
+	c->cb = cb;
+	c->done = NULL;
+	c->data = data;
+	c->period = 0;
+	c->periods = 0;
+	lli = first;
+	do {
+		c->periods++;
+		lli = lli->next;
+	} while (lli && lli != first);
+
+	return dma_start_pair(chn, first, dma_cyclic_irq);
+}
+
+int dma_stop_cyclic(int chn)
+{
+	return dma_stop_pair(chn);
+}
+
+int dma_start_lli(int chn, dma_lli_t *first, dma_cb_t cb, void *data)
+{
+	struct dma_cyclic *c;
+
+	if (chn < 1 || chn >= DMA_MAX_CHANNELS || !dma_channels[chn].name ||
+		!first)
+		return -EINVAL;
+
+	c = &dma_cyclic[chn];
+	c->cb = NULL;
+	c->done = cb;
+	c->data = data;
+
+	return dma_start_pair(chn, first, dma_list_irq);
+}
+
+int dma_stop_lli(int chn)
 {
-    /* fixed me: not yet implement */
-    return 0;
+	return dma_stop_pair(chn);
 }
 
 device_initcall(lpc313x_dma_init);
@@ -542,3 +911,11 @@ EXPORT_SYMBOL(dma_request_specific_sg_channel);
 EXPORT_SYMBOL(dma_prog_sg_channel);
 EXPORT_SYMBOL(dma_release_sg_channel);
 EXPORT_SYMBOL(dma_prepare_sg_list);
+EXPORT_SYMBOL(dma_lli_alloc);
+EXPORT_SYMBOL(dma_lli_free);
+EXPORT_SYMBOL(dma_lli_from_sg);
+EXPORT_SYMBOL(dma_lli_cyclic);
+EXPORT_SYMBOL(dma_start_cyclic);
+EXPORT_SYMBOL(dma_stop_cyclic);
+EXPORT_SYMBOL(dma_start_lli);
+EXPORT_SYMBOL(dma_stop_lli);
@@ -31,6 +31,8 @@
 #include <mach/hardware.h>
 
 #include <mach/gpio.h>
+#include <mach/dmac.h>
+#include <mach/isram.h>
 #include <asm/mach/map.h>
 
 /* local functions */
@@ -60,8 +62,25 @@ static struct platform_device serial_device = {
 };
 
 
+#if defined (CONFIG_LPC313X_DMAC) || defined (CONFIG_LPC313X_DMAC_MODULE)
+static struct lpc313x_dmac_platform_data dmac_data = {
+	.nr_channels	= 4,
+};
+
+static struct platform_device dmac_device = {
+	.name = "lpc313x_dmac",
+	.id = 0,
+	.dev = {
+		.platform_data = &dmac_data,
+	},
+};
+#endif
+
 static struct platform_device *devices[] __initdata = {
 	&serial_device,
+#if defined (CONFIG_LPC313X_DMAC) || defined (CONFIG_LPC313X_DMAC_MODULE)
+	&dmac_device,
+#endif
 };
 
 static struct map_desc lpc313x_io_desc[] __initdata = {
@@ -113,11 +132,27 @@ static struct map_desc lpc313x_io_desc[] __initdata = {
 		.length		= IO_NAND_BUF_SIZE,
 		.type		= MT_DEVICE
 	},
+#ifdef CONFIG_LPC313X_ISRAM_TEXT
+	{
+		.virtual	= io_p2v(IO_ISRAM0_TEXT_PHYS),
+		.pfn		= __phys_to_pfn(IO_ISRAM0_TEXT_PHYS),
+		.length		= IO_ISRAM0_TEXT_SIZE,
+		.type		= MT_DEVICE_CACHED
+	},
+#endif
+	{
+		.virtual	= io_p2v(IO_ISRAM0_PHYS),
+		.pfn		= __phys_to_pfn(IO_ISRAM0_PHYS),
+		.length		= IO_ISRAM0_SIZE,
+		.type		= MT_DEVICE
+	},
 };
 
 void __init lpc313x_map_io(void)
 {
 	iotable_init(lpc313x_io_desc, ARRAY_SIZE(lpc313x_io_desc));
+	/* before the IRQ code placed there gets used */
+	lpc313x_isram_text_init();
 }
 extern int __init cgu_init(char *str);
 
@@ -0,0 +1,67 @@
+/*  linux/arch/arm/mach-lpc313x/include/mach/aes.h
+ *
+ * Interface of the LPC3143 AES engine driver (drivers/crypto/lpc3143_aes.c)
+ * for decrypting encrypted ELF images.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __ASM_ARCH_AES_H
+#define __ASM_ARCH_AES_H
+
+#include <linux/completion.h>
+#include <linux/list.h>
+
+/* Size of the header chunk and of the engine's unit of work */
+#define LPC3143_AES_CHUNK	512
+
+/*
+ * An encrypted image decrypted piece by piece. The first chunk of an
+ * image is the plain text header, which holds the IV at 0x80; the rest
+ * is fed to lpc3143_aes_stream_start() in order, each piece a multiple
+ * of LPC3143_AES_CHUNK, so the loader can read the next piece from flash
+ * while the engine works on the current one:
+ *
+ *	lpc3143_aes_stream_init(&s, header, key);
+ *	read piece 0;
+ *	for each piece n:
+ *		lpc3143_aes_stream_start(&s, piece n, len);
+ *		read piece n + 1;
+ *		lpc3143_aes_stream_wait(&s);
+ *
+ * Only one piece of a stream may be in flight at a time, and only a
+ * piece that started with 0 may be waited for. Without the engine the
+ * start fails with -ENODEV.
+ */
+struct lpc3143_aes_stream {
+	unsigned int key[4];
+	unsigned int iv[4];	/* engine IV to resume with */
+
+	/* private to the driver */
+	struct list_head list;
+	struct completion done;
+	unsigned long phys;
+	void *buf;
+	int len;
+	int ret;
+};
+
+extern void lpc3143_aes_stream_init(struct lpc3143_aes_stream *s,
+	const unsigned char *header, const unsigned char *key);
+extern void lpc3143_aes_stream_seek(struct lpc3143_aes_stream *s,
+	const unsigned char *prev_block);
+extern int lpc3143_aes_stream_start(struct lpc3143_aes_stream *s,
+	void *buf, int len);
+extern int lpc3143_aes_stream_wait(struct lpc3143_aes_stream *s);
+
+/*
+ * Decrypt a whole image in place. The header chunk at base only gives
+ * the IV and is left as it is; phys is where the image starts.
+ */
+extern int lpc3143_aes_decrypt_elf(unsigned char *base, unsigned int phys,
+	int size, unsigned char *key);
+
+#endif /* __ASM_ARCH_AES_H */
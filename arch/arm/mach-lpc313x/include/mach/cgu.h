@@ -545,6 +545,10 @@ typedef struct
 /***********************************************************************
 * CGU driver functions
 **********************************************************************/
+/* Frequency of each CGU input, indexed by CGU_FIN_SELECT_* */
+extern u32 g_clkin_freq[CGU_FIN_SELECT_MAX];
+
+
 /* Return the current base frequecy of the requested domain*/
 u32 cgu_get_base_freq(CGU_DOMAIN_ID_T baseid);
 
@@ -557,6 +561,9 @@ u32 cgu_get_clk_freq(CGU_CLOCK_ID_T clkid);
 /* Change the sub-domain frequency for the requested clock */
 void cgu_set_subdomain_freq(CGU_CLOCK_ID_T clkid, CGU_FDIV_SETUP_T fdiv_cfg);
 
+/* Return the output frequency of the selected HPLL */
+u32 cgu_get_pll_freq(CGU_HPLL_ID_T pll_id, u32 infreq);
+
 /* Configure the selected HPLL */
 void cgu_hpll_config(CGU_HPLL_ID_T id, CGU_HPLL_SETUP_T* pllsetup);
 
@@ -569,6 +576,20 @@ u32 cgu_fdiv_config(u32 fdId, CGU_FDIV_SETUP_T fdivCfg, u32 enable);
 /* frac divider reset function */
 u32 cgu_fdiv_reset(u32 fdId);
 
+/* read back the n/m setting of a running frac divider */
+int cgu_fdiv_get(u32 fdId, CGU_FDIV_SETUP_T *fdivCfg);
+
+/* reprogram the frac dividers in fdmask (indexed by divider id) together */
+void cgu_set_domain_fdivs(CGU_DOMAIN_ID_T domainId, u32 fdmask,
+	const CGU_FDIV_SETUP_T *fdivCfg);
+
+/* Finds the ESR index of the requested clock, CGU_INVALID_ID if none */
+u32 cgu_clkid2esrid(CGU_CLOCK_ID_T clkid);
+
+/* Finds domain index and fractional divider index for the requested clock */
+void cgu_ClkId2DomainId(CGU_CLOCK_ID_T clkid, CGU_DOMAIN_ID_T* pDomainId,
+	u32* pSubdomainId);
+
 /***********************************************************************
 * CGU driver inline (ANSI C99 based) functions
 **********************************************************************/
@@ -598,5 +619,26 @@ static inline void cgu_soft_reset_module(CGU_MOD_ID_T modId)
   CGU_CFG->resetn_soft[modId] = CGU_CONFIG_SOFT_RESET;
 }
 
+/* Enable/Disable external refresh controller used by
+ * auto clock scaling feature of CGU.
+ */
+static inline void lpc313x_ext_refresh_en(int enable)
+{
+  if (enable)
+  {
+    SYS_MPMC_TESTMODE0 |= _BIT(12);
+  }
+  else
+  {
+    SYS_MPMC_TESTMODE0 &= ~_BIT(12);
+  }
+}
+
+/* Is the external refresh controller enabled? */
+static inline int lpc313x_ext_refresh_enabled(void)
+{
+  return (SYS_MPMC_TESTMODE0 & _BIT(12)) != 0;
+}
+
 
 #endif /* LPC313X_CGU_DRIVER_H */
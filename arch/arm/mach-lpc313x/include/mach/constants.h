@@ -61,6 +61,20 @@
 #define ISRAM1_PHYS       (0x11040000)
 #define ISRAM1_LENGTH     (0x00018000)
 
+/* ISRAM0 layout: code slots reserved at boot, the rest is the isram.c pool */
+#define ISRAM0_TEXT_OFS     (0x00000000)	/* .isram.text, cached */
+#ifdef CONFIG_LPC313X_ISRAM_TEXT
+#define ISRAM0_TEXT_SIZE    (0x00004000)
+#else
+#define ISRAM0_TEXT_SIZE    (0x00000000)
+#endif
+#define ISRAM0_SUSPEND_OFS  (ISRAM0_TEXT_OFS + ISRAM0_TEXT_SIZE) /* pm_standby.S */
+#define ISRAM0_SUSPEND_SIZE (0x00000400)
+#define ISRAM0_IDLE_SIZE    (0x00000100)	/* idle_sr.S */
+#define ISRAM0_IDLE_OFS     (ISRAM0_LENGTH - ISRAM0_IDLE_SIZE)
+#define ISRAM0_POOL_OFS     (ISRAM0_SUSPEND_OFS + ISRAM0_SUSPEND_SIZE)
+#define ISRAM0_POOL_SIZE    (ISRAM0_IDLE_OFS - ISRAM0_POOL_OFS)
+
 /***********************************************************************
  * XTAL clock definitions
  **********************************************************************/
@@ -101,3 +115,10 @@
 /* NAND buffer address range*/
 #define IO_NAND_BUF_PHYS  (0x70000000)
 #define IO_NAND_BUF_SIZE  (0x00001000)
+
+/* Internal SRAM 0 hot code, mapped cached */
+#define IO_ISRAM0_TEXT_PHYS (ISRAM0_PHYS + ISRAM0_TEXT_OFS)
+#define IO_ISRAM0_TEXT_SIZE (ISRAM0_TEXT_SIZE)
+/* Internal SRAM 0 from the suspend code on, uncached for DMA */
+#define IO_ISRAM0_PHYS    (ISRAM0_PHYS + ISRAM0_SUSPEND_OFS)
+#define IO_ISRAM0_SIZE    (ISRAM0_LENGTH - ISRAM0_SUSPEND_OFS)
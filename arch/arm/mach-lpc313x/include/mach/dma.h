@@ -157,6 +157,27 @@ typedef struct dma_sg_ll
 	u32 next_entry;
 } dma_sg_ll_t;
 
+/*
+ * Linked list entry allocated from the shared descriptor pool. The
+ * controller only reads ll; next and dma are the CPU side view of the
+ * chain, so a list can be walked and freed without a bus to virtual
+ * address translation.
+ */
+typedef struct dma_lli
+{
+	dma_sg_ll_t ll;
+	struct dma_lli *next;
+	dma_addr_t dma;
+} dma_lli_t;
+
+/*
+ * Cyclic transfer period callback
+ * 1st parameter - SG channel number
+ * 2nd parameter - index of the period that has just completed
+ * 3rd parameter - additional data (callback-specific context)
+ */
+typedef void (*dma_period_cb_t)(int, int, void *);
+
 
 /*
  * API definition
@@ -380,4 +401,83 @@ int dma_release_sg_channel (unsigned int);
  */
 int dma_channel_enabled(unsigned int);
 
+struct scatterlist;
+
+/*
+ * Allocate/free linked list entries from the shared descriptor pool
+ *
+ * dma_lli_free() releases the entry and everything chained after it
+ * through ->next; it stops when it comes back to the first entry, so
+ * cyclic lists are freed the same way.
+ */
+dma_lli_t *dma_lli_alloc(gfp_t);
+void dma_lli_free(dma_lli_t *);
+
+/*
+ * Build a linked list for a mapped scatterlist
+ *
+ * Function parameters:
+ * 1st parameter - channel number returned by dma_request_sg_channel()
+ * 2nd parameter - scatterlist, already mapped with dma_map_sg()
+ * 3rd parameter - number of mapped entries
+ * 4th parameter - peripheral FIFO address
+ * 5th parameter - channel configuration (slave number and transfer size)
+ * 6th parameter - !0 for memory to peripheral, 0 for peripheral to memory
+ * 7th parameter - !0 to end the list with a soft interrupt entry, which
+ *                 requires the channel to own the soft IRQ
+ * 8th parameter - allocation flags
+ *
+ * Entries longer than a channel can do in one go are split. The
+ * companion settings are filled in as by dma_prepare_sg_list().
+ *
+ * Returns: first entry, to be passed (->dma) to dma_prog_sg_channel(),
+ *          or an ERR_PTR(): -EINVAL if the lengths don't fit the transfer
+ *          size or add up to nothing, -ENOMEM
+ */
+dma_lli_t *dma_lli_from_sg(int, struct scatterlist *, int, u32, u32, int,
+	int, gfp_t);
+
+/*
+ * Build a cyclic linked list over a buffer, one entry per period
+ *
+ * Function parameters:
+ * 1st parameter - channel number returned by dma_request_sg_channel()
+ * 2nd parameter - bus address of the buffer
+ * 3rd parameter - period length in bytes, at most DMA_MAX_TRANSFERS + 1
+ *                 transfer units
+ * 4th parameter - number of periods
+ * 5th parameter - peripheral FIFO address
+ * 6th parameter - channel configuration (slave number and transfer size)
+ * 7th parameter - !0 for memory to peripheral, 0 for peripheral to memory
+ * 8th parameter - allocation flags
+ *
+ * Returns: first entry of the ring, or an ERR_PTR() on failure
+ */
+dma_lli_t *dma_lli_cyclic(int, dma_addr_t, size_t, int, u32, u32, int, gfp_t);
+
+/*
+ * Start/stop a cyclic transfer built with dma_lli_cyclic()
+ *
+ * The callback is called from the DMA interrupt each time the data
+ * channel finishes a period. dma_stop_cyclic() stops both channels of
+ * the pair and unhooks the callback; the ring can then be freed.
+ *
+ * Returns: 0 on success, otherwise failure
+ */
+int dma_start_cyclic(int, dma_lli_t *, dma_period_cb_t, void *);
+int dma_stop_cyclic(int);
+
+/*
+ * Start/stop a list built with dma_lli_from_sg() without soft interrupt
+ *
+ * The callback is called from the DMA interrupt, with DMA_IRQ_FINISHED,
+ * once the last entry has been transferred; it may start the next list.
+ * dma_stop_lli() stops both channels of the pair and unhooks the
+ * callback.
+ *
+ * Returns: 0 on success, otherwise failure
+ */
+int dma_start_lli(int, dma_lli_t *, dma_cb_t, void *);
+int dma_stop_lli(int);
+
 #endif				/* _ASM_ARCH_DMA_H */
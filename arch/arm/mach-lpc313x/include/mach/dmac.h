@@ -0,0 +1,51 @@
+/*  linux/arch/arm/mach-lpc313x/include/mach/dmac.h
+ *
+ * Platform data and slave description for the LPC313x dmaengine
+ * provider (drivers/dma/lpc313x_dmac.c).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __ASM_ARCH_DMAC_H
+#define __ASM_ARCH_DMAC_H
+
+#include <linux/dmaengine.h>
+
+/*
+ * struct lpc313x_dmac_platform_data - controller configuration
+ * @nr_channels: number of dmaengine channels to expose. A hardware
+ *	channel is taken from the mach DMA allocator when the first
+ *	descriptor is prepared on a dmaengine channel and given back
+ *	when its last client releases it, so drivers using the
+ *	dma_request_channel() API of <mach/dma.h> keep working.
+ */
+struct lpc313x_dmac_platform_data {
+	unsigned int	nr_channels;
+};
+
+/*
+ * struct lpc313x_dma_slave - controller-specific slave information
+ * @slave: generic information, tx_reg/rx_reg and reg_width are used
+ * @tx_cfg: channel configuration for DMA_TO_DEVICE, normally
+ *	DMA_CFG_WR_SLV_NR(DMA_SLV_xxx)
+ * @rx_cfg: channel configuration for DMA_FROM_DEVICE, normally
+ *	DMA_CFG_RD_SLV_NR(DMA_SLV_xxx)
+ *
+ * The transfer size bits of the configuration are filled in from
+ * slave.reg_width.
+ */
+struct lpc313x_dma_slave {
+	struct dma_slave	slave;
+	u32			tx_cfg;
+	u32			rx_cfg;
+};
+
+static inline struct lpc313x_dma_slave *to_lpc313x_dma_slave(struct dma_slave *slave)
+{
+	return container_of(slave, struct lpc313x_dma_slave, slave);
+}
+
+#endif /* __ASM_ARCH_DMAC_H */
@@ -0,0 +1,64 @@
+/*  linux/arch/arm/mach-lpc313x/include/mach/isram.h
+ *
+ * Internal SRAM (ISRAM0) allocator and hot code section for LPC313x &
+ * LPC315x, see arch/arm/mach-lpc313x/isram.c.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __ASM_ARCH_ISRAM_H
+#define __ASM_ARCH_ISRAM_H
+
+#include <mach/hardware.h>
+
+/* Run address of .isram.text, and the end of its slot (vmlinux.lds.S) */
+#define LPC313X_ISRAM_TEXT_VA	io_p2v(ISRAM0_PHYS + ISRAM0_TEXT_OFS)
+#define LPC313X_ISRAM_TEXT_END	(LPC313X_ISRAM_TEXT_VA + ISRAM0_TEXT_SIZE)
+
+#ifndef __ASSEMBLY__
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <linux/init.h>
+#include <linux/gfp.h>
+
+struct device;
+
+/*
+ * Code run from ISRAM. It is out of branch range of the kernel text, so
+ * it may only call inline functions and function pointers, and is
+ * itself only reached through pointers or long calls.
+ */
+#ifdef CONFIG_LPC313X_ISRAM_TEXT
+#define __isram_text \
+	__attribute__((__section__(".isram.text"), __long_call__)) notrace
+#else
+#define __isram_text
+#endif
+
+/*
+ * ISRAM is mapped uncached, buffers from the pool are DMA coherent.
+ * Bus addresses are the physical ones.
+ */
+extern void *lpc313x_isram_alloc(size_t len, dma_addr_t *dma);
+extern void lpc313x_isram_free(void *addr, size_t len);
+
+/* ISRAM if there is room left, dma_alloc_coherent() memory otherwise */
+extern void *lpc313x_isram_alloc_coherent(struct device *dev, size_t len,
+		dma_addr_t *dma, gfp_t gfp);
+extern void lpc313x_isram_free_coherent(struct device *dev, size_t len,
+		void *addr, dma_addr_t dma);
+
+static inline int lpc313x_isram_owns(const void *addr)
+{
+	return (unsigned long)addr - io_p2v(ISRAM0_PHYS) < ISRAM0_LENGTH;
+}
+
+extern void __init lpc313x_isram_text_init(void);
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* __ASM_ARCH_ISRAM_H */
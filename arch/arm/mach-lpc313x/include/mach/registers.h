@@ -296,6 +296,8 @@
 #define SYS_MPMC_DELAY      __REG (SYS_PHYS + 0x68)
 #define SYS_MPMC_WTD_DEL0   __REG (SYS_PHYS + 0x6C)
 #define SYS_MPMC_WTD_DEL1   __REG (SYS_PHYS + 0x70)
+#define SYS_MPMC_TESTMODE0  __REG (SYS_PHYS + 0x74)
+#define SYS_MPMC_TESTMODE1  __REG (SYS_PHYS + 0x78)
 #define SYS_REMAP_ADDR      __REG (SYS_PHYS + 0x84)
 #define SYS_MUX_LCD_EBI     __REG (SYS_PHYS + 0x90)
 #define SYS_MUX_GPIO_MCI    __REG (SYS_PHYS + 0x94)
@@ -0,0 +1,37 @@
+/*  linux/arch/arm/mach-lpc313x/include/mach/vmlinux.lds.h
+ *
+ * LPC313x & LPC315x additions to the ARM kernel linker script.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __ASM_ARCH_VMLINUX_LDS_H
+#define __ASM_ARCH_VMLINUX_LDS_H
+
+#ifdef CONFIG_LPC313X_ISRAM_TEXT
+#include <mach/isram.h>
+
+/*
+ * Code run from ISRAM0. It is loaded after .data and copied to its run
+ * address by lpc313x_isram_text_init().
+ */
+#define MACH_DATA_SECTIONS						\
+	. = ALIGN(4);							\
+	__isram_text_loc = .;						\
+	.isram.text LPC313X_ISRAM_TEXT_VA : AT(__isram_text_loc) {	\
+		__isram_text_start = .;					\
+		*(.isram.text)						\
+		. = ALIGN(4);						\
+		__isram_text_end = .;					\
+	}								\
+	. = __isram_text_loc + SIZEOF(.isram.text);
+
+#define MACH_LDS_ASSERTS						\
+	ASSERT(__isram_text_end <= LPC313X_ISRAM_TEXT_END,		\
+		".isram.text too large")
+#endif
+
+#endif /* __ASM_ARCH_VMLINUX_LDS_H */
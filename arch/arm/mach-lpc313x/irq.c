@@ -29,15 +29,16 @@
 #include <asm/irq.h>
 #include <asm/mach/irq.h>
 #include <mach/irqs.h>
+#include <mach/isram.h>
 
 static IRQ_EVENT_MAP_T irq_2_event[] = BOARD_IRQ_EVENT_MAP;
 
-static void intc_mask_irq(unsigned int irq)
+static void __isram_text intc_mask_irq(unsigned int irq)
 {
 	INTC_REQ_REG(irq) = INTC_REQ_WE_ENABLE;
 }
 
-static void intc_unmask_irq(unsigned int irq)
+static void __isram_text intc_unmask_irq(unsigned int irq)
 {
 	INTC_REQ_REG(irq) = INTC_REQ_ENABLE | INTC_REQ_WE_ENABLE;
 }
@@ -49,7 +50,7 @@ static struct irq_chip lpc313x_internal_chip = {
 	.unmask = intc_unmask_irq,
 };
 
-static void evt_mask_irq(unsigned int irq)
+static void __isram_text evt_mask_irq(unsigned int irq)
 {
 	u32 bank = EVT_GET_BANK(irq_2_event[irq - IRQ_BOARD_START].event_pin);
 	u32 bit_pos = irq_2_event[irq - IRQ_BOARD_START].event_pin & 0x1F;
@@ -57,7 +58,7 @@ static void evt_mask_irq(unsigned int irq)
 	EVRT_MASK_CLR(bank) = _BIT(bit_pos);
 }
 
-static void evt_unmask_irq(unsigned int irq)
+static void __isram_text evt_unmask_irq(unsigned int irq)
 {
 	u32 bank = EVT_GET_BANK(irq_2_event[irq - IRQ_BOARD_START].event_pin);
 	u32 bit_pos = irq_2_event[irq - IRQ_BOARD_START].event_pin & 0x1F;
@@ -65,7 +66,7 @@ static void evt_unmask_irq(unsigned int irq)
 	EVRT_MASK_SET(bank) = _BIT(bit_pos);
 }
 
-static void evt_ack_irq(unsigned int irq)
+static void __isram_text evt_ack_irq(unsigned int irq)
 {
 	u32 bank = EVT_GET_BANK(irq_2_event[irq - IRQ_BOARD_START].event_pin);
 	u32 bit_pos = irq_2_event[irq - IRQ_BOARD_START].event_pin & 0x1F;
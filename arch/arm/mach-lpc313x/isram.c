@@ -0,0 +1,123 @@
+/*  arch/arm/mach-lpc313x/isram.c
+ *
+ * Internal SRAM allocator for LPC313x & LPC315x.
+ *
+ * ISRAM0 has no wait states and doesn't compete with the LCD refresh
+ * and the other SDRAM bus masters. Its bottom holds the .isram.text hot
+ * code (mapped cached) and the suspend code of pm.c, its top the
+ * self-refresh code of cpuidle.c. The rest is a genalloc pool for DMA
+ * descriptors and small buffers. That part is mapped uncached, so pool
+ * memory needs no cache maintenance for DMA.
+ *
+ * dma_lli_alloc() takes the scatter-gather list entries of the MMC, SPI
+ * and PCM drivers from the pool, 32 bytes each; when it runs out they
+ * come from SDRAM instead.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/genalloc.h>
+#include <linux/dma-mapping.h>
+
+#include <asm/cacheflush.h>
+
+#include <mach/hardware.h>
+#include <mach/isram.h>
+
+/* 32 byte granules, the size of a DMA linked list entry */
+#define LPC313X_ISRAM_ORDER	5
+
+#define LPC313X_ISRAM_POOL_VA	io_p2v(ISRAM0_PHYS + ISRAM0_POOL_OFS)
+
+static struct gen_pool *lpc313x_isram_pool;
+
+void *lpc313x_isram_alloc(size_t len, dma_addr_t *dma)
+{
+	unsigned long addr;
+
+	if (!lpc313x_isram_pool || !len)
+		return NULL;
+
+	addr = gen_pool_alloc(lpc313x_isram_pool, len);
+	if (!addr)
+		return NULL;
+
+	if (dma)
+		*dma = io_v2p(addr);
+
+	return (void *)addr;
+}
+EXPORT_SYMBOL(lpc313x_isram_alloc);
+
+void lpc313x_isram_free(void *addr, size_t len)
+{
+	if (addr)
+		gen_pool_free(lpc313x_isram_pool, (unsigned long)addr, len);
+}
+EXPORT_SYMBOL(lpc313x_isram_free);
+
+void *lpc313x_isram_alloc_coherent(struct device *dev, size_t len,
+		dma_addr_t *dma, gfp_t gfp)
+{
+	void *addr = lpc313x_isram_alloc(len, dma);
+
+	if (!addr)
+		addr = dma_alloc_coherent(dev, len, dma, gfp);
+
+	return addr;
+}
+EXPORT_SYMBOL(lpc313x_isram_alloc_coherent);
+
+void lpc313x_isram_free_coherent(struct device *dev, size_t len,
+		void *addr, dma_addr_t dma)
+{
+	if (lpc313x_isram_owns(addr))
+		lpc313x_isram_free(addr, len);
+	else if (addr)
+		dma_free_coherent(dev, len, addr, dma);
+}
+EXPORT_SYMBOL(lpc313x_isram_free_coherent);
+
+/*
+ * Copy .isram.text from its load address in the kernel image to where
+ * it was linked to run. Called from map_io, before interrupts are set up.
+ */
+void __init lpc313x_isram_text_init(void)
+{
+#ifdef CONFIG_LPC313X_ISRAM_TEXT
+	extern char __isram_text_start[], __isram_text_end[];
+	extern char __isram_text_loc[];
+
+	memcpy(__isram_text_start, __isram_text_loc,
+		__isram_text_end - __isram_text_start);
+	flush_icache_range((unsigned long)__isram_text_start,
+		(unsigned long)__isram_text_end);
+#endif
+}
+
+static int __init lpc313x_isram_init(void)
+{
+	lpc313x_isram_pool = gen_pool_create(LPC313X_ISRAM_ORDER, -1);
+	if (!lpc313x_isram_pool)
+		return -ENOMEM;
+
+	if (gen_pool_add(lpc313x_isram_pool, LPC313X_ISRAM_POOL_VA,
+			ISRAM0_POOL_SIZE, -1)) {
+		gen_pool_destroy(lpc313x_isram_pool);
+		lpc313x_isram_pool = NULL;
+		return -ENOMEM;
+	}
+
+	printk(KERN_INFO "ISRAM: %u bytes pool at 0x%08x\n",
+		(unsigned int)ISRAM0_POOL_SIZE, ISRAM0_PHYS + ISRAM0_POOL_OFS);
+
+	return 0;
+}
+core_initcall(lpc313x_isram_init);
@@ -21,6 +21,7 @@
  *
  */
 
+#include <linux/module.h>
 #include <linux/pm.h>
 #include <linux/rtc.h>
 #include <linux/sched.h>
@@ -30,9 +31,16 @@
 #include <linux/clk.h>
 #include <linux/io.h>
 #include <asm/cacheflush.h>
+#include <asm/div64.h>
+#include <mach/hardware.h>
+#include <mach/cgu.h>
 
 
-#define LPC313x_ISRAM_VA io_p2v(ISRAM0_PHYS)
+/*
+ * The suspend code is copied once at boot to its reserved ISRAM0 slot,
+ * nothing else uses that area so it needn't be saved around a suspend.
+ */
+#define LPC313x_ISRAM_VA (io_p2v(ISRAM0_PHYS) + ISRAM0_SUSPEND_OFS)
 
 /*
  * Pointers used for sizing and copying suspend function data
@@ -40,18 +48,115 @@
 extern int lpc313x_suspend_mem(void);
 extern int lpc313x_suspend_mem_sz;
 
+static int (*lpc313x_suspend_ptr) (u32);
 
-/* Enable/Disable external refresh controller used by
- * auto clock scaling feature of CGU.
+#ifdef CONFIG_PM_DEBUG
+/*
+ * Suspend/resume phase timing, printed when the system is back.
+ *
+ * The phases around .enter are timed with sched_clock(). TIMER1 under it
+ * is stopped from sysdev suspend to sysdev resume, so "power down" ends
+ * and "power up" starts there and .enter itself is timed on TIMER2, run
+ * as a stopwatch: "sleep" runs from the clock domains being switched
+ * off to their restart. TIMER2 is in the AHB0_APB1 domain which is
+ * stopped for suspend to RAM, then the time asleep is not counted.
  */
-static void lpc313x_ext_refresh_en(int enable)
+enum {
+	PM_T_BEGIN,
+	PM_T_PREPARE,
+	PM_T_ENTER,
+	PM_T_FINISH,
+	PM_T_END,
+	PM_T_NR,
+};
+
+enum {
+	PM_SW_ENTER,
+	PM_SW_SLEEP,
+	PM_SW_WAKE,
+	PM_SW_DONE,
+	PM_SW_NR,
+};
+
+static unsigned long long lpc313x_pm_t[PM_T_NR];
+static u32 lpc313x_pm_sw[PM_SW_NR];
+static u32 lpc313x_pm_sw_hz;
+
+static inline void lpc313x_pm_stamp(int phase)
+{
+	lpc313x_pm_t[phase] = sched_clock();
+}
+
+static inline void lpc313x_pm_sw_stamp(int phase)
+{
+	lpc313x_pm_sw[phase] = ~TIMER_VALUE(TIMER2_PHYS);
+}
+
+static void lpc313x_pm_sw_start(void)
+{
+	memset(lpc313x_pm_sw, 0, sizeof(lpc313x_pm_sw));
+	cgu_clk_en_dis(CGU_SB_TIMER2_PCLK_ID, 1);
+	lpc313x_pm_sw_hz = cgu_get_clk_freq(CGU_SB_TIMER2_PCLK_ID);
+	TIMER_CONTROL(TIMER2_PHYS) = 0;
+	TIMER_LOAD(TIMER2_PHYS) = 0xffffffff;
+	TIMER_CONTROL(TIMER2_PHYS) = TM_CTRL_ENABLE;
+}
+
+static void lpc313x_pm_sw_stop(void)
+{
+	TIMER_CONTROL(TIMER2_PHYS) = 0;
+	cgu_clk_en_dis(CGU_SB_TIMER2_PCLK_ID, 0);
+}
+
+static unsigned long lpc313x_pm_us(int from, int to)
 {
-	if (enable)
-		SYS_MPMC_TESTMODE0 |= _BIT(12);
-	else
-		SYS_MPMC_TESTMODE0 &= ~_BIT(12);
+	unsigned long long ns;
 
+	if (!lpc313x_pm_t[from] || !lpc313x_pm_t[to])
+		return 0;
+	ns = lpc313x_pm_t[to] - lpc313x_pm_t[from];
+	do_div(ns, NSEC_PER_USEC);
+
+	return (unsigned long)ns;
+}
+
+static unsigned long lpc313x_pm_sw_us(int from, int to)
+{
+	unsigned long long us;
+
+	if (!lpc313x_pm_sw_hz)
+		return 0;
+	us = (unsigned long long)(lpc313x_pm_sw[to] - lpc313x_pm_sw[from]) *
+		USEC_PER_SEC;
+	do_div(us, lpc313x_pm_sw_hz);
+
+	return (unsigned long)us;
 }
+
+static void lpc313x_pm_report(void)
+{
+	printk(KERN_INFO "PM: suspend devices %lu us, power down %lu us\n",
+		lpc313x_pm_us(PM_T_BEGIN, PM_T_PREPARE),
+		lpc313x_pm_us(PM_T_PREPARE, PM_T_ENTER));
+	if (lpc313x_pm_sw_hz)
+		printk(KERN_INFO "PM: enter %lu us, sleep %lu us, "
+			"exit %lu us\n",
+			lpc313x_pm_sw_us(PM_SW_ENTER, PM_SW_SLEEP),
+			lpc313x_pm_sw_us(PM_SW_SLEEP, PM_SW_WAKE),
+			lpc313x_pm_sw_us(PM_SW_WAKE, PM_SW_DONE));
+	printk(KERN_INFO "PM: power up %lu us, resume devices %lu us\n",
+		lpc313x_pm_us(PM_T_ENTER, PM_T_FINISH),
+		lpc313x_pm_us(PM_T_FINISH, PM_T_END));
+}
+#else
+static inline void lpc313x_pm_stamp(int phase) { }
+static inline void lpc313x_pm_sw_stamp(int phase) { }
+static inline void lpc313x_pm_sw_start(void) { }
+static inline void lpc313x_pm_sw_stop(void) { }
+static inline void lpc313x_pm_report(void) { }
+#endif
+
+
 static int lpc313x_pm_valid_state(suspend_state_t state)
 {
 	switch (state) {
@@ -74,9 +179,29 @@ static suspend_state_t target_state;
 static int lpc313x_pm_begin(suspend_state_t state)
 {
 	target_state = state;
+#ifdef CONFIG_PM_DEBUG
+	memset(lpc313x_pm_t, 0, sizeof(lpc313x_pm_t));
+	lpc313x_pm_sw_hz = 0;
+#endif
+	lpc313x_pm_stamp(PM_T_BEGIN);
 	return 0;
 }
 
+/*
+ * Called after devices are suspended, prepare and finish are only there
+ * for the phase timing.
+ */
+static int lpc313x_pm_prepare(void)
+{
+	lpc313x_pm_stamp(PM_T_PREPARE);
+	return 0;
+}
+
+static void lpc313x_pm_finish(void)
+{
+	lpc313x_pm_stamp(PM_T_FINISH);
+}
+
 static void lpc313x_clk_debug(void)
 {
 #ifdef CONFIG_PM_DEBUG
@@ -95,17 +220,15 @@ static void lpc313x_clk_debug(void)
 
 static int lpc313x_enter_sleep(u32 standby)
 {
-	int (*lpc313x_suspend_ptr) (u32);
 	int i;
 	u32 base_clk_state = 0;
 
-#if defined(BACKUP_ISRAM)
-	void *iram_swap_area;
-#endif
-
 	/* print clocks which are still on */
 	lpc313x_clk_debug();
 
+	lpc313x_pm_sw_start();
+	lpc313x_pm_sw_stamp(PM_SW_ENTER);
+
 	lpc313x_ext_refresh_en(0);
 	/*
 	 * To simplify stand-by routine, set FFAST as source clock for the
@@ -117,6 +240,10 @@ static int lpc313x_enter_sleep(u32 standby)
 		else
 			CGU_SB->base_fs1[i] = CGU_FIN_SELECT_FFAST;
 	}
+
+	/* TIMER2 can't be read while the APB1 domain is stopped */
+	lpc313x_pm_sw_stamp(PM_SW_SLEEP);
+
 	if (standby == 0) {
 		/* switch off remaining pheripheral clock domains */
 		for (i = 2; i < CGU_SB_NR_BASE; i++) {
@@ -132,44 +259,9 @@ static int lpc313x_enter_sleep(u32 standby)
 		CGU_SB->clk_pcr[CGU_SB_INTC_CLK_ID] = CGU_SB_PCR_RUN;
 	}
 
-
-
-#if defined(BACKUP_ISRAM)
-	/* Allocate some space for temporary IRAM storage */
-	iram_swap_area = kmalloc(lpc313x_suspend_mem_sz, GFP_KERNEL);
-	if (!iram_swap_area) {
-		printk(KERN_ERR
-		       "PM Suspend: cannot allocate memory to save portion "
-			"of SRAM\n");
-		return -ENOMEM;
-	}
-	/* Backup a small area of IRAM used for the suspend code */
-	memcpy(iram_swap_area, (void *) LPC313x_ISRAM_VA,
-			lpc313x_suspend_mem_sz);
-#endif
-
-	/*
-	 * Copy code to suspend system into IRAM. The suspend code
-	 * needs to run from IRAM as DRAM may no longer be available
-	 * when the PLL is stopped.
-	 */
-	memcpy((void *) LPC313x_ISRAM_VA, &lpc313x_suspend_mem,
-			lpc313x_suspend_mem_sz);
-	flush_icache_range((unsigned long)LPC313x_ISRAM_VA,
-		(unsigned long)(LPC313x_ISRAM_VA) + lpc313x_suspend_mem_sz);
-
 	/* Transfer to suspend code in IRAM */
-	lpc313x_suspend_ptr = (void *) LPC313x_ISRAM_VA;
 	(void) lpc313x_suspend_ptr(standby);
 
-#if defined(BACKUP_ISRAM)
-	/* Restore original IRAM contents */
-	memcpy((void *) LPC313x_ISRAM_VA, iram_swap_area,
-			lpc313x_suspend_mem_sz);
-
-	kfree(iram_swap_area);
-#endif
-
 	if (standby == 0) {
 		/* switch on domains clocks which were switched off in this
 		 * routine.
@@ -185,8 +277,13 @@ static int lpc313x_enter_sleep(u32 standby)
 					CGU_SB_PCR_RUN | CGU_SB_PCR_AUTO;
 	}
 
+	lpc313x_pm_sw_stamp(PM_SW_WAKE);
+
 	lpc313x_ext_refresh_en(1);
 
+	lpc313x_pm_sw_stamp(PM_SW_DONE);
+	lpc313x_pm_sw_stop();
+
 	return 0;
 }
 
@@ -196,6 +293,8 @@ static int lpc313x_pm_enter(suspend_state_t state)
 {
 	int ret = 0;
 
+	lpc313x_pm_stamp(PM_T_ENTER);
+
 	switch (state) {
 		/*
 		 * Suspend-to-RAM is like STANDBY plus slow clock mode, so
@@ -242,6 +341,9 @@ error:
 static void lpc313x_pm_end(void)
 {
 	target_state = PM_SUSPEND_ON;
+
+	lpc313x_pm_stamp(PM_T_END);
+	lpc313x_pm_report();
 }
 
 /*
@@ -259,7 +361,9 @@ EXPORT_SYMBOL(lpc313x_entering_suspend_mem);
 static struct platform_suspend_ops lpc313x_pm_ops ={
 	.valid	= lpc313x_pm_valid_state,
 	.begin	= lpc313x_pm_begin,
+	.prepare = lpc313x_pm_prepare,
 	.enter	= lpc313x_pm_enter,
+	.finish	= lpc313x_pm_finish,
 	.end	= lpc313x_pm_end,
 };
 
@@ -271,6 +375,21 @@ static int __init lpc313x_pm_init(void)
 	 * as wakeable.
 	 */
 
+	/*
+	 * Copy code to suspend system into IRAM. The suspend code
+	 * needs to run from IRAM as DRAM may no longer be available
+	 * when the PLL is stopped.
+	 */
+	if (lpc313x_suspend_mem_sz > ISRAM0_SUSPEND_SIZE) {
+		printk(KERN_ERR "PM: suspend code too large for its "
+			"ISRAM slot\n");
+		return -ENOMEM;
+	}
+	memcpy((void *) LPC313x_ISRAM_VA, &lpc313x_suspend_mem,
+			lpc313x_suspend_mem_sz);
+	flush_icache_range((unsigned long)LPC313x_ISRAM_VA,
+		(unsigned long)(LPC313x_ISRAM_VA) + lpc313x_suspend_mem_sz);
+	lpc313x_suspend_ptr = (void *) LPC313x_ISRAM_VA;
 
 	suspend_set_ops(&lpc313x_pm_ops);
 
@@ -25,22 +25,83 @@
 #include <linux/interrupt.h>
 #include <linux/irq.h>
 #include <linux/time.h>
+#include <linux/clockchips.h>
+#include <linux/clocksource.h>
+#include <linux/cnt32_to_63.h>
 
 #include <mach/hardware.h>
 #include <asm/io.h>
 #include <asm/irq.h>
 #include <asm/leds.h>
+#include <asm/div64.h>
 
 #include <asm/mach/time.h>
 #include <mach/gpio.h>
 #include <mach/board.h>
+#include <mach/isram.h>
 //#include <mach/cgu.h>
 
+/*
+ * TIMER0 is the clock event device, TIMER1 runs free as the clocksource.
+ * Both count down at CLOCK_TICK_RATE. The timers have no one-shot mode,
+ * so one-shot events use periodic mode and the interrupt handler stops
+ * the timer again.
+ */
+
+static enum clock_event_mode lpc313x_clkevt_mode = CLOCK_EVT_MODE_UNUSED;
 
-static irqreturn_t lpc313x_timer_interrupt(int irq, void *dev_id)
+static void lpc313x_clkevt_set_mode(enum clock_event_mode mode,
+			   struct clock_event_device *clk)
 {
+	TIMER_CONTROL(TIMER0_PHYS) = 0;
 	TIMER_CLEAR(TIMER0_PHYS) = 0;
-	timer_tick();
+
+	switch (mode) {
+	case CLOCK_EVT_MODE_PERIODIC:
+		TIMER_LOAD(TIMER0_PHYS) = LATCH;
+		TIMER_CONTROL(TIMER0_PHYS) = (TM_CTRL_ENABLE | TM_CTRL_PERIODIC);
+		break;
+	case CLOCK_EVT_MODE_ONESHOT:
+		/* period set, and timer enabled in 'next_event' hook */
+	case CLOCK_EVT_MODE_UNUSED:
+	case CLOCK_EVT_MODE_SHUTDOWN:
+	case CLOCK_EVT_MODE_RESUME:
+	default:
+		break;
+	}
+
+	lpc313x_clkevt_mode = mode;
+}
+
+static int __isram_text lpc313x_clkevt_next_event(unsigned long delta,
+				struct clock_event_device *unused)
+{
+	TIMER_CONTROL(TIMER0_PHYS) = 0;
+	TIMER_LOAD(TIMER0_PHYS) = delta;
+	TIMER_CONTROL(TIMER0_PHYS) = (TM_CTRL_ENABLE | TM_CTRL_PERIODIC);
+
+	return 0;
+}
+
+static struct clock_event_device lpc313x_clkevt = {
+	.name		= "timer0",
+	.shift		= 32,
+	.features	= CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+	.rating		= 200,
+	.set_mode	= lpc313x_clkevt_set_mode,
+	.set_next_event	= lpc313x_clkevt_next_event,
+};
+
+static irqreturn_t __isram_text lpc313x_timer_interrupt(int irq, void *dev_id)
+{
+	struct clock_event_device *evt = &lpc313x_clkevt;
+
+	if (lpc313x_clkevt_mode == CLOCK_EVT_MODE_ONESHOT)
+		TIMER_CONTROL(TIMER0_PHYS) = 0;
+	TIMER_CLEAR(TIMER0_PHYS) = 0;
+
+	evt->event_handler(evt);
+
 	return IRQ_HANDLED;
 }
 
@@ -50,47 +111,104 @@ static struct irqaction lpc313x_timer_irq = {
 	.handler	= lpc313x_timer_interrupt,
 };
 
+static cycle_t lpc313x_clksrc_read(void)
+{
+	return ~TIMER_VALUE(TIMER1_PHYS);
+}
+
+static struct clocksource lpc313x_clksrc = {
+	.name		= "timer1",
+	.rating		= 200,
+	.read		= lpc313x_clksrc_read,
+	.mask		= CLOCKSOURCE_MASK(32),
+	.shift		= 20,
+	.flags		= CLOCK_SOURCE_IS_CONTINUOUS,
+};
+
+/*
+ * sched_clock() on the TIMER1 count, extended to 63 bits by cnt32_to_63().
+ * At 6 MHz this has a resolution of 167 ns and a range of 208 days, and
+ * stays monotonic as long as it is called at least every 357 seconds,
+ * which the scheduler does even on a tickless idle system.
+ */
+#define CYC2NS_SCALE_FACTOR	10
+
+static unsigned long cyc2ns_scale;
+
+static void __init set_cyc2ns_scale(unsigned long rate)
+{
+	unsigned long long v = 1000000000ULL << CYC2NS_SCALE_FACTOR;
+
+	do_div(v, rate);
+	cyc2ns_scale = v;
+	/*
+	 * We want an even value to automatically clear the top bit
+	 * returned by cnt32_to_63() without an additional run time
+	 * instruction. So if the LSB is 1 then round it up.
+	 */
+	if (cyc2ns_scale & 1)
+		cyc2ns_scale++;
+}
+
+unsigned long long sched_clock(void)
+{
+	unsigned long long v = cnt32_to_63(~TIMER_VALUE(TIMER1_PHYS));
+
+	return (v * cyc2ns_scale) >> CYC2NS_SCALE_FACTOR;
+}
+
+static void lpc313x_clksrc_start(void)
+{
+	/* free running from 0xffffffff */
+	TIMER_CONTROL(TIMER1_PHYS) = 0;
+	TIMER_LOAD(TIMER1_PHYS) = 0xffffffff;
+	TIMER_CONTROL(TIMER1_PHYS) = TM_CTRL_ENABLE;
+}
+
 static void __init lpc313x_timer_init (void)
 {
 	/* Switch on needed Timer clocks & switch off others*/
 	cgu_clk_en_dis(CGU_SB_TIMER0_PCLK_ID, 1);
-	cgu_clk_en_dis(CGU_SB_TIMER1_PCLK_ID, 0);
+	cgu_clk_en_dis(CGU_SB_TIMER1_PCLK_ID, 1);
 	cgu_clk_en_dis(CGU_SB_TIMER2_PCLK_ID, 0);
 	cgu_clk_en_dis(CGU_SB_TIMER3_PCLK_ID, 0);
 
 	/* Stop/disable all timers */
 	TIMER_CONTROL(TIMER0_PHYS) = 0;
-
-	TIMER_LOAD(TIMER0_PHYS) = LATCH;
-	TIMER_CONTROL(TIMER0_PHYS) = (TM_CTRL_ENABLE | TM_CTRL_PERIODIC);
 	TIMER_CLEAR(TIMER0_PHYS) = 0;
+
+	lpc313x_clksrc_start();
+	set_cyc2ns_scale(CLOCK_TICK_RATE);
+	lpc313x_clksrc.mult =
+		clocksource_hz2mult(CLOCK_TICK_RATE, lpc313x_clksrc.shift);
+	clocksource_register(&lpc313x_clksrc);
+
 	setup_irq (IRQ_TIMER0, &lpc313x_timer_irq);
-}
 
-/*!
- * Returns number of us since last clock interrupt.  Note that interrupts
- * will have been disabled by do_gettimeoffset()
- */
-static unsigned long lpc313x_gettimeoffset(void)
-{
-	u32 elapsed = LATCH - TIMER_VALUE(TIMER0_PHYS);
-	return ((elapsed * 100) / (XTAL_CLOCK / 20000));
+	lpc313x_clkevt.mult =
+		div_sc(CLOCK_TICK_RATE, NSEC_PER_SEC, lpc313x_clkevt.shift);
+	lpc313x_clkevt.max_delta_ns =
+		clockevent_delta2ns(0xffffffff, &lpc313x_clkevt);
+	lpc313x_clkevt.min_delta_ns =
+		clockevent_delta2ns(0xf, &lpc313x_clkevt);
+	lpc313x_clkevt.cpumask = cpumask_of_cpu(0);
+	clockevents_register_device(&lpc313x_clkevt);
 }
 
 static void lpc313x_timer_suspend(void)
 {
-	TIMER_CONTROL(TIMER0_PHYS) &= ~TM_CTRL_ENABLE;	/* disable timers */
+	/* the clock event device has been shut down by the core */
+	TIMER_CONTROL(TIMER1_PHYS) &= ~TM_CTRL_ENABLE;
 }
 
 static void lpc313x_timer_resume(void)
 {
-	TIMER_CONTROL(TIMER0_PHYS) |= TM_CTRL_ENABLE;	/* enable timers */
+	TIMER_CONTROL(TIMER1_PHYS) |= TM_CTRL_ENABLE;
 }
 
 
 struct sys_timer lpc313x_timer = {
 	.init = lpc313x_timer_init,
-	.offset = lpc313x_gettimeoffset,
 	.suspend = lpc313x_timer_suspend,
 	.resume = lpc313x_timer_resume,
 };
@@ -5,14 +5,25 @@
 
 #include <crypto/aes.h>
 #include <crypto/algapi.h>
+#include <crypto/scatterwalk.h>
 #include <linux/crypto.h>
+#include <linux/clk.h>
+#include <linux/debugfs.h>
+#include <linux/dma-mapping.h>
 #include <linux/io.h>
 #include <linux/mutex.h>
 #include <linux/kthread.h>
+#include <linux/moduleparam.h>
 #include <linux/interrupt.h>
 #include <linux/platform_device.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/swab.h>
 
+#include <asm/div64.h>
+
+#include <mach/aes.h>
 #include <mach/cgu.h>
 #include <mach/dma.h>
 
@@ -24,21 +35,41 @@
 #define	IV								0x64/4
 #define AES_FROM_AHB 			0x7C/4
 
-#define	CHUNK			512
+#define	CHUNK			LPC3143_AES_CHUNK
 
-//~ #define ASYNC  // TO-FIX: IRQ problems right now
+#define	QUEUE_LEN		50
 
 static struct lpc3143_aes_priv
 {
 	unsigned long __iomem *regs;
 	unsigned long phys_sram[2];
+	unsigned char __iomem *sram;
+	unsigned char *bounce;
+	struct device *dev;
 	int irq;
 	int dma_ch;
 
-#ifdef ASYNC
+	/* key now in the engine, valid while key_loaded is set */
+	unsigned int key[4];
+	int key_loaded;
+
 	struct crypto_queue queue;
+	struct list_head streams;	/* under qlock too */
 	spinlock_t qlock;
-	struct task_struct *workers[2];
+	struct task_struct *worker;
+
+	/* statistics, see the debugfs "stats" file */
+	unsigned long requests;
+	unsigned long batches;
+	unsigned long chunks;
+	unsigned long key_loads;
+	unsigned long key_skips;
+	unsigned int qlen_max;
+	u64 bytes;
+	u64 busy_ns;
+	ktime_t since;
+#if defined (CONFIG_DEBUG_FS)
+	struct dentry *debugfs_root;
 #endif
 } aeshw;
 
@@ -46,25 +77,114 @@ struct lpc3143_aes_instance
 {
 	unsigned int key[4];
 	unsigned int round_key[44];
+
+	/* "cbc(aes)" only: FIPS byte order, and the software cbc(aes)
+	   for the key sizes the engine doesn't have */
+	int fips;
+	unsigned int keylen;
+	struct crypto_blkcipher *fallback;
 };
 
-#ifdef ASYNC
 static DECLARE_WAIT_QUEUE_HEAD(aesreqq);
-#endif
 
 static DEFINE_MUTEX(aeshw_mtx);
 
 static DECLARE_COMPLETION(aescomplete);
+static DECLARE_COMPLETION(aesdmadone);
+
+/* set once the engine is up, the exported stream API checks it */
+static int probed;
+
+/*
+ * One piece of work for the engine: at most CHUNK bytes copied into a
+ * SRAM bank, decrypted there and copied back out. The data is either at
+ * the physical addresses src/dst, or in the scatterlists src_sg/dst_sg
+ * at the given offsets. Scatterlist pieces that don't suit the DMA are
+ * copied by the CPU.
+ */
+struct lpc3143_aes_chunk
+{
+	unsigned long src;
+	unsigned long dst;
+	struct scatterlist *src_sg;
+	struct scatterlist *dst_sg;
+	unsigned int src_off;
+	unsigned int dst_off;
+	unsigned int len;
+	int cpu;
+	int rev;		/* FIPS byte order, reversed around the engine */
+	const unsigned int *iv;	/* IV to start this chunk with, or NULL */
+	unsigned int iv_buf[4];	/* aligned copy of the request IV */
+	void *iv_out;		/* gets the last cipher text block */
+	unsigned int last[4];	/* last cipher text block, for chaining */
+	void *req;		/* request finished once this is drained */
+};
+
+/*
+ * A run of chunks decrypted with the same key. get_chunk() is called
+ * once per chunk, in order, right before the chunk is loaded, and
+ * returns 0 when there are no chunks left; put_chunk(), if set, once
+ * the chunk is back out. A chunk without an IV of its own continues
+ * the CBC stream of the previous one when chain is set, otherwise the
+ * engine IV is left as it is.
+ */
+struct lpc3143_aes_job
+{
+	const unsigned int *key;
+	int chain;
+	unsigned int *iv_save;	/* gets the engine IV at the end */
+	int (*get_chunk)(struct lpc3143_aes_job *job, int i,
+		struct lpc3143_aes_chunk *c);
+	void (*put_chunk)(struct lpc3143_aes_job *job,
+		struct lpc3143_aes_chunk *c);
+	void *priv;
+};
 
 static void encrypt_block(unsigned int block[], unsigned int const rk[]);
 static void expand_key(unsigned char const *key, unsigned int round_key[]);
 
+asmlinkage void lpc3143_aes_cbc_enc(const unsigned int *rk, unsigned int *iv,
+	void *dst, const void *src, unsigned int nblocks);
+
+/*
+ * The engine and the CPU core both take blocks, keys and IVs with the
+ * order of all 16 bytes reversed from FIPS-197. "cbc(aes)" reverses them
+ * on the way in and out; CBC only XORs whole blocks, so the chaining
+ * works the same in either order.
+ */
+static void lpc3143_rev_block(unsigned int *b)
+{
+	unsigned int t0 = swab32(b[0]), t1 = swab32(b[1]);
+
+	b[0] = swab32(b[3]);
+	b[1] = swab32(b[2]);
+	b[2] = t1;
+	b[3] = t0;
+}
+
+static void lpc3143_rev_blocks(void *buf, unsigned int len)
+{
+	unsigned int *b = buf;
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE, b += 4)
+		lpc3143_rev_block(b);
+}
+
+static int bench;
+module_param(bench, bool, 0444);
+MODULE_PARM_DESC(bench, "Time the C and assembly encryption at probe");
+
+static int async = 1;
+module_param(async, bool, 0444);
+MODULE_PARM_DESC(async, "Queue dm-crypt style requests to a worker thread");
+
 static void lpc3143_aes_dma_irq(int ch, dma_irq_type_t dtype, void *handle)
 {
-	// not used
+	if (dtype == DMA_IRQ_FINISHED)
+		complete(&aesdmadone);
 }
 
-static void lpc3143_dmacpy(unsigned long dest, unsigned long src, int len)
+static void lpc3143_dma_start(unsigned long dest, unsigned long src, int len)
 {
 	dma_setup_t tx =
 	{
@@ -74,10 +194,29 @@ static void lpc3143_dmacpy(unsigned long dest, unsigned long src, int len)
 		.dest_address	= dest
 	};
 
+	INIT_COMPLETION(aesdmadone);
+
 	dma_prog_channel(aeshw.dma_ch, &tx);
 	dma_start_channel(aeshw.dma_ch);
+}
+
+static int lpc3143_dma_wait(void)
+{
+	if (!wait_for_completion_timeout(&aesdmadone, HZ/10))
+	{
+		dma_stop_channel(aeshw.dma_ch);
+		dev_err(aeshw.dev, "DMA never finished!\n");
+		return -EFAULT;
+	}
 
-	while (dma_channel_enabled(aeshw.dma_ch));
+	return 0;
+}
+
+static int lpc3143_dmacpy(unsigned long dest, unsigned long src, int len)
+{
+	lpc3143_dma_start(dest, src, len);
+
+	return lpc3143_dma_wait();
 }
 
 static irqreturn_t lpc3143_aes_irq(int irq, void *priv)
@@ -122,72 +261,428 @@ static int lpc3143_aes_setkey_blk(struct crypto_tfm *tfm,
 
 }
 
+static int lpc3143_aes_setkey_fips(struct crypto_ablkcipher *cipher,
+	const u8 *key, unsigned int len)
+{
+	struct crypto_tfm *tfm = crypto_ablkcipher_tfm(cipher);
+	struct lpc3143_aes_instance *ctx = crypto_tfm_ctx(tfm);
+	int ret;
+
+	ctx->keylen = len;
+
+	if (len == AES_KEYSIZE_128)
+	{
+		memcpy(ctx->key, key, sizeof(ctx->key));
+		lpc3143_rev_block(ctx->key);
+		expand_key((unsigned char *)ctx->key, ctx->round_key);
+		return 0;
+	}
+
+	/* The engine only does AES-128 */
+	ctx->fallback->base.crt_flags &= ~CRYPTO_TFM_REQ_MASK;
+	ctx->fallback->base.crt_flags |= (tfm->crt_flags & CRYPTO_TFM_REQ_MASK);
+
+	ret = crypto_blkcipher_setkey(ctx->fallback, key, len);
+	if (ret)
+	{
+		tfm->crt_flags &= ~CRYPTO_TFM_RES_MASK;
+		tfm->crt_flags |= (ctx->fallback->base.crt_flags &
+			CRYPTO_TFM_RES_MASK);
+	}
+
+	return ret;
+}
+
 
-static int lpc3143_handle_req(int idx, struct ablkcipher_request *req)
+static int lpc3143_aes_load(struct lpc3143_aes_chunk *c, int bank)
 {
-	unsigned int *iv = req->info;
-	unsigned int *k =
-		((struct lpc3143_aes_instance *)crypto_tfm_ctx(req->base.tfm))->key;
-	long l;
+	unsigned char __iomem *sram = aeshw.sram + bank * 0x400;
+	dma_addr_t addr;
+	int ret;
 
-	if (req->nbytes != CHUNK)
+	if (!c->src_sg && aeshw.dma_ch < 0)
 	{
-		printk(KERN_CRIT "lpc3143_aes: data size != chunk size!!\n");
-		return -EFAULT;
+		memcpy_toio(sram, phys_to_virt(c->src), c->len);
+		ret = 0;
+	}
+	else if (!c->src_sg)
+		ret = lpc3143_dmacpy(aeshw.phys_sram[bank], c->src, c->len);
+	else if (c->cpu)
+	{
+		scatterwalk_map_and_copy(aeshw.bounce, c->src_sg, c->src_off,
+			c->len, 0);
+		if (c->rev)
+			lpc3143_rev_blocks(aeshw.bounce, c->len);
+		memcpy_toio(sram, aeshw.bounce, c->len);
+		ret = 0;
+	}
+	else
+	{
+		addr = dma_map_page(aeshw.dev, sg_page(c->src_sg),
+			c->src_sg->offset + c->src_off, c->len, DMA_TO_DEVICE);
+		ret = lpc3143_dmacpy(aeshw.phys_sram[bank], addr, c->len);
+		dma_unmap_page(aeshw.dev, addr, c->len, DMA_TO_DEVICE);
 	}
 
-	mutex_lock(&aeshw_mtx);
+	/* the engine overwrites it, keep it for the next IV */
+	memcpy_fromio(c->last, sram + c->len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
 
-	lpc3143_dmacpy(aeshw.phys_sram[idx], sg_phys(req->src), CHUNK);
+	return ret;
+}
+
+static int lpc3143_aes_drain(struct lpc3143_aes_chunk *c, int bank)
+{
+	dma_addr_t addr;
+	int ret;
+
+	if (!c->dst_sg && aeshw.dma_ch < 0)
+	{
+		memcpy_fromio(phys_to_virt(c->dst), aeshw.sram + bank * 0x400,
+			c->len);
+		return 0;
+	}
+
+	if (!c->dst_sg)
+		return lpc3143_dmacpy(c->dst, aeshw.phys_sram[bank], c->len);
+
+	if (c->cpu)
+	{
+		memcpy_fromio(aeshw.bounce, aeshw.sram + bank * 0x400, c->len);
+		if (c->rev)
+			lpc3143_rev_blocks(aeshw.bounce, c->len);
+		scatterwalk_map_and_copy(aeshw.bounce, c->dst_sg, c->dst_off,
+			c->len, 1);
+		return 0;
+	}
+
+	/*
+	 * Mapped only now: CPU copies of the neighbouring chunks may have
+	 * pulled shared cache lines back in since this chunk was loaded.
+	 */
+	addr = dma_map_page(aeshw.dev, sg_page(c->dst_sg),
+		c->dst_sg->offset + c->dst_off, c->len, DMA_FROM_DEVICE);
+	ret = lpc3143_dmacpy(addr, aeshw.phys_sram[bank], c->len);
+	dma_unmap_page(aeshw.dev, addr, c->len, DMA_FROM_DEVICE);
+
+	return ret;
+}
+
+/* Called with aeshw_mtx held */
+static void lpc3143_aes_set_key(const unsigned int *k)
+{
+	if (aeshw.key_loaded && !memcmp(aeshw.key, k, sizeof(aeshw.key)))
+	{
+		aeshw.key_skips++;
+		return;
+	}
 
 	writel(k[0], &aeshw.regs[KEY+0]);
 	writel(k[1], &aeshw.regs[KEY+1]);
 	writel(k[2], &aeshw.regs[KEY+2]);
 	writel(k[3], &aeshw.regs[KEY+3]);
 
-	writel(iv[0], &aeshw.regs[IV+0]);
-	writel(iv[1], &aeshw.regs[IV+1]);
-	writel(iv[2], &aeshw.regs[IV+2]);
-	writel(iv[3], &aeshw.regs[IV+3]);
+	memcpy(aeshw.key, k, sizeof(aeshw.key));
+	aeshw.key_loaded = 1;
+	aeshw.key_loads++;
+}
+
+static int lpc3143_aes_put(struct lpc3143_aes_job *job,
+	struct lpc3143_aes_chunk *c, int bank)
+{
+	unsigned int iv[4];
+	int ret = lpc3143_aes_drain(c, bank);
 
-	writel(NAND_AES_AHB_EN |
-		(idx ? NAND_AES_AHB_DCRYPT_RAM1 : NAND_AES_AHB_DCRYPT_RAM0),
-		&aeshw.regs[AES_FROM_AHB]);
+	if (ret)
+		return ret;
 
-#ifdef ASYNC
-	l = wait_for_completion_timeout(&aescomplete, HZ/20);
-#else
-	for (l = 50; l && !try_wait_for_completion(&aescomplete); --l);
-#endif
-	INIT_COMPLETION(aescomplete);
+	aeshw.chunks++;
+	aeshw.bytes += c->len;
 
-	if (!l)
+	if (c->iv_out)
+	{
+		memcpy(iv, c->last, AES_BLOCK_SIZE);
+		if (c->rev)
+			lpc3143_rev_block(iv);
+		memcpy(c->iv_out, iv, AES_BLOCK_SIZE);
+	}
+	if (job->put_chunk)
+		job->put_chunk(job, c);
+
+	return 0;
+}
+
+/*
+ * Run a job through both SRAM banks. While the engine decrypts chunk i
+ * in one bank, the DMA channel drains chunk i-1 out of the other bank
+ * and fills it with chunk i+1, so the engine never waits on the copies
+ * once the pipeline is primed.
+ */
+static int lpc3143_aes_run(struct lpc3143_aes_job *job)
+{
+	struct lpc3143_aes_chunk c[3];
+	ktime_t start;
+	int i, more, ret;
+
+	mutex_lock(&aeshw_mtx);
+
+	if (!job->get_chunk(job, 0, &c[0]))
 	{
-		// timed out
-		printk(KERN_CRIT "lpc3143_aes: IRQ never arrived!\n");
 		mutex_unlock(&aeshw_mtx);
-		return -EFAULT;
+		return 0;
+	}
+
+	start = ktime_get();
+
+	lpc3143_aes_set_key(job->key);
+
+	ret = lpc3143_aes_load(&c[0], 0);
+
+	for (i = 0, more = 1; !ret && more; i++)
+	{
+		struct lpc3143_aes_chunk *cur = &c[i % 3];
+		const unsigned int *iv = cur->iv;
+		int bank = i & 1;
+
+		if (!iv && job->chain && i)
+			iv = c[(i - 1) % 3].last;
+
+		if (iv)
+		{
+			writel(iv[0], &aeshw.regs[IV+0]);
+			writel(iv[1], &aeshw.regs[IV+1]);
+			writel(iv[2], &aeshw.regs[IV+2]);
+			writel(iv[3], &aeshw.regs[IV+3]);
+		}
+
+		INIT_COMPLETION(aescomplete);
+		writel(NAND_AES_AHB_EN |
+			(bank ? NAND_AES_AHB_DCRYPT_RAM1 : NAND_AES_AHB_DCRYPT_RAM0),
+			&aeshw.regs[AES_FROM_AHB]);
+
+		if (i > 0)
+			ret = lpc3143_aes_put(job, &c[(i - 1) % 3], !bank);
+
+		more = job->get_chunk(job, i + 1, &c[(i + 1) % 3]);
+		if (!ret && more)
+			ret = lpc3143_aes_load(&c[(i + 1) % 3], !bank);
+
+		/* never leave the engine running behind our back */
+		if (!wait_for_completion_timeout(&aescomplete, HZ/20))
+		{
+			dev_err(aeshw.dev, "IRQ never arrived!\n");
+			ret = -EFAULT;
+		}
 	}
 
-	lpc3143_dmacpy(sg_phys(req->dst), aeshw.phys_sram[idx], CHUNK);
+	if (!ret)
+		ret = lpc3143_aes_put(job, &c[(i - 1) % 3], (i - 1) & 1);
+
+	if (job->iv_save)
+	{
+		job->iv_save[0] = readl(&aeshw.regs[IV+0]);
+		job->iv_save[1] = readl(&aeshw.regs[IV+1]);
+		job->iv_save[2] = readl(&aeshw.regs[IV+2]);
+		job->iv_save[3] = readl(&aeshw.regs[IV+3]);
+	}
+
+	aeshw.busy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
 
 	mutex_unlock(&aeshw_mtx);
 
-	return 0;
+	return ret;
 }
 
-#ifdef ASYNC
+/*
+ * Where a walk over a list of requests stands. Requests move from todo
+ * to inflight when their first chunk is handed out, and on to done when
+ * their last chunk is back out.
+ */
+struct lpc3143_req_walk
+{
+	struct list_head todo;
+	struct list_head inflight;
+	struct list_head done;
+	struct ablkcipher_request *req;
+	struct scatterlist *src;
+	struct scatterlist *dst;
+	unsigned int src_off;
+	unsigned int dst_off;
+	unsigned int left;
+};
+
+static void lpc3143_walk_advance(struct scatterlist **sg, unsigned int *off,
+	unsigned int len)
+{
+	*off += len;
+	while (*sg && *off >= (*sg)->length)
+	{
+		*off -= (*sg)->length;
+		*sg = scatterwalk_sg_next(*sg);
+	}
+}
 
-static int lpc3143_aes_kthread(void *p)
+static int lpc3143_req_chunk(struct lpc3143_aes_job *job, int i,
+	struct lpc3143_aes_chunk *c)
 {
-	while (!kthread_should_stop())
+	struct lpc3143_req_walk *w = job->priv;
+	struct ablkcipher_request *req;
+	struct lpc3143_aes_instance *ctx;
+	unsigned int len;
+
+	c->iv = NULL;
+
+	if (!w->left)
 	{
-		struct crypto_async_request *async_req, *backlog;
-		int ret;
+		if (list_empty(&w->todo))
+			return 0;
+
+		req = list_first_entry(&w->todo, struct ablkcipher_request,
+			base.list);
+		list_move_tail(&req->base.list, &w->inflight);
+
+		w->req = req;
+		w->src = req->src;
+		w->dst = req->dst;
+		w->src_off = w->dst_off = 0;
+		w->left = req->nbytes;
+
+		memcpy(c->iv_buf, req->info, AES_BLOCK_SIZE);
+		c->iv = c->iv_buf;
+	}
 
-		if (!wait_event_timeout(aesreqq, aeshw.queue.qlen, HZ))
-			continue;
+	/* FIPS byte order blocks are reversed by the CPU copies */
+	ctx = crypto_tfm_ctx(w->req->base.tfm);
+	c->rev = ctx->fips;
+	if (c->iv && c->rev)
+		lpc3143_rev_block(c->iv_buf);
+
+	c->src_sg = w->src;
+	c->dst_sg = w->dst;
+	c->src_off = w->src_off;
+	c->dst_off = w->dst_off;
+
+	/*
+	 * Hand the DMA whole blocks that sit in one piece of each list;
+	 * anything straddling pieces or badly aligned goes through the CPU.
+	 */
+	len = min(w->left, (unsigned int)CHUNK);
+	len = min(len, w->src->length - w->src_off);
+	len = min(len, w->dst->length - w->dst_off);
+	len &= ~(AES_BLOCK_SIZE - 1);
+
+	c->cpu = aeshw.dma_ch < 0 || c->rev || !len || ((sg_phys(w->src) + w->src_off) & 3) ||
+		((sg_phys(w->dst) + w->dst_off) & 3);
+	if (c->cpu)
+		len = min(w->left, (unsigned int)CHUNK);
+
+	c->len = len;
+	w->left -= len;
+
+	lpc3143_walk_advance(&w->src, &w->src_off, len);
+	lpc3143_walk_advance(&w->dst, &w->dst_off, len);
+
+	/* the caller sees the last cipher block in info, as with cbc() */
+	c->req = w->left ? NULL : w->req;
+	c->iv_out = w->left ? NULL : w->req->info;
+
+	return 1;
+}
+
+static void lpc3143_req_put(struct lpc3143_aes_job *job,
+	struct lpc3143_aes_chunk *c)
+{
+	struct lpc3143_req_walk *w = job->priv;
+	struct ablkcipher_request *req = c->req;
+
+	if (req)
+		list_move_tail(&req->base.list, &w->done);
+}
+
+/*
+ * Decrypt a list of requests of the same tfm as one job, so the engine
+ * keeps the key and the pipeline stays primed across request
+ * boundaries. On return every request sits on one of the three lists
+ * of the walk, ready to be completed.
+ */
+static int lpc3143_aes_run_list(struct lpc3143_req_walk *w,
+	struct crypto_tfm *tfm)
+{
+	struct lpc3143_aes_job job =
+	{
+		.key		= ((struct lpc3143_aes_instance *)
+					crypto_tfm_ctx(tfm))->key,
+		.chain		= 1,
+		.get_chunk	= lpc3143_req_chunk,
+		.put_chunk	= lpc3143_req_put,
+		.priv		= w,
+	};
+
+	INIT_LIST_HEAD(&w->inflight);
+	INIT_LIST_HEAD(&w->done);
+	w->left = 0;
+
+	aeshw.batches++;
+
+	return lpc3143_aes_run(&job);
+}
+
+/* Checks shared by the synchronous and the queued paths */
+static int lpc3143_aes_check(struct ablkcipher_request *req)
+{
+	/* CBC has no notion of a partial block */
+	if (req->nbytes % AES_BLOCK_SIZE)
+	{
+		req->base.tfm->crt_flags |= CRYPTO_TFM_RES_BAD_BLOCK_LEN;
+		return -EINVAL;
+	}
+
+	return req->nbytes ? 1 : 0;
+}
+
+static int lpc3143_handle_req(struct ablkcipher_request *req)
+{
+	struct lpc3143_req_walk walk;
+	int ret;
+
+	ret = lpc3143_aes_check(req);
+	if (ret <= 0)
+		return ret;
+
+	aeshw.requests++;
+
+	INIT_LIST_HEAD(&walk.todo);
+	list_add(&req->base.list, &walk.todo);
+
+	return lpc3143_aes_run_list(&walk, req->base.tfm);
+}
 
+static void lpc3143_complete_list(struct list_head *list, int err)
+{
+	struct crypto_async_request *r, *n;
+
+	list_for_each_entry_safe(r, n, list, list)
+	{
+		list_del(&r->list);
+		r->complete(r, err);
+	}
+}
+
+static void lpc3143_aes_run_streams(void);
+
+/*
+ * Take the whole backlog at once and run it grouped by tfm, one job per
+ * group. Requests are completed outside aeshw_mtx, so a completion may
+ * submit more work, even synchronously.
+ */
+static void lpc3143_aes_batch(void)
+{
+	struct crypto_async_request *async_req, *backlog, *r, *n;
+	struct lpc3143_req_walk walk;
+	LIST_HEAD(batch);
+	int ret;
+
+	for (;;)
+	{
 		spin_lock_irq(&aeshw.qlock);
 		backlog = crypto_get_backlog(&aeshw.queue);
 		async_req = crypto_dequeue_request(&aeshw.queue);
@@ -197,34 +692,69 @@ static int lpc3143_aes_kthread(void *p)
 			backlog->complete(backlog, -EINPROGRESS);
 
 		if (!async_req)
-			continue;
+			break;
 
-		ret = lpc3143_handle_req((int)p, container_of(async_req,
-					struct ablkcipher_request, base));
+		list_add_tail(&async_req->list, &batch);
+	}
 
-		async_req->complete(async_req, ret);
+	while (!list_empty(&batch))
+	{
+		struct crypto_tfm *tfm =
+			list_first_entry(&batch, struct crypto_async_request,
+				list)->tfm;
+
+		INIT_LIST_HEAD(&walk.todo);
+		list_for_each_entry_safe(r, n, &batch, list)
+			if (r->tfm == tfm)
+				list_move_tail(&r->list, &walk.todo);
+
+		ret = lpc3143_aes_run_list(&walk, tfm);
+
+		lpc3143_complete_list(&walk.done, 0);
+		lpc3143_complete_list(&walk.inflight, ret);
+		lpc3143_complete_list(&walk.todo, ret);
 	}
-	return 0;
+
+	lpc3143_aes_run_streams();
 }
 
-#endif
+static int lpc3143_aes_kthread(void *p)
+{
+	while (!kthread_should_stop())
+	{
+		wait_event_interruptible(aesreqq, aeshw.queue.qlen ||
+			!list_empty(&aeshw.streams) || kthread_should_stop());
+
+		lpc3143_aes_batch();
+	}
+
+	return 0;
+}
 
 static int lpc3143_aes_decrypt(struct ablkcipher_request *req)
 {
-#ifdef ASYNC
 	unsigned long flags;
 	int ret;
 
+	if (!async)
+		return lpc3143_handle_req(req);
+
+	ret = lpc3143_aes_check(req);
+	if (ret <= 0)
+		return ret;
+
 	spin_lock_irqsave(&aeshw.qlock, flags);
 	ret = ablkcipher_enqueue_request(&aeshw.queue, req);
+	/* -EBUSY only queues it on the backlog if the caller allows that */
+	if (ret != -EBUSY || (req->base.flags & CRYPTO_TFM_REQ_MAY_BACKLOG))
+		aeshw.requests++;
+	if (aeshw.queue.qlen > aeshw.qlen_max)
+		aeshw.qlen_max = aeshw.queue.qlen;
 	spin_unlock_irqrestore(&aeshw.qlock, flags);
 
 	wake_up(&aesreqq);
 
 	return ret;
-#else
-	return lpc3143_handle_req(0, req);
-#endif
 }
 
 
@@ -234,144 +764,461 @@ static int lpc3143_aes_decrypt_blk(struct blkcipher_desc *desc,
 {
 	struct ablkcipher_request req;
 
-#ifdef ASYNC
+	req.src = src;
+	req.dst = dst;
+	req.nbytes = nbytes;
+	req.info = desc->info;
+	req.base.tfm = crypto_blkcipher_tfm(desc->tfm);
 
-#error "This must be reimplemented if we enable ASYNC!"
+	return lpc3143_handle_req(&req);
+}
 
-#else
 
+/* NAND controller clocks, shared with the NAND driver */
+static const char *lpc313x_nand_clk_names[] = {
+	"nandflash_s0_clk",
+	"nandflash_nand_clk",
+	"nandflash_pclk",
+	/* Needed for LPC3143/54 chips only */
+	"nandflash_aes_clk",
+};
+static struct clk *lpc313x_nand_clks[ARRAY_SIZE(lpc313x_nand_clk_names)];
 
-		req.src = src;
-		req.dst = dst;
-		req.nbytes = nbytes;
-		req.info = desc->info;
-		req.base.tfm=crypto_blkcipher_tfm(desc->tfm);
-		return lpc3143_handle_req(0, &req);
-#endif
+static int lpc313x_nand_clocks_get(struct device *dev)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nand_clk_names); i++) {
+		lpc313x_nand_clks[i] = clk_get(dev, lpc313x_nand_clk_names[i]);
+		if (IS_ERR(lpc313x_nand_clks[i])) {
+			while (--i >= 0)
+				clk_put(lpc313x_nand_clks[i]);
+			return -ENOENT;
+		}
+	}
 
+	return 0;
 }
 
+static void lpc313x_nand_clocks_put(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nand_clk_names); i++)
+		clk_put(lpc313x_nand_clks[i]);
+}
 
 /* Enable or disable NAND controller clocks */
 static void lpc313x_nand_clocks_disen(int en)
 {
-	/* Enable or disable clocks for NAND Controller */
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_S0_CLK_ID, en);
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_NAND_CLK_ID, en);
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_PCLK_ID, en);
+	int i;
 
-	/* Needed for LPC3143/54 chips only */
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_AES_CLK_ID, en);
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nand_clk_names); i++) {
+		if (en)
+			clk_enable(lpc313x_nand_clks[i]);
+		else
+			clk_disable(lpc313x_nand_clks[i]);
+	}
 }
 
-static int lpc3143_aes_encrypt_blk(struct blkcipher_desc *desc,
-			   struct scatterlist *dst, struct scatterlist *src,
-			   unsigned int nbytes)
+/*
+ * The engine only decrypts, so encryption runs on the CPU. Word aligned
+ * runs that are contiguous in both lists go to the assembly CBC loop in
+ * place; blocks straddling pages or entries are bounced one at a time.
+ * The loop loads and stores the IV as words, and the caller's IV may
+ * be anywhere, so it works on an aligned copy. FIPS byte order blocks
+ * all take the bounce path, to be reversed around the core.
+ */
+static int lpc3143_encrypt_sg(struct crypto_tfm *tfm, struct scatterlist *dst,
+	struct scatterlist *src, unsigned int nbytes, u8 *info)
 {
-	struct crypto_tfm *tfm = crypto_blkcipher_tfm(desc->tfm);
 	struct lpc3143_aes_instance *ctx = crypto_tfm_ctx(tfm);
+	unsigned int buf[4], iv[4];
+	struct scatter_walk in, out;
 
-	unsigned int *iv = desc->info;
-		unsigned int block[] = { iv[0], iv[1], iv[2], iv[3] };
-	int i;
-	if (nbytes != CHUNK)
+	if (nbytes % AES_BLOCK_SIZE)
 	{
-		printk(KERN_CRIT "lpc3143_aes: data size != chunk size!!\n");
-		return -EFAULT;
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_BLOCK_LEN;
+		return -EINVAL;
+	}
+
+	if (!nbytes)
+		return 0;
+
+	memcpy(iv, info, AES_BLOCK_SIZE);
+	if (ctx->fips)
+		lpc3143_rev_block(iv);
+
+	scatterwalk_start(&in, src);
+	scatterwalk_start(&out, dst);
+
+	while (nbytes)
+	{
+		unsigned int n = min(scatterwalk_clamp(&in, nbytes),
+			scatterwalk_clamp(&out, nbytes));
+
+		n &= ~(AES_BLOCK_SIZE - 1);
+
+		if (n && !ctx->fips && !((in.offset | out.offset) & 3))
+		{
+			u8 *s = scatterwalk_map(&in, 0);
+			u8 *d = scatterwalk_map(&out, 1);
+
+			lpc3143_aes_cbc_enc(ctx->round_key, iv, d, s,
+				n / AES_BLOCK_SIZE);
+
+			scatterwalk_unmap(d, 1);
+			scatterwalk_unmap(s, 0);
+
+			scatterwalk_advance(&in, n);
+			scatterwalk_advance(&out, n);
+		}
+		else
+		{
+			n = AES_BLOCK_SIZE;
+			scatterwalk_copychunks(buf, &in, n, 0);
+			if (ctx->fips)
+				lpc3143_rev_block(buf);
+			lpc3143_aes_cbc_enc(ctx->round_key, iv, buf, buf, 1);
+			if (ctx->fips)
+				lpc3143_rev_block(buf);
+			scatterwalk_copychunks(buf, &out, n, 1);
+		}
+
+		nbytes -= n;
+
+		scatterwalk_done(&in, 0, nbytes);
+		scatterwalk_done(&out, 1, nbytes);
 	}
 
-		for (i = 0; i < CHUNK; i += 16)
+	if (ctx->fips)
+		lpc3143_rev_block(iv);
+	memcpy(info, iv, AES_BLOCK_SIZE);
+
+	return 0;
+}
+
+/* The reference C path, block by block */
+static void lpc3143_cbc_enc_c(const unsigned int *rk, unsigned int *iv,
+	unsigned char *dst, const unsigned char *src, unsigned int nblocks)
+{
+	unsigned int block[] = { iv[0], iv[1], iv[2], iv[3] };
+
+	for (; nblocks; nblocks--, src += 16, dst += 16)
 	{
-		unsigned int *pbuf = (unsigned int*)((unsigned char*)sg_virt(src) + i);
+		const unsigned int *pbuf = (const unsigned int *)src;
 
 		block[0] ^= pbuf[0];
 		block[1] ^= pbuf[1];
 		block[2] ^= pbuf[2];
 		block[3] ^= pbuf[3];
 
-		encrypt_block(block, ctx->round_key);
+		encrypt_block(block, rk);
 
-		memcpy((unsigned char*)sg_virt(dst) + i, block, sizeof(block));
+		memcpy(dst, block, sizeof(block));
 	}
 
-	return 0;
+	memcpy(iv, block, sizeof(block));
 }
 
-static int lpc3143_aes_encrypt(struct ablkcipher_request *req)
+/*
+ * Check the assembly core against the C one, and with bench=1 time both
+ * in the way tcrypt does: as many operations as fit in a second, for a
+ * few buffer sizes.
+ */
+static int lpc3143_aes_selftest(void)
 {
-	unsigned int *iv = req->info;
-	unsigned int block[] = { iv[0], iv[1], iv[2], iv[3] };
-	int i;
+	static const unsigned int sizes[] = { 16, 64, 256, 1024, 8192 };
+	unsigned int key[4] = { 0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c };
+	unsigned int rk[44], iv_c[4] = { 0 }, iv_asm[4] = { 0 };
+	unsigned char *buf;
+	int i, ret = 0;
+
+	buf = kmalloc(2 * 8192, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	expand_key((unsigned char *)key, rk);
+
+	for (i = 0; i < 8192; i++)
+		buf[i] = i * 7;
 
-	if (req->nbytes != CHUNK)
+	lpc3143_cbc_enc_c(rk, iv_c, buf + 8192, buf, 64);
+	lpc3143_aes_cbc_enc(rk, iv_asm, buf, buf, 64);
+
+	if (memcmp(buf, buf + 8192, 1024) || memcmp(iv_c, iv_asm, 16))
 	{
-		printk(KERN_CRIT "lpc3143_aes: data size != chunk size!!\n");
-		return -EFAULT;
+		printk(KERN_CRIT "lpc3143_aes: assembly encryption self-test failed!\n");
+		ret = -EINVAL;
+		goto out;
 	}
 
-	for (i = 0; i < CHUNK; i += 16)
+	for (i = 0; bench && i < ARRAY_SIZE(sizes); i++)
 	{
-		unsigned int *pbuf = (unsigned int*)((unsigned char*)sg_virt(req->src) + i);
+		unsigned int n = sizes[i] / AES_BLOCK_SIZE;
+		unsigned long end;
+		int c_ops, asm_ops;
 
-		block[0] ^= pbuf[0];
-		block[1] ^= pbuf[1];
-		block[2] ^= pbuf[2];
-		block[3] ^= pbuf[3];
+		end = jiffies + HZ;
+		for (c_ops = 0; time_before(jiffies, end); c_ops++)
+			lpc3143_cbc_enc_c(rk, iv_c, buf + 8192, buf + 8192, n);
 
-		encrypt_block(block,
-			((struct lpc3143_aes_instance *)crypto_tfm_ctx(req->base.tfm))->round_key);
+		end = jiffies + HZ;
+		for (asm_ops = 0; time_before(jiffies, end); asm_ops++)
+			lpc3143_aes_cbc_enc(rk, iv_asm, buf, buf, n);
 
-		memcpy((unsigned char*)sg_virt(req->dst) + i, block, sizeof(block));
+		printk(KERN_INFO "lpc3143_aes: %u byte blocks: C %d ops (%d bytes), "
+			"asm %d ops (%d bytes) in 1 second\n", sizes[i],
+			c_ops, c_ops * sizes[i], asm_ops, asm_ops * sizes[i]);
+	}
+
+out:
+	kfree(buf);
+
+	return ret;
+}
+
+static int lpc3143_aes_encrypt_blk(struct blkcipher_desc *desc,
+			   struct scatterlist *dst, struct scatterlist *src,
+			   unsigned int nbytes)
+{
+	return lpc3143_encrypt_sg(crypto_blkcipher_tfm(desc->tfm), dst, src,
+		nbytes, desc->info);
+}
+
+static int lpc3143_aes_encrypt(struct ablkcipher_request *req)
+{
+	return lpc3143_encrypt_sg(req->base.tfm, req->dst, req->src,
+		req->nbytes, req->info);
+}
+
+/*
+ * "cbc(aes)" for dm-crypt, IPsec and the like: AES-128 keys on the
+ * engine in FIPS byte order, the other sizes on the software cbc(aes).
+ */
+static int lpc3143_aes_encrypt_fips(struct ablkcipher_request *req)
+{
+	struct lpc3143_aes_instance *ctx = crypto_tfm_ctx(req->base.tfm);
+	struct blkcipher_desc desc;
+
+	if (ctx->keylen == AES_KEYSIZE_128)
+		return lpc3143_aes_encrypt(req);
+
+	desc.tfm = ctx->fallback;
+	desc.info = req->info;
+	desc.flags = req->base.flags;
+
+	return crypto_blkcipher_encrypt_iv(&desc, req->dst, req->src,
+		req->nbytes);
+}
+
+static int lpc3143_aes_decrypt_fips(struct ablkcipher_request *req)
+{
+	struct lpc3143_aes_instance *ctx = crypto_tfm_ctx(req->base.tfm);
+	struct blkcipher_desc desc;
+
+	if (ctx->keylen == AES_KEYSIZE_128)
+		return lpc3143_aes_decrypt(req);
+
+	desc.tfm = ctx->fallback;
+	desc.info = req->info;
+	desc.flags = req->base.flags;
+
+	return crypto_blkcipher_decrypt_iv(&desc, req->dst, req->src,
+		req->nbytes);
+}
+
+static int lpc3143_aes_init_fips(struct crypto_tfm *tfm)
+{
+	struct lpc3143_aes_instance *ctx = crypto_tfm_ctx(tfm);
+
+	ctx->fips = 1;
+	ctx->fallback = crypto_alloc_blkcipher(tfm->__crt_alg->cra_name, 0,
+		CRYPTO_ALG_ASYNC | CRYPTO_ALG_NEED_FALLBACK);
+	if (IS_ERR(ctx->fallback))
+	{
+		printk(KERN_ERR "lpc3143_aes: no fallback for %s\n",
+			tfm->__crt_alg->cra_name);
+		return PTR_ERR(ctx->fallback);
 	}
 
 	return 0;
 }
 
-int lpc3143_aes_decrypt_elf(unsigned char *base, unsigned int phys, int size, unsigned char *key)
+static void lpc3143_aes_exit_fips(struct crypto_tfm *tfm)
 {
-	unsigned int *k = (unsigned int*)key;
-	unsigned int *iv = (unsigned int*)&base[0x80];
-	int i;
+	struct lpc3143_aes_instance *ctx = crypto_tfm_ctx(tfm);
 
-	mutex_lock(&aeshw_mtx);
+	crypto_free_blkcipher(ctx->fallback);
+	ctx->fallback = NULL;
+}
 
-	writel(k[0], &aeshw.regs[KEY+0]);
-	writel(k[1], &aeshw.regs[KEY+1]);
-	writel(k[2], &aeshw.regs[KEY+2]);
-	writel(k[3], &aeshw.regs[KEY+3]);
+static int lpc3143_stream_chunk(struct lpc3143_aes_job *job, int i,
+	struct lpc3143_aes_chunk *c)
+{
+	struct lpc3143_aes_stream *st = job->priv;
+
+	if (i >= st->len / CHUNK)
+		return 0;
 
-	writel(iv[0], &aeshw.regs[IV+0]);
-	writel(iv[1], &aeshw.regs[IV+1]);
-	writel(iv[2], &aeshw.regs[IV+2]);
-	writel(iv[3], &aeshw.regs[IV+3]);
+	c->src = c->dst = st->phys + CHUNK * i;
+	c->src_sg = c->dst_sg = NULL;
+	c->rev = 0;
+	c->len = CHUNK;
+	c->iv = i ? NULL : st->iv;
+	c->iv_out = NULL;
+	c->req = NULL;
 
-	for (i = 1; i < size/CHUNK; i++)
+	return 1;
+}
+
+/*
+ * Decrypt one piece of a stream. Within the piece the engine carries
+ * its IV from chunk to chunk as it always did for whole images; the IV
+ * it ends with is saved so the next piece resumes exactly there, even
+ * if other users had the engine in between.
+ */
+static int lpc3143_aes_stream_run(struct lpc3143_aes_stream *st)
+{
+	struct lpc3143_aes_job job =
 	{
-		long l;
+		.key		= st->key,
+		.iv_save	= st->iv,
+		.get_chunk	= lpc3143_stream_chunk,
+		.priv		= st,
+	};
 
-		lpc3143_dmacpy(aeshw.phys_sram[0], phys + CHUNK*i, CHUNK);
+	return lpc3143_aes_run(&job);
+}
 
-		writel(NAND_AES_AHB_EN | NAND_AES_AHB_DCRYPT_RAM0,
-			&aeshw.regs[AES_FROM_AHB]);
+/* Finish a piece started by lpc3143_aes_stream_start() */
+static void lpc3143_aes_stream_end(struct lpc3143_aes_stream *st)
+{
+	if (st->buf)
+		dma_unmap_single(aeshw.dev, st->phys, st->len,
+			DMA_BIDIRECTIONAL);
 
-		for (l = 50; l && !try_wait_for_completion(&aescomplete); --l);
-		INIT_COMPLETION(aescomplete);
+	complete(&st->done);
+}
 
-		if (!l)
+/* Called by the worker once the cipher requests are done */
+static void lpc3143_aes_run_streams(void)
+{
+	struct lpc3143_aes_stream *st;
+
+	for (;;)
+	{
+		spin_lock_irq(&aeshw.qlock);
+		if (list_empty(&aeshw.streams))
+			st = NULL;
+		else
 		{
-			// timed out
-			printk(KERN_CRIT "lpc3143_aes: IRQ never arrived!\n");
-			mutex_unlock(&aeshw_mtx);
-			return -EFAULT;
+			st = list_first_entry(&aeshw.streams,
+				struct lpc3143_aes_stream, list);
+			list_del(&st->list);
 		}
+		spin_unlock_irq(&aeshw.qlock);
+
+		if (!st)
+			break;
 
-		lpc3143_dmacpy(phys + CHUNK*i, aeshw.phys_sram[0], CHUNK);
+		st->ret = lpc3143_aes_stream_run(st);
+		lpc3143_aes_stream_end(st);
 	}
+}
 
-	mutex_unlock(&aeshw_mtx);
+void lpc3143_aes_stream_init(struct lpc3143_aes_stream *st,
+	const unsigned char *header, const unsigned char *key)
+{
+	memcpy(st->key, key, sizeof(st->key));
+	memcpy(st->iv, &header[0x80], sizeof(st->iv));
+	init_completion(&st->done);
+	st->buf = NULL;
+	st->len = 0;
+	st->ret = 0;
+}
+EXPORT_SYMBOL_GPL(lpc3143_aes_stream_init);
+
+/*
+ * Resume a stream at any chunk of an image encrypted as one CBC stream,
+ * from the cipher text block just before it as read from flash. This
+ * is what a loader decrypting pages as they fault in needs.
+ */
+void lpc3143_aes_stream_seek(struct lpc3143_aes_stream *st,
+	const unsigned char *prev_block)
+{
+	memcpy(st->iv, prev_block, sizeof(st->iv));
+}
+EXPORT_SYMBOL_GPL(lpc3143_aes_stream_seek);
+
+/*
+ * Start decrypting the next piece of a stream in place. buf must be
+ * lowmem, and the caller leaves it alone until lpc3143_aes_stream_wait().
+ * Without the worker thread the piece is done before this returns.
+ */
+int lpc3143_aes_stream_start(struct lpc3143_aes_stream *st, void *buf,
+	int len)
+{
+	if (!probed)
+		return -ENODEV;
+
+	if (len <= 0 || len % CHUNK)
+		return -EINVAL;
+
+	st->phys = dma_map_single(aeshw.dev, buf, len, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(aeshw.dev, st->phys))
+		return -ENOMEM;
+
+	INIT_COMPLETION(st->done);
+	st->buf = buf;
+	st->len = len;
+
+	if (!aeshw.worker)
+	{
+		st->ret = lpc3143_aes_stream_run(st);
+		lpc3143_aes_stream_end(st);
+		return 0;
+	}
+
+	spin_lock_irq(&aeshw.qlock);
+	list_add_tail(&st->list, &aeshw.streams);
+	spin_unlock_irq(&aeshw.qlock);
+
+	wake_up(&aesreqq);
 
 	return 0;
 }
+EXPORT_SYMBOL_GPL(lpc3143_aes_stream_start);
+
+int lpc3143_aes_stream_wait(struct lpc3143_aes_stream *st)
+{
+	wait_for_completion(&st->done);
+
+	return st->ret;
+}
+EXPORT_SYMBOL_GPL(lpc3143_aes_stream_wait);
+
+/*
+ * Decrypt a whole image in place. As before, phys is used as is and the
+ * caller takes care of the cache.
+ */
+int lpc3143_aes_decrypt_elf(unsigned char *base, unsigned int phys, int size, unsigned char *key)
+{
+	struct lpc3143_aes_stream st;
+
+	if (!probed)
+		return -ENODEV;
+
+	if (size / CHUNK <= 1)
+		return 0;
+
+	lpc3143_aes_stream_init(&st, base, key);
+	st.phys = phys + CHUNK;
+	st.len = (size / CHUNK - 1) * CHUNK;
+
+	return lpc3143_aes_stream_run(&st);
+}
+EXPORT_SYMBOL_GPL(lpc3143_aes_decrypt_elf);
 
 static struct crypto_alg lpc3143_async_aes_alg_cbc = {
 	.cra_name		= "cbc(nxpaes)",
@@ -417,8 +1264,121 @@ static struct crypto_alg lpc3143_aes_alg_cbc = {
 	},
 };
 
+static struct crypto_alg lpc3143_fips_aes_alg_cbc = {
+	.cra_name		= "cbc(aes)",
+	.cra_driver_name	= "cbc-aes-lpc3143",
+	.cra_priority	= 300,
+	.cra_flags	= CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC |
+			  CRYPTO_ALG_NEED_FALLBACK,
+	.cra_init	= lpc3143_aes_init_fips,
+	.cra_exit	= lpc3143_aes_exit_fips,
+	.cra_blocksize	= AES_BLOCK_SIZE,
+	.cra_alignmask	= 0,
+	.cra_type	= &crypto_ablkcipher_type,
+	.cra_module	= THIS_MODULE,
+	.cra_ctxsize	= sizeof(struct lpc3143_aes_instance),
+	.cra_u		= {
+		.ablkcipher = {
+			.ivsize		= AES_BLOCK_SIZE,
+			.min_keysize	= AES_KEYSIZE_128,
+			.max_keysize	= AES_KEYSIZE_256,
+			.setkey		= lpc3143_aes_setkey_fips,
+			.encrypt	= lpc3143_aes_encrypt_fips,
+			.decrypt	= lpc3143_aes_decrypt_fips,
+		},
+	},
+};
+
 
 
+#if defined (CONFIG_DEBUG_FS)
+/*
+ * Show the queue and engine statistics. The utilisation is the share of
+ * wall time the engine was running jobs since the counters were reset.
+ */
+static int lpc3143_aes_stats_show(struct seq_file *s, void *v)
+{
+	struct lpc3143_aes_priv *p = s->private;
+	u64 wall = ktime_to_ns(ktime_sub(ktime_get(), p->since)) >> 20;
+	u64 util = (p->busy_ns >> 20) * 1000;
+	unsigned long qlen;
+
+	spin_lock_irq(&p->qlock);
+	qlen = p->queue.qlen;
+	spin_unlock_irq(&p->qlock);
+
+	/* in units of ~1ms, per mille */
+	if (wall)
+		do_div(util, (u32)wall);
+	else
+		util = 0;
+
+	seq_printf(s, "mode: %s\n", async ? "async" : "sync");
+	seq_printf(s, "queue: %lu max: %u limit: %d\n", qlen, p->qlen_max,
+		QUEUE_LEN);
+	seq_printf(s, "requests: %lu batches: %lu chunks: %lu bytes: %llu\n",
+		p->requests, p->batches, p->chunks,
+		(unsigned long long)p->bytes);
+	seq_printf(s, "key loads: %lu skipped: %lu\n", p->key_loads,
+		p->key_skips);
+	seq_printf(s, "busy: %llu ms utilisation: %llu/1000\n",
+		(unsigned long long)(p->busy_ns >> 20),
+		(unsigned long long)util);
+
+	return 0;
+}
+
+static int lpc3143_aes_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lpc3143_aes_stats_show, inode->i_private);
+}
+
+/*
+ * Any write clears the counters
+ */
+static ssize_t lpc3143_aes_stats_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct lpc3143_aes_priv *p = s->private;
+
+	mutex_lock(&aeshw_mtx);
+	p->requests = p->batches = p->chunks = 0;
+	p->key_loads = p->key_skips = 0;
+	p->qlen_max = 0;
+	p->bytes = p->busy_ns = 0;
+	p->since = ktime_get();
+	mutex_unlock(&aeshw_mtx);
+
+	return count;
+}
+
+static const struct file_operations lpc3143_aes_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lpc3143_aes_stats_open,
+	.read		= seq_read,
+	.write		= lpc3143_aes_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void lpc3143_aes_init_debugfs(struct lpc3143_aes_priv *p)
+{
+	struct dentry *node;
+
+	p->debugfs_root = debugfs_create_dir("lpc3143_aes", NULL);
+	if (IS_ERR(p->debugfs_root) || !p->debugfs_root) {
+		p->debugfs_root = NULL;
+		return;
+	}
+
+	node = debugfs_create_file("stats", S_IRUSR | S_IWUSR,
+		p->debugfs_root, p, &lpc3143_aes_stats_fops);
+	if (!node)
+		dev_err(p->dev, "failed to initialize debugfs\n");
+}
+#endif
+
 static int lpc3143_aes_probe(struct platform_device *pdev)
 {
 	struct lpc3143_aes_priv *p = &aeshw;
@@ -426,8 +1386,6 @@ static int lpc3143_aes_probe(struct platform_device *pdev)
 	int irq;
 	int ret;
 
-	static int probed;
-
 	if (probed)
 		return -EEXIST;
 
@@ -441,19 +1399,44 @@ static int lpc3143_aes_probe(struct platform_device *pdev)
 	p->phys_sram[0] = res->start;
 	p->phys_sram[1] = res->start + 0x400;
 
+	p->sram = ioremap(res->start, 0x800);
+	if (!p->sram)
+		return -ENOMEM;
+
+	p->bounce = kmalloc(CHUNK, GFP_KERNEL);
+	if (!p->bounce)
+	{
+		ret = -ENOMEM;
+		goto err_unmap_sram;
+	}
+
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!res)
-		return -ENXIO;
+	{
+		ret = -ENXIO;
+		goto err_free_bounce;
+	}
 
 	p->regs = ioremap(res->start, res->end - res->start + 1);
 	if (!p->regs)
-		return -ENOMEM;
+	{
+		ret = -ENOMEM;
+		goto err_free_bounce;
+	}
+
+	p->dev = &pdev->dev;
+
+	/* Enable clocks for NAND Controller, the self test needs them */
+	ret = lpc313x_nand_clocks_get(&pdev->dev);
+	if (ret)
+		goto err_unmap_regs;
+	lpc313x_nand_clocks_disen(1);
 
 	irq = platform_get_irq(pdev, 0);
 	if (irq < 0 || irq == NO_IRQ) {
 		ret = irq;
 		printk(KERN_CRIT "lpc3143_aes_probe: no IRQ?!\n");
-		goto err_unmap_regs;
+		goto err_clocks;
 	}
 	p->irq = irq;
 
@@ -463,31 +1446,44 @@ static int lpc3143_aes_probe(struct platform_device *pdev)
 		dev_name(&pdev->dev), p);
 
 	if (ret)
-		goto err_unmap_regs;
+		goto err_clocks;
 
-#ifdef ASYNC
-	p->workers[0] = kthread_run(lpc3143_aes_kthread, (void*)0, "kaeshw-0");
-	if (IS_ERR(p->workers[0])) {
-		ret = PTR_ERR(p->workers[0]);
-		goto err_thread;
+	spin_lock_init(&p->qlock);
+	crypto_init_queue(&p->queue, QUEUE_LEN);
+	INIT_LIST_HEAD(&p->streams);
+	p->since = ktime_get();
+
+	/*
+	 * One worker is enough: it feeds both SRAM banks itself and takes
+	 * the whole backlog on each wakeup.
+	 */
+	if (async)
+	{
+		p->worker = kthread_run(lpc3143_aes_kthread, NULL, "kaeshw");
+		if (IS_ERR(p->worker)) {
+			ret = PTR_ERR(p->worker);
+			goto err_thread;
+		}
+		printk(KERN_INFO "lpc3143_aes: asynchronous mode, queue of %d\n",
+			QUEUE_LEN);
 	}
 
-	p->workers[1] = kthread_run(lpc3143_aes_kthread, (void*)1, "kaeshw-1");
-	if (IS_ERR(p->workers[0])) {
-		ret = PTR_ERR(p->workers[0]);
+	ret = lpc3143_aes_selftest();
+	if (ret)
 		goto err_thread2;
-	}
-	printk(KERN_CRIT "lpc3143_aes: asynchronous mode, using 2 worker threads\n");
-#endif
 
+	/*
+	 * Channel 10 is only a habit, any channel does memory to memory.
+	 * With none left the CPU does the copies, see dma.c for the budget.
+	 */
 	p->dma_ch = dma_request_specific_channel(10,"lpc3143_aes", lpc3143_aes_dma_irq, 0);
 	if (p->dma_ch < 0)
-	{
-		dev_err(&pdev->dev, "error getting DMA channel.\n");
-		ret = -ENXIO;
-		goto err_thread2;
-	}
-	printk(KERN_CRIT "lpc3143_aes: using DMA channel %d\n", p->dma_ch);
+		p->dma_ch = dma_request_channel("lpc3143_aes",
+			lpc3143_aes_dma_irq, 0);
+	if (p->dma_ch < 0)
+		dev_warn(&pdev->dev, "no DMA channel left, copying with the CPU\n");
+	else
+		printk(KERN_CRIT "lpc3143_aes: using DMA channel %d\n", p->dma_ch);
 
 	// async version for dm-crypt
 	crypto_register_alg(&lpc3143_async_aes_alg_cbc);
@@ -495,9 +1491,6 @@ static int lpc3143_aes_probe(struct platform_device *pdev)
 	// sync version for cryptoloop
 	crypto_register_alg(&lpc3143_aes_alg_cbc);
 
-	/* Enable clocks for NAND Controller */
-	lpc313x_nand_clocks_disen(1);
-
 	/* Reset NAND controller */
 	cgu_soft_reset_module(NANDFLASH_CTRL_NAND_RESET_N_SOFT);
 	cgu_soft_reset_module(NANDFLASH_CTRL_AES_RESET_N_SOFT);
@@ -509,9 +1502,12 @@ static int lpc3143_aes_probe(struct platform_device *pdev)
 	writel(~(NAND_NANDIRQSTATUS1_AES_DONE_RAM0|NAND_NANDIRQSTATUS1_AES_DONE_RAM1),
 		&p->regs[NandIRQMask1]);
 
-#ifdef ASYNC
-	spin_lock_init(&p->qlock);
-	crypto_init_queue(&p->queue, 50);
+	/* standard byte order cbc(aes), checked by testmgr as it registers
+	   so the engine has to be up by now */
+	crypto_register_alg(&lpc3143_fips_aes_alg_cbc);
+
+#if defined (CONFIG_DEBUG_FS)
+	lpc3143_aes_init_debugfs(p);
 #endif
 
 	printk(KERN_WARNING "lpc3143_aes: set up and ready to go\n");
@@ -521,14 +1517,20 @@ static int lpc3143_aes_probe(struct platform_device *pdev)
 	return 0;
 
 err_thread2:
-#ifdef ASYNC
-	kthread_stop(aeshw.workers[1]);
-	kthread_stop(aeshw.workers[0]);
+	if (p->worker)
+		kthread_stop(p->worker);
+	p->worker = NULL;
 err_thread:
-#endif
 	free_irq(irq, p);
+err_clocks:
+	lpc313x_nand_clocks_disen(0);
+	lpc313x_nand_clocks_put();
 err_unmap_regs:
 	iounmap(p->regs);
+err_free_bounce:
+	kfree(p->bounce);
+err_unmap_sram:
+	iounmap(p->sram);
 
 	return ret;
 }
@@ -537,27 +1539,59 @@ static int lpc3143_aes_remove(struct platform_device *pdev)
 {
 	struct lpc3143_aes_priv *p = platform_get_drvdata(pdev);
 
+	probed = 0;
+
 	writel(0, p->regs[AES_FROM_AHB]);
 
+	crypto_unregister_alg(&lpc3143_fips_aes_alg_cbc);
 	crypto_unregister_alg(&lpc3143_aes_alg_cbc);
+	crypto_unregister_alg(&lpc3143_async_aes_alg_cbc);
+
+	if (p->worker)
+		kthread_stop(p->worker);
 
-#ifdef ASYNC
-	kthread_stop(aeshw.workers[1]);
-	kthread_stop(aeshw.workers[0]);
+#if defined (CONFIG_DEBUG_FS)
+	debugfs_remove_recursive(p->debugfs_root);
 #endif
+	if (p->dma_ch >= 0)
+		dma_release_channel(p->dma_ch);
 	free_irq(p->irq, p);
 	iounmap(p->regs);
-	kfree(p);
+	kfree(p->bounce);
+	iounmap(p->sram);
 
-        /* Disable clocks for NAND Controller */
-        lpc313x_nand_clocks_disen(0);
+	/* Disable clocks for NAND Controller */
+	lpc313x_nand_clocks_disen(0);
+	lpc313x_nand_clocks_put();
 
 	return 0;
 }
 
+#ifdef CONFIG_PM
+/*
+ * The NAND driver resets the block on resume, so the cached key is gone
+ */
+static int lpc3143_aes_resume(struct platform_device *pdev)
+{
+	struct lpc3143_aes_priv *p = platform_get_drvdata(pdev);
+
+	mutex_lock(&aeshw_mtx);
+	p->key_loaded = 0;
+	writel(NAND_AES_AHB_EN, &p->regs[AES_FROM_AHB]);
+	writel(~(NAND_NANDIRQSTATUS1_AES_DONE_RAM0|NAND_NANDIRQSTATUS1_AES_DONE_RAM1),
+		&p->regs[NandIRQMask1]);
+	mutex_unlock(&aeshw_mtx);
+
+	return 0;
+}
+#else
+#define lpc3143_aes_resume	NULL
+#endif
+
 static struct platform_driver lpc3143_aes = {
 	.probe		= lpc3143_aes_probe,
 	.remove		= lpc3143_aes_remove,
+	.resume		= lpc3143_aes_resume,
 	.driver		= {
 		.owner	= THIS_MODULE,
 		.name	= "lpc3143_aes",
@@ -624,7 +1658,8 @@ static unsigned int const sbox[] = {
 	0x41414141,0x99999999,0x2D2D2D2D,0x0F0F0F0F,0xB0B0B0B0,0x54545454,0xBBBBBBBB,0x16161616,
 };
 
-static unsigned int const table[][256] = {{
+/* also used by lpc3143_aes_asm.S */
+unsigned int const lpc3143_aes_table[][256] = {{
 	0xC66363A5,0xF87C7C84,0xEE777799,0xF67B7B8D,0xFFF2F20D,0xD66B6BBD,0xDE6F6FB1,0x91C5C554,
 	0x60303050,0x02010103,0xCE6767A9,0x562B2B7D,0xE7FEFE19,0xB5D7D762,0x4DABABE6,0xEC76769A,
 	0x8FCACA45,0x1F82829D,0x89C9C940,0xFA7D7D87,0xEFFAFA15,0xB25959EB,0x8E4747C9,0xFBF0F00B,
@@ -793,80 +1828,80 @@ static void encrypt_block(unsigned int block[], unsigned int const rk[])
 	x[3] = rk[3] ^ block[0];
 
 	x[4] = rk[4]
-		^ table[0][BYTE3(x[0])]
-		^ table[1][BYTE2(x[1])]
-		^ table[2][BYTE1(x[2])]
-		^ table[3][BYTE0(x[3])];
+		^ lpc3143_aes_table[0][BYTE3(x[0])]
+		^ lpc3143_aes_table[1][BYTE2(x[1])]
+		^ lpc3143_aes_table[2][BYTE1(x[2])]
+		^ lpc3143_aes_table[3][BYTE0(x[3])];
 
 	x[5] = rk[5]
-		^ table[0][BYTE3(x[1])]
-		^ table[1][BYTE2(x[2])]
-		^ table[2][BYTE1(x[3])]
-		^ table[3][BYTE0(x[0])];
+		^ lpc3143_aes_table[0][BYTE3(x[1])]
+		^ lpc3143_aes_table[1][BYTE2(x[2])]
+		^ lpc3143_aes_table[2][BYTE1(x[3])]
+		^ lpc3143_aes_table[3][BYTE0(x[0])];
 
 	x[6] = rk[6]
-		^ table[0][BYTE3(x[2])]
-		^ table[1][BYTE2(x[3])]
-		^ table[2][BYTE1(x[0])]
-		^ table[3][BYTE0(x[1])];
+		^ lpc3143_aes_table[0][BYTE3(x[2])]
+		^ lpc3143_aes_table[1][BYTE2(x[3])]
+		^ lpc3143_aes_table[2][BYTE1(x[0])]
+		^ lpc3143_aes_table[3][BYTE0(x[1])];
 
 	x[7] = rk[7]
-		^ table[0][BYTE3(x[3])]
-		^ table[1][BYTE2(x[0])]
-		^ table[2][BYTE1(x[1])]
-		^ table[3][BYTE0(x[2])];
+		^ lpc3143_aes_table[0][BYTE3(x[3])]
+		^ lpc3143_aes_table[1][BYTE2(x[0])]
+		^ lpc3143_aes_table[2][BYTE1(x[1])]
+		^ lpc3143_aes_table[3][BYTE0(x[2])];
 
 	rk += 8;
 
 	for (i = 0; i < 4; i++)
 	{
 		x[0] = rk[0]
-			^ table[0][BYTE3(x[4])]
-			^ table[1][BYTE2(x[5])]
-			^ table[2][BYTE1(x[6])]
-			^ table[3][BYTE0(x[7])];
+			^ lpc3143_aes_table[0][BYTE3(x[4])]
+			^ lpc3143_aes_table[1][BYTE2(x[5])]
+			^ lpc3143_aes_table[2][BYTE1(x[6])]
+			^ lpc3143_aes_table[3][BYTE0(x[7])];
 
 		x[1] = rk[1]
-			^ table[0][BYTE3(x[5])]
-			^ table[1][BYTE2(x[6])]
-			^ table[2][BYTE1(x[7])]
-			^ table[3][BYTE0(x[4])];
+			^ lpc3143_aes_table[0][BYTE3(x[5])]
+			^ lpc3143_aes_table[1][BYTE2(x[6])]
+			^ lpc3143_aes_table[2][BYTE1(x[7])]
+			^ lpc3143_aes_table[3][BYTE0(x[4])];
 
 		x[2] = rk[2]
-			^ table[0][BYTE3(x[6])]
-			^ table[1][BYTE2(x[7])]
-			^ table[2][BYTE1(x[4])]
-			^ table[3][BYTE0(x[5])];
+			^ lpc3143_aes_table[0][BYTE3(x[6])]
+			^ lpc3143_aes_table[1][BYTE2(x[7])]
+			^ lpc3143_aes_table[2][BYTE1(x[4])]
+			^ lpc3143_aes_table[3][BYTE0(x[5])];
 
 		x[3] = rk[3]
-			^ table[0][BYTE3(x[7])]
-			^ table[1][BYTE2(x[4])]
-			^ table[2][BYTE1(x[5])]
-			^ table[3][BYTE0(x[6])];
+			^ lpc3143_aes_table[0][BYTE3(x[7])]
+			^ lpc3143_aes_table[1][BYTE2(x[4])]
+			^ lpc3143_aes_table[2][BYTE1(x[5])]
+			^ lpc3143_aes_table[3][BYTE0(x[6])];
 
 		x[4] = rk[4]
-			^ table[0][BYTE3(x[0])]
-			^ table[1][BYTE2(x[1])]
-			^ table[2][BYTE1(x[2])]
-			^ table[3][BYTE0(x[3])];
+			^ lpc3143_aes_table[0][BYTE3(x[0])]
+			^ lpc3143_aes_table[1][BYTE2(x[1])]
+			^ lpc3143_aes_table[2][BYTE1(x[2])]
+			^ lpc3143_aes_table[3][BYTE0(x[3])];
 
 		x[5] = rk[5]
-			^ table[0][BYTE3(x[1])]
-			^ table[1][BYTE2(x[2])]
-			^ table[2][BYTE1(x[3])]
-			^ table[3][BYTE0(x[0])];
+			^ lpc3143_aes_table[0][BYTE3(x[1])]
+			^ lpc3143_aes_table[1][BYTE2(x[2])]
+			^ lpc3143_aes_table[2][BYTE1(x[3])]
+			^ lpc3143_aes_table[3][BYTE0(x[0])];
 
 		x[6] = rk[6]
-			^ table[0][BYTE3(x[2])]
-			^ table[1][BYTE2(x[3])]
-			^ table[2][BYTE1(x[0])]
-			^ table[3][BYTE0(x[1])];
+			^ lpc3143_aes_table[0][BYTE3(x[2])]
+			^ lpc3143_aes_table[1][BYTE2(x[3])]
+			^ lpc3143_aes_table[2][BYTE1(x[0])]
+			^ lpc3143_aes_table[3][BYTE0(x[1])];
 
 		x[7] = rk[7]
-			^ table[0][BYTE3(x[3])]
-			^ table[1][BYTE2(x[0])]
-			^ table[2][BYTE1(x[1])]
-			^ table[3][BYTE0(x[2])];
+			^ lpc3143_aes_table[0][BYTE3(x[3])]
+			^ lpc3143_aes_table[1][BYTE2(x[0])]
+			^ lpc3143_aes_table[2][BYTE1(x[1])]
+			^ lpc3143_aes_table[3][BYTE0(x[2])];
 
 		rk += 8;
 	}
@@ -0,0 +1,733 @@
+/*
+ * dmaengine driver for the DMA controller of the NXP LPC313x/LPC315x
+ *
+ * The controller has twelve single-transfer channels which are handed
+ * out by the allocator in arch/arm/mach-lpc313x/dma.c. This driver sits
+ * on top of that allocator so that the in-tree users of the <mach/dma.h>
+ * API and dmaengine clients (async_tx, dmatest, slave drivers) can share
+ * the hardware. The 2.6.28 core allocates resources on every channel
+ * for every client, including clients that go on to refuse the channel,
+ * so a hardware channel is only claimed once a descriptor is prepared
+ * on the dma_chan, and given back when its last client lets go.
+ *
+ * A channel moves at most DMA_MAX_TRANSFERS + 1 units per programming,
+ * so a descriptor is a chain of such segments. The next segment is
+ * programmed straight from the controller interrupt; only the client
+ * callbacks are deferred to the tasklet.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+
+#include <mach/hardware.h>
+#include <mach/dma.h>
+#include <mach/dmac.h>
+
+/* Number of descriptors to allocate for each channel */
+#define NR_DESCS_PER_CHANNEL	64
+
+/* Largest unit count of one channel programming */
+#define LPC313X_MAX_UNITS	(DMA_MAX_TRANSFERS + 1)
+
+/* One channel programming; the first one of a chain carries the txd */
+struct lpc313x_desc {
+	dma_setup_t			setup;
+	struct list_head		desc_node;
+	struct dma_async_tx_descriptor	txd;
+	dma_addr_t			src;
+	dma_addr_t			dst;
+	size_t				len;
+	unsigned int			slave:1;
+};
+
+struct lpc313x_dma_chan {
+	struct dma_chan		chan;
+	spinlock_t		lock;
+	int			hw;	/* mach channel, -1 when not claimed */
+	dma_cookie_t		completed;
+
+	struct lpc313x_desc	*cur;	/* segment in the hardware */
+	struct list_head	active_list;
+	struct list_head	queue;
+	struct list_head	done_list;
+	struct list_head	free_list;
+	unsigned int		descs_allocated;
+
+	struct lpc313x_dma_slave *lds;
+	struct tasklet_struct	tasklet;
+};
+
+struct lpc313x_dma {
+	struct dma_device	dma;
+	struct lpc313x_dma_chan	chan[0];
+};
+
+static inline struct lpc313x_dma_chan *to_lpc313x_dma_chan(struct dma_chan *chan)
+{
+	return container_of(chan, struct lpc313x_dma_chan, chan);
+}
+
+static inline struct lpc313x_desc *txd_to_lpc313x_desc(struct dma_async_tx_descriptor *txd)
+{
+	return container_of(txd, struct lpc313x_desc, txd);
+}
+
+/*----------------------------------------------------------------------*/
+
+static struct lpc313x_desc *ldc_first_active(struct lpc313x_dma_chan *ldc)
+{
+	return list_entry(ldc->active_list.next, struct lpc313x_desc, desc_node);
+}
+
+static struct lpc313x_desc *ldc_first_queued(struct lpc313x_dma_chan *ldc)
+{
+	return list_entry(ldc->queue.next, struct lpc313x_desc, desc_node);
+}
+
+static struct lpc313x_desc *ldc_desc_get(struct lpc313x_dma_chan *ldc)
+{
+	struct lpc313x_desc *desc, *_desc;
+	struct lpc313x_desc *ret = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ldc->lock, flags);
+	list_for_each_entry_safe(desc, _desc, &ldc->free_list, desc_node) {
+		if (async_tx_test_ack(&desc->txd)) {
+			list_del(&desc->desc_node);
+			ret = desc;
+			break;
+		}
+		dev_dbg(&ldc->chan.dev, "desc %p not ACKed\n", desc);
+	}
+	spin_unlock_irqrestore(&ldc->lock, flags);
+
+	return ret;
+}
+
+/* Move a descriptor, including any children, to the free list */
+static void ldc_desc_put(struct lpc313x_dma_chan *ldc, struct lpc313x_desc *desc)
+{
+	unsigned long flags;
+
+	if (desc) {
+		spin_lock_irqsave(&ldc->lock, flags);
+		list_splice_init(&desc->txd.tx_list, &ldc->free_list);
+		list_add(&desc->desc_node, &ldc->free_list);
+		spin_unlock_irqrestore(&ldc->lock, flags);
+	}
+}
+
+/* Called with ldc->lock held */
+static dma_cookie_t
+ldc_assign_cookie(struct lpc313x_dma_chan *ldc, struct lpc313x_desc *desc)
+{
+	dma_cookie_t cookie = ldc->chan.cookie;
+
+	if (++cookie < 0)
+		cookie = 1;
+
+	ldc->chan.cookie = cookie;
+	desc->txd.cookie = cookie;
+
+	return cookie;
+}
+
+/*----------------------------------------------------------------------*/
+
+/* Called with ldc->lock held and interrupts off */
+static void ldc_program(struct lpc313x_dma_chan *ldc, struct lpc313x_desc *seg)
+{
+	ldc->cur = seg;
+	dma_prog_channel(ldc->hw, &seg->setup);
+	dma_start_channel(ldc->hw);
+}
+
+/* Segment after seg in the chain headed by first, NULL at the end */
+static struct lpc313x_desc *
+ldc_next_seg(struct lpc313x_desc *first, struct lpc313x_desc *seg)
+{
+	struct list_head *next;
+
+	next = seg == first ? first->txd.tx_list.next : seg->desc_node.next;
+	if (next == &first->txd.tx_list)
+		return NULL;
+
+	return list_entry(next, struct lpc313x_desc, desc_node);
+}
+
+/*
+ * The descriptor at the head of the active list is over, be it
+ * complete or aborted: hand it to the tasklet and start the next one.
+ * Called with ldc->lock held and interrupts off.
+ */
+static void ldc_advance(struct lpc313x_dma_chan *ldc)
+{
+	list_move_tail(ldc->active_list.next, &ldc->done_list);
+	ldc->cur = NULL;
+
+	if (!list_empty(&ldc->queue)) {
+		list_move_tail(ldc->queue.next, &ldc->active_list);
+		ldc_program(ldc, ldc_first_active(ldc));
+	}
+
+	tasklet_schedule(&ldc->tasklet);
+}
+
+/* Called by the mach DMA interrupt handler */
+static void lpc313x_dma_irq(int hw, dma_irq_type_t type, void *data)
+{
+	struct lpc313x_dma_chan	*ldc = data;
+	struct lpc313x_desc	*next;
+
+	spin_lock(&ldc->lock);
+
+	if (!ldc->cur)
+		goto out;
+
+	switch (type) {
+	case DMA_IRQ_FINISHED:
+		next = ldc_next_seg(ldc_first_active(ldc), ldc->cur);
+		if (next)
+			ldc_program(ldc, next);
+		else
+			ldc_advance(ldc);
+		break;
+
+	case DMA_IRQ_DMAABORT:
+		/*
+		 * The abort status is not per channel; the mach handler
+		 * reports it to everybody. Only give up on our transfer
+		 * if the channel has indeed stopped.
+		 */
+		if (dma_channel_enabled(hw))
+			break;
+		dev_err(&ldc->chan.dev, "transfer %d aborted\n",
+				ldc_first_active(ldc)->txd.cookie);
+		ldc_advance(ldc);
+		break;
+
+	default:
+		break;
+	}
+
+out:
+	spin_unlock(&ldc->lock);
+}
+
+/*----------------------------------------------------------------------*/
+
+static void
+ldc_descriptor_complete(struct lpc313x_dma_chan *ldc, struct lpc313x_desc *desc)
+{
+	dma_async_tx_callback		callback;
+	void				*param;
+	struct dma_async_tx_descriptor	*txd = &desc->txd;
+	struct device			*dev = ldc->chan.dev.parent;
+
+	dev_vdbg(&ldc->chan.dev, "descriptor %u complete\n", txd->cookie);
+
+	ldc->completed = txd->cookie;
+	callback = txd->callback;
+	param = txd->callback_param;
+
+	if (!desc->slave) {
+		if (!(txd->flags & DMA_COMPL_SKIP_DEST_UNMAP))
+			dma_unmap_page(dev, desc->dst, desc->len,
+					DMA_FROM_DEVICE);
+		if (!(txd->flags & DMA_COMPL_SKIP_SRC_UNMAP))
+			dma_unmap_page(dev, desc->src, desc->len,
+					DMA_TO_DEVICE);
+	}
+
+	ldc_desc_put(ldc, desc);
+
+	if (callback)
+		callback(param);
+}
+
+static void lpc313x_dma_tasklet(unsigned long data)
+{
+	struct lpc313x_dma_chan	*ldc = (struct lpc313x_dma_chan *)data;
+	struct lpc313x_desc	*desc, *_desc;
+	unsigned long		flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&ldc->lock, flags);
+	list_splice_init(&ldc->done_list, &list);
+	spin_unlock_irqrestore(&ldc->lock, flags);
+
+	list_for_each_entry_safe(desc, _desc, &list, desc_node) {
+		list_del_init(&desc->desc_node);
+		ldc_descriptor_complete(ldc, desc);
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Claim the hardware channel on first use. The mach allocator doesn't
+ * sleep, so this may be done from the prep calls.
+ */
+static int ldc_claim_hw(struct lpc313x_dma_chan *ldc)
+{
+	unsigned long	flags;
+	int		hw;
+
+	if (ldc->hw >= 0)
+		return 0;
+
+	hw = dma_request_channel(ldc->chan.dev.bus_id, lpc313x_dma_irq, ldc);
+	if (hw < 0) {
+		dev_dbg(&ldc->chan.dev, "no free hardware channel\n");
+		return hw;
+	}
+
+	/* finished interrupt only */
+	dma_set_irq_mask(hw, 1, 0);
+
+	spin_lock_irqsave(&ldc->lock, flags);
+	if (ldc->hw < 0) {
+		ldc->hw = hw;
+		hw = -1;
+	}
+	spin_unlock_irqrestore(&ldc->lock, flags);
+
+	/* somebody else was quicker */
+	if (hw >= 0)
+		dma_release_channel(hw);
+	else
+		dev_dbg(&ldc->chan.dev, "hardware channel %d\n", ldc->hw);
+
+	return 0;
+}
+
+static dma_cookie_t ldc_tx_submit(struct dma_async_tx_descriptor *tx)
+{
+	struct lpc313x_desc	*desc = txd_to_lpc313x_desc(tx);
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(tx->chan);
+	dma_cookie_t		cookie;
+	unsigned long		flags;
+
+	spin_lock_irqsave(&ldc->lock, flags);
+	cookie = ldc_assign_cookie(ldc, desc);
+
+	if (list_empty(&ldc->active_list)) {
+		dev_vdbg(&tx->chan->dev, "tx_submit: started %u\n", cookie);
+		list_add_tail(&desc->desc_node, &ldc->active_list);
+		ldc_program(ldc, desc);
+	} else {
+		dev_vdbg(&tx->chan->dev, "tx_submit: queued %u\n", cookie);
+		list_add_tail(&desc->desc_node, &ldc->queue);
+	}
+
+	spin_unlock_irqrestore(&ldc->lock, flags);
+
+	return cookie;
+}
+
+/* Transfer size configuration and unit for an access width of 1 << shift */
+static const u32 ldc_width_cfg[] = {
+	DMA_CFG_TX_BYTE, DMA_CFG_TX_HWORD, DMA_CFG_TX_WORD,
+};
+
+/*
+ * Append the segments moving len bytes from src to dst, in units of
+ * 1 << shift bytes, to the chain headed by *first. Addresses which are
+ * slave registers (src_inc/dst_inc clear) stay fixed in hardware.
+ */
+static int ldc_add_segs(struct lpc313x_dma_chan *ldc, struct lpc313x_desc **first,
+		u32 src, int src_inc, u32 dst, int dst_inc, size_t len,
+		unsigned int shift, u32 cfg)
+{
+	struct lpc313x_desc	*desc;
+	size_t			xfer;
+
+	while (len) {
+		xfer = min_t(size_t, len >> shift, LPC313X_MAX_UNITS);
+
+		desc = ldc_desc_get(ldc);
+		if (!desc)
+			return -ENOMEM;
+
+		desc->setup.src_address = src;
+		desc->setup.dest_address = dst;
+		desc->setup.trans_length = xfer - 1;
+		desc->setup.cfg = cfg;
+
+		if (!*first)
+			*first = desc;
+		else
+			list_add_tail(&desc->desc_node, &(*first)->txd.tx_list);
+
+		xfer <<= shift;
+		if (src_inc)
+			src += xfer;
+		if (dst_inc)
+			dst += xfer;
+		len -= xfer;
+	}
+
+	return 0;
+}
+
+static struct dma_async_tx_descriptor *
+ldc_prep_dma_memcpy(struct dma_chan *chan, dma_addr_t dest, dma_addr_t src,
+		size_t len, unsigned long flags)
+{
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(chan);
+	struct lpc313x_desc	*first = NULL;
+	unsigned int		shift;
+	u32			cfg;
+	u32			align;
+
+	dev_vdbg(&chan->dev, "prep_dma_memcpy d0x%x s0x%x l0x%zx f0x%lx\n",
+			dest, src, len, flags);
+
+	if (unlikely(!len) || ldc_claim_hw(ldc))
+		return NULL;
+
+	/* Bursts of four words when possible, else the widest access */
+	align = dest | src | len;
+	if (!(align & 15)) {
+		shift = 4;
+		cfg = DMA_CFG_TX_BURST;
+	} else {
+		shift = (align & 1) ? 0 : (align & 2) ? 1 : 2;
+		cfg = ldc_width_cfg[shift];
+	}
+
+	if (ldc_add_segs(ldc, &first, src, 1, dest, 1, len, shift, cfg)) {
+		dev_err(&chan->dev, "not enough descriptors available\n");
+		ldc_desc_put(ldc, first);
+		return NULL;
+	}
+
+	first->txd.flags = flags;	/* client is in control of this ack */
+	first->src = src;
+	first->dst = dest;
+	first->len = len;
+	first->slave = 0;
+
+	return &first->txd;
+}
+
+/*
+ * The scatterlist must already be mapped by the client; it is not
+ * unmapped on completion either.
+ */
+static struct dma_async_tx_descriptor *
+ldc_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
+		unsigned int sg_len, enum dma_data_direction direction,
+		unsigned long flags)
+{
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(chan);
+	struct lpc313x_dma_slave *lds = ldc->lds;
+	struct lpc313x_desc	*first = NULL;
+	struct scatterlist	*sg;
+	unsigned int		shift;
+	size_t			total_len = 0;
+	u32			cfg;
+	u32			reg;
+	unsigned int		i;
+
+	dev_vdbg(&chan->dev, "prep_slave_sg\n");
+
+	if (unlikely(!lds || !sg_len) || ldc_claim_hw(ldc))
+		return NULL;
+
+	shift = lds->slave.reg_width;
+	if (direction == DMA_TO_DEVICE) {
+		reg = lds->slave.tx_reg;
+		cfg = lds->tx_cfg;
+	} else {
+		reg = lds->slave.rx_reg;
+		cfg = lds->rx_cfg;
+	}
+	cfg |= ldc_width_cfg[shift];
+
+	for_each_sg(sgl, sg, sg_len, i) {
+		u32	mem = sg_dma_address(sg);
+		size_t	len = sg_dma_len(sg);
+		int	err;
+
+		if (unlikely((mem | len) & ((1 << shift) - 1))) {
+			dev_err(&chan->dev, "unaligned slave buffer\n");
+			goto err;
+		}
+
+		if (direction == DMA_TO_DEVICE)
+			err = ldc_add_segs(ldc, &first, mem, 1, reg, 0,
+					len, shift, cfg);
+		else
+			err = ldc_add_segs(ldc, &first, reg, 0, mem, 1,
+					len, shift, cfg);
+		if (err) {
+			dev_err(&chan->dev,
+				"not enough descriptors available\n");
+			goto err;
+		}
+		total_len += len;
+	}
+
+	/* nothing to move */
+	if (unlikely(!first))
+		return NULL;
+
+	first->txd.flags = flags;
+	first->len = total_len;
+	first->slave = 1;
+
+	return &first->txd;
+
+err:
+	ldc_desc_put(ldc, first);
+	return NULL;
+}
+
+static void ldc_terminate_all(struct dma_chan *chan)
+{
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(chan);
+	struct lpc313x_desc	*desc, *_desc;
+	unsigned long		flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&ldc->lock, flags);
+
+	if (ldc->hw >= 0)
+		dma_stop_channel(ldc->hw);
+	ldc->cur = NULL;
+
+	/* done entries first, then the active one, then the queue */
+	list_splice_init(&ldc->queue, &list);
+	list_splice_init(&ldc->active_list, &list);
+	list_splice_init(&ldc->done_list, &list);
+
+	spin_unlock_irqrestore(&ldc->lock, flags);
+
+	list_for_each_entry_safe(desc, _desc, &list, desc_node) {
+		list_del_init(&desc->desc_node);
+		ldc_descriptor_complete(ldc, desc);
+	}
+}
+
+static enum dma_status
+ldc_is_tx_complete(struct dma_chan *chan,
+		dma_cookie_t cookie,
+		dma_cookie_t *done, dma_cookie_t *used)
+{
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(chan);
+	dma_cookie_t		last_used;
+	dma_cookie_t		last_complete;
+
+	last_complete = ldc->completed;
+	last_used = chan->cookie;
+
+	if (done)
+		*done = last_complete;
+	if (used)
+		*used = last_used;
+
+	return dma_async_is_complete(cookie, last_complete, last_used);
+}
+
+static void ldc_issue_pending(struct dma_chan *chan)
+{
+	/* Descriptors are started at submit time and chained from the IRQ */
+}
+
+static int ldc_alloc_chan_resources(struct dma_chan *chan,
+		struct dma_client *client)
+{
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(chan);
+	struct lpc313x_desc	*desc;
+	struct dma_slave	*slave = client->slave;
+	unsigned long		flags;
+	int			i;
+
+	dev_vdbg(&chan->dev, "alloc_chan_resources\n");
+
+	/* Channels doing slave DMA can only handle one client. */
+	if (ldc->lds || slave) {
+		if (chan->client_count)
+			return -EBUSY;
+	}
+
+	if (slave) {
+		BUG_ON(!slave->dma_dev || slave->dma_dev != chan->device->dev);
+		ldc->lds = to_lpc313x_dma_slave(slave);
+	} else {
+		ldc->lds = NULL;
+	}
+
+	/* The hardware channel is claimed by the first prep */
+	ldc->completed = chan->cookie = 1;
+
+	i = ldc->descs_allocated;
+	while (ldc->descs_allocated < NR_DESCS_PER_CHANNEL) {
+		desc = kzalloc(sizeof(struct lpc313x_desc), GFP_KERNEL);
+		if (!desc) {
+			dev_info(&chan->dev,
+				"only allocated %d descriptors\n", i);
+			break;
+		}
+
+		dma_async_tx_descriptor_init(&desc->txd, chan);
+		desc->txd.tx_submit = ldc_tx_submit;
+		desc->txd.flags = DMA_CTRL_ACK;
+		INIT_LIST_HEAD(&desc->txd.tx_list);
+		ldc_desc_put(ldc, desc);
+
+		spin_lock_irqsave(&ldc->lock, flags);
+		i = ++ldc->descs_allocated;
+		spin_unlock_irqrestore(&ldc->lock, flags);
+	}
+
+	dev_dbg(&chan->dev, "%d descriptors\n", i);
+
+	return i;
+}
+
+static void ldc_free_chan_resources(struct dma_chan *chan)
+{
+	struct lpc313x_dma_chan	*ldc = to_lpc313x_dma_chan(chan);
+	struct lpc313x_desc	*desc, *_desc;
+	unsigned long		flags;
+	LIST_HEAD(list);
+
+	dev_dbg(&chan->dev, "free_chan_resources (descs allocated=%u)\n",
+			ldc->descs_allocated);
+
+	/* ASSERT:  channel is idle */
+	BUG_ON(!list_empty(&ldc->active_list));
+	BUG_ON(!list_empty(&ldc->queue));
+
+	tasklet_kill(&ldc->tasklet);
+
+	spin_lock_irqsave(&ldc->lock, flags);
+	list_splice_init(&ldc->free_list, &list);
+	ldc->descs_allocated = 0;
+	ldc->lds = NULL;
+	spin_unlock_irqrestore(&ldc->lock, flags);
+
+	if (ldc->hw >= 0) {
+		dma_release_channel(ldc->hw);
+		ldc->hw = -1;
+	}
+
+	list_for_each_entry_safe(desc, _desc, &list, desc_node)
+		kfree(desc);
+}
+
+/*----------------------------------------------------------------------*/
+
+static int __init lpc313x_dma_probe(struct platform_device *pdev)
+{
+	struct lpc313x_dmac_platform_data *pdata;
+	struct lpc313x_dma	*ld;
+	size_t			size;
+	int			i;
+
+	pdata = pdev->dev.platform_data;
+	if (!pdata || !pdata->nr_channels ||
+			pdata->nr_channels > DMA_MAX_CHANNELS)
+		return -EINVAL;
+
+	size = sizeof(struct lpc313x_dma);
+	size += pdata->nr_channels * sizeof(struct lpc313x_dma_chan);
+	ld = kzalloc(size, GFP_KERNEL);
+	if (!ld)
+		return -ENOMEM;
+
+	platform_set_drvdata(pdev, ld);
+
+	INIT_LIST_HEAD(&ld->dma.channels);
+	for (i = 0; i < pdata->nr_channels; i++, ld->dma.chancnt++) {
+		struct lpc313x_dma_chan	*ldc = &ld->chan[i];
+
+		ldc->chan.device = &ld->dma;
+		ldc->chan.cookie = ldc->completed = 1;
+		ldc->chan.chan_id = i;
+		list_add_tail(&ldc->chan.device_node, &ld->dma.channels);
+
+		spin_lock_init(&ldc->lock);
+		ldc->hw = -1;
+
+		INIT_LIST_HEAD(&ldc->active_list);
+		INIT_LIST_HEAD(&ldc->queue);
+		INIT_LIST_HEAD(&ldc->done_list);
+		INIT_LIST_HEAD(&ldc->free_list);
+
+		tasklet_init(&ldc->tasklet, lpc313x_dma_tasklet,
+				(unsigned long)ldc);
+	}
+
+	dma_cap_set(DMA_MEMCPY, ld->dma.cap_mask);
+	dma_cap_set(DMA_SLAVE, ld->dma.cap_mask);
+	ld->dma.dev = &pdev->dev;
+	ld->dma.device_alloc_chan_resources = ldc_alloc_chan_resources;
+	ld->dma.device_free_chan_resources = ldc_free_chan_resources;
+
+	ld->dma.device_prep_dma_memcpy = ldc_prep_dma_memcpy;
+
+	ld->dma.device_prep_slave_sg = ldc_prep_slave_sg;
+	ld->dma.device_terminate_all = ldc_terminate_all;
+
+	ld->dma.device_is_tx_complete = ldc_is_tx_complete;
+	ld->dma.device_issue_pending = ldc_issue_pending;
+
+	printk(KERN_INFO "%s: LPC313x DMA Controller, %d channels\n",
+			pdev->dev.bus_id, ld->dma.chancnt);
+
+	dma_async_device_register(&ld->dma);
+
+	return 0;
+}
+
+static int __exit lpc313x_dma_remove(struct platform_device *pdev)
+{
+	struct lpc313x_dma	*ld = platform_get_drvdata(pdev);
+	struct lpc313x_dma_chan	*ldc, *_ldc;
+
+	dma_async_device_unregister(&ld->dma);
+
+	list_for_each_entry_safe(ldc, _ldc, &ld->dma.channels,
+			chan.device_node) {
+		list_del(&ldc->chan.device_node);
+		tasklet_kill(&ldc->tasklet);
+	}
+
+	kfree(ld);
+
+	return 0;
+}
+
+static struct platform_driver lpc313x_dma_driver = {
+	.remove		= __exit_p(lpc313x_dma_remove),
+	.driver = {
+		.name	= "lpc313x_dmac",
+	},
+};
+
+static int __init lpc313x_dma_init(void)
+{
+	return platform_driver_probe(&lpc313x_dma_driver, lpc313x_dma_probe);
+}
+module_init(lpc313x_dma_init);
+
+static void __exit lpc313x_dma_exit(void)
+{
+	platform_driver_unregister(&lpc313x_dma_driver);
+}
+module_exit(lpc313x_dma_exit);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("LPC313x dmaengine driver");
@@ -39,10 +39,12 @@
 #include <linux/delay.h>
 #include <linux/irq.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
 
 #include "lpc313x_mmc.h"
 #include <mach/irqs.h>
 #include <linux/mmc/host.h>
+#include <linux/mmc/mmc.h>
 #include <mach/board.h>
 /* for time being use arch specific DMA framework instead of generic framework */
 #include <mach/dma.h>
@@ -57,6 +59,42 @@
 #define LPC313x_MCI_RECV_STATUS		2
 #define LPC313x_MCI_DMA_THRESHOLD	16
 
+/* Card clock limits for default and high speed timing */
+#define LPC313x_MCI_LEGACY_CLOCK	25000000
+#define LPC313x_MCI_HS_CLOCK		50000000
+
+/* Number of blocks read at high speed by the self-test */
+#define LPC313x_MCI_SELFTEST_READS	8
+
+/* Advertise SD and MMC high speed timing */
+static int highspeed = 1;
+module_param(highspeed, bool, 0444);
+MODULE_PARM_DESC(highspeed, "Enable SD/MMC high speed timing (up to 50MHz)");
+
+/* Largest transfer of a single linked list entry, segments are limited to
+   this so each one needs a single entry */
+#define LPC313x_MCI_MAX_SEG_SIZE	((DMA_MAX_TRANSFERS + 1) << 2)
+#define LPC313x_MCI_MAX_SEGS		128
+
+/* Segments that are not word aligned in memory or in the data stream are
+   gathered into a bounce buffer and transferred from there */
+#define LPC313x_MCI_BOUNCE_SIZE		LPC313x_MCI_MAX_SEG_SIZE
+#define LPC313x_MCI_MAX_BOUNCE_SEGS	16
+
+/* Number of DMA descriptor sets, a request can be mapped and its linked
+   list built while the previous one is still in flight */
+#define LPC313x_MCI_DMA_DESCS		2
+
+#ifdef USE_DMA
+/* Map the request and build its linked list from lpc313x_mci_request(),
+   outside the host lock and ahead of the start of the transfer. This
+   only overlaps with another slot's transfer, so by default (-1) it is
+   only done on boards with more than one slot. */
+static int premap = -1;
+module_param(premap, int, 0644);
+MODULE_PARM_DESC(premap, "Prepare DMA for a request before the previous one has completed (-1 = only with several slots)");
+#endif
+
 enum {
 	EVENT_CMD_COMPLETE = 0,
 	EVENT_XFER_COMPLETE,
@@ -77,6 +115,24 @@ enum lpc313x_mci_state {
 /*forward declaration */
 struct lpc313x_mci_slot;
 
+/* DMA linked list and bounce buffer for one request */
+struct lpc313x_mci_dma_desc {
+	dma_lli_t		*lli;
+	struct scatterlist	lli_sg[LPC313x_MCI_MAX_SEGS];
+	void			*bounce_cpu;
+	dma_addr_t		bounce_dma;
+	unsigned int		bounce_len;
+	unsigned int		bounce_nr;
+	struct {
+		void		*virt;
+		unsigned int	len;
+	} bounce_seg[LPC313x_MCI_MAX_BOUNCE_SEGS];
+
+	/* Request the set is used for, NULL when free */
+	struct mmc_data		*data;
+	unsigned int		direction;
+};
+
 struct lpc313x_mci {
 	spinlock_t		lock;
 	void __iomem		*regs;
@@ -91,8 +147,11 @@ struct lpc313x_mci {
 
 #ifdef USE_DMA
 	int			dma_chn;
-	dma_addr_t		sg_dma;
-	dma_sg_ll_t		*sg_cpu;
+	dma_addr_t		bounce_dma;
+	void			*bounce_cpu;
+
+	struct lpc313x_mci_dma_desc dma_desc[LPC313x_MCI_DMA_DESCS];
+	struct lpc313x_mci_dma_desc *cur_desc;
 #endif
 	u32			cmd_status;
 	u32			data_status;
@@ -128,11 +187,18 @@ struct lpc313x_mci_slot {
 #define LPC313x_MMC_CARD_PRESENT	0
 #define LPC313x_MMC_CARD_NEED_INIT	1
 #define LPC313x_MMC_SHUTDOWN		2
+#define LPC313x_MMC_HS_TESTED		3
+#define LPC313x_MMC_HS_FAILED		4
+#define LPC313x_MMC_HS_PENDING		5
 	int			id;
 	int			last_detect_state;
 	struct task_struct	*thread_task;
 
 	struct timer_list	detect_timer;
+
+	/* High speed self-test, run ahead of the request held in hs_mrq */
+	struct work_struct	hs_work;
+	struct mmc_request	*hs_mrq;
 };
 
 #define lpc313x_mci_test_and_clear_pending(host, event)		\
@@ -355,14 +421,37 @@ static void send_stop_cmd(struct lpc313x_mci *host, struct mmc_data *data)
 
 #ifdef USE_DMA
 
+/*
+ * Called from both the tasklet and the DMA interrupt, whichever takes
+ * the set off cur_desc first undoes it
+ */
 static void lpc313x_mci_dma_cleanup(struct lpc313x_mci *host)
 {
-	struct mmc_data			*data = host->data;
+	struct lpc313x_mci_dma_desc	*desc;
+	struct mmc_data			*data;
+	unsigned int			i, offset = 0;
 
-	if (data) 
-		dma_unmap_sg(&host->pdev->dev, data->sg, data->sg_len,
-		     ((data->flags & MMC_DATA_WRITE)
-		      ? DMA_TO_DEVICE : DMA_FROM_DEVICE));
+	desc = xchg(&host->cur_desc, NULL);
+	if (desc == NULL)
+		return;
+
+	data = desc->data;
+	dma_unmap_sg(&host->pdev->dev, data->sg, data->sg_len,
+		desc->direction);
+	dma_lli_free(desc->lli);
+	desc->lli = NULL;
+
+	/* Copy bounced segments of a read back to the request */
+	if (desc->direction == DMA_FROM_DEVICE) {
+		for (i = 0; i < desc->bounce_nr; i++) {
+			memcpy(desc->bounce_seg[i].virt,
+				desc->bounce_cpu + offset,
+				desc->bounce_seg[i].len);
+			offset += desc->bounce_seg[i].len;
+		}
+	}
+
+	desc->data = NULL;
 }
 
 static void lpc313x_mci_stop_dma(struct lpc313x_mci *host)
@@ -396,99 +485,253 @@ static void lpc313x_mci_dma_complete(int chn, dma_irq_type_t type, void *arg)
 	}
 }
 
-static int lpc313x_mci_submit_data_dma(struct lpc313x_mci *host, struct mmc_data *data)
+/*
+ * Add a segment of the transfer to the scatterlist the linked list is
+ * built from. Returns the next free slot, or -1 if the list is full.
+ */
+static int lpc313x_mci_add_seg(struct lpc313x_mci_dma_desc *desc, int j,
+		u32 mem_addr, unsigned int length)
 {
-	struct scatterlist		*sg;
-	unsigned int			i, direction, sg_len;
-	unsigned int			j, trans_len;
+	if (j >= LPC313x_MCI_MAX_SEGS)
+		return -1;
 
-	/* If we don't have a channel, we can't do DMA */
-	if (host->dma_chn < 0)
-		return -ENODEV;
+	sg_dma_address(&desc->lli_sg[j]) = mem_addr;
+	sg_dma_len(&desc->lli_sg[j]) = length;
 
-	/*
-	 * We don't do DMA on "complex" transfers, i.e. with
-	 * non-word-aligned buffers or lengths. Also, we don't bother
-	 * with all the DMA setup overhead for short transfers.
-	 */
-	if (data->blocks * data->blksz < LPC313x_MCI_DMA_THRESHOLD)
-		return -EINVAL;
-	if (data->blksz & 3)
-		return -EINVAL;
+	return j + 1;
+}
 
-	for_each_sg(data->sg, sg, data->sg_len, i) {
-		if (sg->offset & 3 || sg->length & 3)
-			return -EINVAL;
+/*
+ * Claim a free descriptor set for data, called with the host lock held
+ */
+static struct lpc313x_mci_dma_desc *lpc313x_mci_get_desc(struct lpc313x_mci *host,
+		struct mmc_data *data)
+{
+	int				i;
+
+	for (i = 0; i < LPC313x_MCI_DMA_DESCS; i++) {
+		if (host->dma_desc[i].data == NULL) {
+			host->dma_desc[i].data = data;
+			return &host->dma_desc[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the descriptor set prepared for data, called with the host lock
+ * held
+ */
+static struct lpc313x_mci_dma_desc *lpc313x_mci_find_desc(struct lpc313x_mci *host,
+		struct mmc_data *data)
+{
+	int				i;
+
+	for (i = 0; i < LPC313x_MCI_DMA_DESCS; i++) {
+		if (host->dma_desc[i].data == data)
+			return &host->dma_desc[i];
 	}
 
-	if (data->flags & MMC_DATA_READ)
-		direction = DMA_FROM_DEVICE;
+	return NULL;
+}
+
+/*
+ * Map the request and build its DMA linked list in a claimed descriptor
+ * set. On failure the set is released and the request uses PIO.
+ */
+static int lpc313x_mci_prep_data_dma(struct lpc313x_mci *host,
+		struct lpc313x_mci_dma_desc *desc, struct mmc_data *data)
+{
+	struct scatterlist		*sg;
+	unsigned int			i, sg_len, read;
+	unsigned int			pos, run_start, run_len;
+	u32				cfg;
+	int				j;
+
+	read = (data->flags & MMC_DATA_READ) ? 1 : 0;
+	if (read)
+		desc->direction = DMA_FROM_DEVICE;
 	else
-		direction = DMA_TO_DEVICE;
+		desc->direction = DMA_TO_DEVICE;
 
 	sg_len = dma_map_sg(&host->pdev->dev, data->sg, data->sg_len,
-				   direction);
+				   desc->direction);
 
-	dev_vdbg(&host->pdev->dev, "sd sg_cpu: 0x%08x sg_dma:0x%08x sg_len:%d \n",
-		(u32)host->sg_cpu, (u32)host->sg_dma, sg_len);
+	dev_vdbg(&host->pdev->dev, "sd sg_len:%d \n", sg_len);
 
-	for (i = 0, j = 0; i < sg_len; i++) {
-		unsigned int length = sg_dma_len(&data->sg[i]);
-		u32 mem_addr = sg_dma_address(&data->sg[i]);
+	/*
+	 * Segments that start on a word boundary, both in memory and in
+	 * the data stream, and have a length multiple of 4 are transferred
+	 * in place. Runs of other segments are gathered in the bounce
+	 * buffer, a run always ends on a word boundary of the stream.
+	 */
+	desc->bounce_nr = 0;
+	desc->bounce_len = 0;
+	pos = run_start = run_len = 0;
+	j = 0;
+	sg_init_table(desc->lli_sg, LPC313x_MCI_MAX_SEGS);
+
+	for_each_sg(data->sg, sg, sg_len, i) {
+		unsigned int length = sg_dma_len(sg);
+		u32 mem_addr = sg_dma_address(sg);
+
+		if (!((mem_addr | length | pos) & 3)) {
+			if (run_len) {
+				j = lpc313x_mci_add_seg(desc, j,
+					desc->bounce_dma + run_start, run_len);
+				run_len = 0;
+				if (j < 0)
+					goto err_unmap;
+			}
 
-		while (length) {
+			j = lpc313x_mci_add_seg(desc, j, mem_addr, length);
+			if (j < 0)
+				goto err_unmap;
+		}
+		else {
+			if ((desc->bounce_nr >= LPC313x_MCI_MAX_BOUNCE_SEGS) ||
+				((desc->bounce_len + length) > LPC313x_MCI_BOUNCE_SIZE))
+				goto err_unmap;
+
+			if (!read)
+				memcpy(desc->bounce_cpu + desc->bounce_len,
+					sg_virt(sg), length);
+
+			desc->bounce_seg[desc->bounce_nr].virt = sg_virt(sg);
+			desc->bounce_seg[desc->bounce_nr].len = length;
+			desc->bounce_nr++;
+
+			if (!run_len)
+				run_start = desc->bounce_len;
+			desc->bounce_len += length;
+			run_len += length;
+		}
 
-			host->sg_cpu[j].setup.cfg = DMA_CFG_CMP_CH_EN | DMA_CFG_CMP_CH_NR(host->dma_chn);
+		pos += length;
+	}
 
-			if (data->flags & MMC_DATA_READ) {
-				host->sg_cpu[j].setup.src_address = SDMMC_DATA_ADR;
-				host->sg_cpu[j].setup.dest_address = mem_addr;
-				host->sg_cpu[j].setup.cfg |= DMA_CFG_RD_SLV_NR(DMA_SLV_SDMMC);
-			} else {
-				host->sg_cpu[j].setup.src_address = mem_addr;
-				host->sg_cpu[j].setup.dest_address = SDMMC_DATA_ADR;
-				host->sg_cpu[j].setup.cfg |= DMA_CFG_WR_SLV_NR(DMA_SLV_SDMMC);
-			}
-			host->sg_cpu[j].next_entry = host->sg_dma + (j + 1) *
-						sizeof(dma_sg_ll_t);
+	if (run_len) {
+		j = lpc313x_mci_add_seg(desc, j, desc->bounce_dma + run_start,
+			run_len);
+		if (j < 0)
+			goto err_unmap;
+	}
 
+	if (read)
+		cfg = DMA_CFG_RD_SLV_NR(DMA_SLV_SDMMC);
+	else
+		cfg = DMA_CFG_WR_SLV_NR(DMA_SLV_SDMMC);
 #ifdef BURST_DMA
-			host->sg_cpu[j].setup.cfg |= DMA_CFG_TX_BURST;
-      /* 16 bytes per transfer */
-			trans_len = (length >> 4) - 1;
-#else
-      /* 4 bytes per transfer */
-			trans_len = (length >> 2) - 1;
+	/* 16 bytes per transfer */
+	cfg |= DMA_CFG_TX_BURST;
 #endif
 
-			if (trans_len > DMA_MAX_TRANSFERS) {
-				trans_len = DMA_MAX_TRANSFERS;
-				length -= (DMA_MAX_TRANSFERS + 1) << 2;
-				mem_addr += ((DMA_MAX_TRANSFERS + 1) << 2);
-			}
-			else {
-				length = 0;
-			}
+	/* The list ends with the soft interrupt that completes the request */
+	desc->lli = dma_lli_from_sg(host->dma_chn, desc->lli_sg, j,
+		SDMMC_DATA_ADR, cfg, !read, 1, GFP_ATOMIC);
+	if (IS_ERR(desc->lli)) {
+		desc->lli = NULL;
+		goto err_unmap;
+	}
+
+	return 0;
 
-			host->sg_cpu[j].setup.trans_length = trans_len;
+err_unmap:
+	/* Too many entries or bounced bytes, or no memory for the list,
+	   use PIO for this request */
+	dma_unmap_sg(&host->pdev->dev, data->sg, data->sg_len, desc->direction);
+	desc->data = NULL;
 
-			dev_vdbg(&host->pdev->dev, "sd src: 0x%08x dest:0x%08x cfg:0x%08x nxt:0x%08x len:%d \n",
-				host->sg_cpu[j].setup.src_address, host->sg_cpu[j].setup.dest_address,
-				host->sg_cpu[j].setup.cfg, host->sg_cpu[j].next_entry,
-				host->sg_cpu[j].setup.trans_length);
+	return -EINVAL;
+}
 
-			/* move to next transfer descriptor */
-			j++;
-		}
+/*
+ * Check if a request can use DMA at all
+ */
+static int lpc313x_mci_can_dma(struct lpc313x_mci *host, struct mmc_data *data)
+{
+	/* If we don't have a channel, we can't do DMA */
+	if (host->dma_chn < 0)
+		return 0;
+
+	/*
+	 * The data FIFO is word wide, so the total length must be a
+	 * multiple of 4. Also, we don't bother with all the DMA setup
+	 * overhead for short transfers.
+	 */
+	if (data->blocks * data->blksz < LPC313x_MCI_DMA_THRESHOLD)
+		return 0;
+	if (data->blksz & 3)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Prepare DMA for a request ahead of its start, called from
+ * lpc313x_mci_request() without the host lock held
+ */
+static void lpc313x_mci_premap_data(struct lpc313x_mci *host, struct mmc_data *data)
+{
+	struct lpc313x_mci_dma_desc	*desc;
+
+	if (!premap || ((premap < 0) && (host->pdata->num_slots < 2)) ||
+		!lpc313x_mci_can_dma(host, data))
+		return;
+
+	spin_lock_bh(&host->lock);
+	desc = lpc313x_mci_get_desc(host, data);
+	spin_unlock_bh(&host->lock);
+
+	/* The set is claimed, build it outside the lock */
+	if (desc)
+		lpc313x_mci_prep_data_dma(host, desc, data);
+}
+
+/*
+ * Drop the DMA preparation of a request that is completed without being
+ * started, called with the host lock held
+ */
+static void lpc313x_mci_release_data(struct lpc313x_mci *host, struct mmc_data *data)
+{
+	struct lpc313x_mci_dma_desc	*desc;
+
+	desc = lpc313x_mci_find_desc(host, data);
+	if (desc && desc != host->cur_desc) {
+		dma_unmap_sg(&host->pdev->dev, data->sg, data->sg_len,
+			desc->direction);
+		dma_lli_free(desc->lli);
+		desc->lli = NULL;
+		desc->data = NULL;
+	}
+}
+
+static int lpc313x_mci_submit_data_dma(struct lpc313x_mci *host, struct mmc_data *data)
+{
+	struct lpc313x_mci_dma_desc	*desc, *old;
+
+	if (!lpc313x_mci_can_dma(host, data))
+		return -EINVAL;
+
+	/* Use the prepared set, or prepare one now */
+	desc = lpc313x_mci_find_desc(host, data);
+	if (desc == NULL) {
+		desc = lpc313x_mci_get_desc(host, data);
+		if (desc == NULL)
+			return -EBUSY;
+		if (lpc313x_mci_prep_data_dma(host, desc, data))
+			return -EINVAL;
 	}
-	host->sg_cpu[j].setup.src_address = host->sg_dma;
-	host->sg_cpu[j].setup.dest_address = DMACH_SOFT_INT_PHYS;
-	host->sg_cpu[j].setup.trans_length = 1;
-	host->sg_cpu[j].setup.cfg = 0;
+
+	/* The previous set must have been cleaned up by now */
+	old = xchg(&host->cur_desc, desc);
+	WARN_ON(old != NULL);
+
 	// disable irq of RX & TX, let DMA handle it
 	//SDMMC_INTMASK &= ~(SDMMC_INT_RXDR | SDMMC_INT_TXDR);
 	SDMMC_CTRL |= SDMMC_CTRL_DMA_ENABLE; // enable dma
-	dma_prog_sg_channel(host->dma_chn, host->sg_dma);
+	dma_prog_sg_channel(host->dma_chn, desc->lli->dma);
 	wmb();
 	/* Go! */
 	dma_start_channel(host->dma_chn);
@@ -507,6 +750,10 @@ static void lpc313x_mci_stop_dma(struct lpc313x_mci *host)
 	/* Data transfer was stopped by the interrupt handler */
 	lpc313x_mci_set_pending(host, EVENT_XFER_COMPLETE);
 }
+
+static void lpc313x_mci_release_data(struct lpc313x_mci *host, struct mmc_data *data)
+{
+}
 #endif
 
 static void lpc313x_mci_submit_data(struct lpc313x_mci *host, struct mmc_data *data)
@@ -536,16 +783,48 @@ static void lpc313x_mci_submit_data(struct lpc313x_mci *host, struct mmc_data *d
     while (SDMMC_CMD & SDMMC_CMD_START); \
 }
 
+/*
+ * Card clock of a slot, limited to default speed once high speed has
+ * failed for the card
+ */
+static unsigned int lpc313x_mci_slot_clock(struct lpc313x_mci_slot *slot)
+{
+	if (test_bit(LPC313x_MMC_HS_FAILED, &slot->flags))
+		return min(slot->clock, (unsigned int)LPC313x_MCI_LEGACY_CLOCK);
+
+	return slot->clock;
+}
+
+/*
+ * Drop a card to default speed timing after errors at high speed
+ */
+static void lpc313x_mci_hs_fallback(struct lpc313x_mci_slot *slot)
+{
+	if (slot->clock <= LPC313x_MCI_LEGACY_CLOCK ||
+		test_and_set_bit(LPC313x_MMC_HS_FAILED, &slot->flags))
+		return;
+
+	dev_warn(&slot->mmc->class_dev,
+		"CRC errors at %uHz, limiting card clock to %uHz\n",
+		slot->clock, LPC313x_MCI_LEGACY_CLOCK);
+}
+
 void lpc313x_mci_setup_bus(struct lpc313x_mci_slot *slot)
 {
 	struct lpc313x_mci *host = slot->host;
+	unsigned int clock = lpc313x_mci_slot_clock(slot);
 	u32 div;
 
-	if (slot->clock != host->current_speed) {
-		div  = (((host->bus_hz + (host->bus_hz / 5)) / slot->clock)) >> 1;
+	if (clock != host->current_speed) {
+		/* Never run the card faster than requested, CLKDIV 0 bypasses
+		   the divider */
+		if (clock >= host->bus_hz)
+			div = 0;
+		else
+			div = min(DIV_ROUND_UP(host->bus_hz, 2 * clock), 255U);
 
 		dev_dbg(&slot->mmc->class_dev, "Bus speed (slot %d) = %dHz (actual %dHz)\n",
-			slot->id, slot->clock, (host->bus_hz / div));
+			slot->id, clock, div ? (host->bus_hz / (2 * div)) : host->bus_hz);
 			
 		/* disable clock */
 		mci_writel(CLKENA, 0);
@@ -562,7 +841,7 @@ void lpc313x_mci_setup_bus(struct lpc313x_mci_slot *slot)
 		/* inform CIU */
 		 mci_send_cmd( SDMMC_CMD_UPD_CLK | SDMMC_CMD_PRV_DAT_WAIT, 0);
 
-		host->current_speed = slot->clock;
+		host->current_speed = clock;
 	}
 
 	/* Set the current slot bus width */
@@ -635,23 +914,147 @@ static void lpc313x_mci_queue_request(struct lpc313x_mci *host,
 }
 
 
-static void lpc313x_mci_request(struct mmc_host *mmc, struct mmc_request *mrq)
+/*
+ * Read one block at the current clock of a slot. The card is selected
+ * and in transfer state once the core has set it up for high speed.
+ */
+static int lpc313x_mci_read_block(struct mmc_host *mmc, void *buf)
 {
-	struct lpc313x_mci_slot	*slot = mmc_priv(mmc);
-	struct lpc313x_mci	*host = slot->host;
+	struct mmc_request	mrq;
+	struct mmc_command	cmd;
+	struct mmc_data		data;
+	struct scatterlist	sg;
 
-	WARN_ON(slot->mrq);
+	memset(&mrq, 0, sizeof(struct mmc_request));
+	memset(&cmd, 0, sizeof(struct mmc_command));
+	memset(&data, 0, sizeof(struct mmc_data));
+
+	mrq.cmd = &cmd;
+	mrq.data = &data;
+
+	cmd.opcode = MMC_READ_SINGLE_BLOCK;
+	cmd.arg = 0;
+	cmd.flags = MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	data.blksz = 512;
+	data.blocks = 1;
+	data.flags = MMC_DATA_READ;
+	data.sg = &sg;
+	data.sg_len = 1;
+	data.timeout_ns = 100000000;
+
+	sg_init_one(&sg, buf, 512);
+
+	mmc_wait_for_req(mmc, &mrq);
+
+	if (cmd.error)
+		return cmd.error;
+
+	return data.error;
+}
+
+/*
+ * High speed self-test: read the first block at default speed, then
+ * read it back several times at high speed. A CRC error, timeout or
+ * mismatch limits the card to default speed until it is removed.
+ */
+static void lpc313x_mci_hs_selftest(struct lpc313x_mci_slot *slot)
+{
+	u8			*ref, *buf;
+	int			i, err;
+
+	ref = kmalloc(2 * 512, GFP_KERNEL);
+	if (ref == NULL)
+		return;
+	buf = ref + 512;
+
+	set_bit(LPC313x_MMC_HS_FAILED, &slot->flags);
+	err = lpc313x_mci_read_block(slot->mmc, ref);
+	clear_bit(LPC313x_MMC_HS_FAILED, &slot->flags);
+
+	/* Nothing to compare against, leave the card alone */
+	if (err)
+		goto out;
+
+	for (i = 0; i < LPC313x_MCI_SELFTEST_READS; i++) {
+		err = lpc313x_mci_read_block(slot->mmc, buf);
+		if (!err && memcmp(ref, buf, 512))
+			err = -EILSEQ;
+		if (err)
+			break;
+	}
+
+	if (err)
+		lpc313x_mci_hs_fallback(slot);
+	else
+		dev_dbg(&slot->mmc->class_dev, "high speed self-test passed at %uHz\n",
+			slot->clock);
+
+out:
+	kfree(ref);
+}
+
+static void lpc313x_mci_submit_request(struct lpc313x_mci_slot *slot,
+		struct mmc_request *mrq)
+{
+	struct lpc313x_mci	*host = slot->host;
 
 	if (!test_bit(LPC313x_MMC_CARD_PRESENT, &slot->flags)) {
 		mrq->cmd->error = -ENOMEDIUM;
-		mmc_request_done(mmc, mrq);
+		mmc_request_done(slot->mmc, mrq);
 		return;
 	}
 
+#ifdef USE_DMA
+	/* Map and build the DMA list now, while the controller may still
+	   be busy with the request of another slot */
+	if (mrq->data)
+		lpc313x_mci_premap_data(host, mrq->data);
+#endif
+
 	/* We don't support multiple blocks of weird lengths. */
 	lpc313x_mci_queue_request(host, slot, mrq);
 }
 
+/*
+ * Run the high speed self-test, then the request it was held back for.
+ * The core keeps the host claimed while it waits for that request, so
+ * the test reads are issued on its behalf.
+ */
+static void lpc313x_mci_hs_work(struct work_struct *work)
+{
+	struct lpc313x_mci_slot	*slot =
+		container_of(work, struct lpc313x_mci_slot, hs_work);
+	struct mmc_request	*mrq = slot->hs_mrq;
+
+	slot->hs_mrq = NULL;
+
+	if (test_bit(LPC313x_MMC_CARD_PRESENT, &slot->flags))
+		lpc313x_mci_hs_selftest(slot);
+
+	lpc313x_mci_submit_request(slot, mrq);
+}
+
+static void lpc313x_mci_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct lpc313x_mci_slot	*slot = mmc_priv(mmc);
+
+	WARN_ON(slot->mrq);
+
+	/* Check the card before its first transfer at high speed. The core
+	   sets the bus width after the clock, only now both are final. The
+	   test sleeps and goes through this function again, so it runs
+	   from a work item. */
+	if (mrq->data &&
+		test_and_clear_bit(LPC313x_MMC_HS_PENDING, &slot->flags)) {
+		slot->hs_mrq = mrq;
+		schedule_work(&slot->hs_work);
+		return;
+	}
+
+	lpc313x_mci_submit_request(slot, mrq);
+}
+
 static void lpc313x_mci_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 {
 	struct lpc313x_mci_slot	*slot = mmc_priv(mmc);
@@ -676,6 +1079,13 @@ static void lpc313x_mci_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 		 */
 		slot->clock = ios->clock;
 
+		/* Check the card once it has been switched to high speed,
+		   with the first data request (the bus width comes later) */
+		if (ios->timing != MMC_TIMING_LEGACY &&
+			ios->clock > LPC313x_MCI_LEGACY_CLOCK &&
+			!test_and_set_bit(LPC313x_MMC_HS_TESTED, &slot->flags))
+			set_bit(LPC313x_MMC_HS_PENDING, &slot->flags);
+
 //		if (list_empty(&host->queue))
 //			lpc313x_mci_set_clk(host,slot->clock,slot->ctype);
 //		else
@@ -902,6 +1312,7 @@ static void lpc313x_mci_tasklet_func(unsigned long priv)
 					dev_err(&host->pdev->dev,
 							"data CRC error\n");
 					data->error = -EILSEQ;
+					lpc313x_mci_hs_fallback(host->cur_slot);
 				} else {
 					dev_err(&host->pdev->dev,
 						"data FIFO error (status=%08x)\n",
@@ -1263,8 +1674,10 @@ static int lpc313x_mci_detect_change_thread(void *slot_data)
 				} else {
 					list_del(&slot->queue_node);
 					mrq->cmd->error = -ENOMEDIUM;
-					if (mrq->data)
+					if (mrq->data) {
+						lpc313x_mci_release_data(host, mrq->data);
 						mrq->data->error = -ENOMEDIUM;
+					}
 					if (mrq->stop)
 						mrq->stop->error = -ENOMEDIUM;
 	
@@ -1280,6 +1693,11 @@ static int lpc313x_mci_detect_change_thread(void *slot_data)
 					host->pdata->setpower(slot->id, 0);
 
 				clear_bit(LPC313x_MMC_CARD_PRESENT, &slot->flags);
+
+				/* A new card gets its own high speed test */
+				clear_bit(LPC313x_MMC_HS_TESTED, &slot->flags);
+				clear_bit(LPC313x_MMC_HS_FAILED, &slot->flags);
+				clear_bit(LPC313x_MMC_HS_PENDING, &slot->flags);
 			}
 
 			spin_unlock(&host->lock);
@@ -1306,6 +1724,18 @@ static irqreturn_t lpc313x_mci_detect_interrupt(int irq, void *dev_id)
 	return IRQ_HANDLED;
 }
 
+/*
+ * Highest card clock up to high speed that the CIU divider gives for an
+ * input clock of bus_hz
+ */
+static unsigned int lpc313x_mci_max_clock(u32 bus_hz)
+{
+	if (bus_hz <= LPC313x_MCI_HS_CLOCK)
+		return bus_hz;
+
+	return bus_hz / (2 * DIV_ROUND_UP(bus_hz, 2 * LPC313x_MCI_HS_CLOCK));
+}
+
 static int __init
 lpc313x_mci_init_slot(struct lpc313x_mci *host, unsigned int id)
 {
@@ -1322,10 +1752,11 @@ lpc313x_mci_init_slot(struct lpc313x_mci *host, unsigned int id)
 	slot->id = id;
 	slot->mmc = mmc;
 	slot->host = host;
+	INIT_WORK(&slot->hs_work, lpc313x_mci_hs_work);
 
 	mmc->ops = &lpc313x_mci_ops;
 	mmc->f_min = DIV_ROUND_UP(host->bus_hz, 510);
-	mmc->f_max = host->bus_hz/2; //max f is clock to mmc_clk/2
+	mmc->f_max = lpc313x_mci_max_clock(host->bus_hz);
 	if (host->pdata->get_ocr)
 		mmc->ocr_avail = host->pdata->get_ocr(id);
 	else
@@ -1340,12 +1771,27 @@ lpc313x_mci_init_slot(struct lpc313x_mci *host, unsigned int id)
 		if (host->pdata->get_bus_wd(slot->id) >= 4)
 		mmc->caps |= MMC_CAP_4_BIT_DATA;
 
+	if (highspeed && mmc->f_max > LPC313x_MCI_LEGACY_CLOCK)
+		mmc->caps |= MMC_CAP_SD_HIGHSPEED | MMC_CAP_MMC_HIGHSPEED;
+	else
+		mmc->f_max = min(mmc->f_max, (unsigned int)LPC313x_MCI_LEGACY_CLOCK);
+
+#ifdef USE_DMA
+	/* Each segment fits in one DMA linked list entry */
+	mmc->max_phys_segs = LPC313x_MCI_MAX_SEGS;
+	mmc->max_hw_segs = LPC313x_MCI_MAX_SEGS;
+	mmc->max_blk_size = 65536; /* BLKSIZ is 16 bits*/
+	mmc->max_blk_count = 512;
+	mmc->max_seg_size = LPC313x_MCI_MAX_SEG_SIZE;
+	mmc->max_req_size = mmc->max_seg_size * mmc->max_hw_segs;
+#else
 	mmc->max_phys_segs = 64;
 	mmc->max_hw_segs = 64;
 	mmc->max_blk_size = 65536; /* BLKSIZ is 16 bits*/
 	mmc->max_blk_count = 512;
 	mmc->max_req_size = mmc->max_blk_size * mmc->max_blk_count;
 	mmc->max_seg_size = mmc->max_req_size;
+#endif
 
 	/* Assume card is present initially */
 	if(!host->pdata->get_cd(id))
@@ -1394,11 +1840,72 @@ static void lpc313x_mci_cleanup_slot(struct lpc313x_mci_slot *slot,
 	set_bit(LPC313x_MMC_SHUTDOWN, &slot->flags);
 	smp_wmb();
 	mmc_remove_host(slot->mmc);
+	flush_work(&slot->hs_work);
 	slot->host->slot[id] = NULL;
 	mmc_free_host(slot->mmc);
 }
 
 
+/*
+ * Check that no other SYS clock uses the fractional divider of the CIU
+ * input clock
+ */
+static int lpc313x_mci_fdiv_private(void)
+{
+	u32 esr = CGU_SB->clk_esr[CGU_SB_SD_MMC_CCLK_IN_ID];
+	int id;
+
+	if (!(esr & CGU_SB_ESR_ENABLE))
+		return 0;
+
+	for (id = CGU_SYS_FIRST; id <= CGU_SYS_LAST; id++) {
+		if (id == CGU_SB_SD_MMC_CCLK_IN_ID)
+			continue;
+		if ((CGU_SB->clk_esr[id] & CGU_SB_ESR_ENABLE) &&
+			(CGU_SB_ESR_SEL_GET(CGU_SB->clk_esr[id]) ==
+			 CGU_SB_ESR_SEL_GET(esr)))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Pick the SYS fractional divider for the CIU input clock that gives the
+ * fastest card clock up to 50MHz. Only integer ratios are used, with
+ * stretching for a 50% duty cycle, as the card clock timing must stay
+ * regular at high speed. The divider is left alone if it is shared.
+ */
+static void lpc313x_mci_setup_cclk_in(void)
+{
+	CGU_FDIV_SETUP_T fdiv_cfg;
+	u32 base, cur, m;
+	unsigned long flags;
+
+	base = cgu_get_base_freq(CGU_SB_SYS_BASE_ID);
+	cur = cgu_get_clk_freq(CGU_SB_SD_MMC_CCLK_IN_ID);
+
+	/* Divided down to 50MHz the card clock is used undivided */
+	m = DIV_ROUND_UP(base, LPC313x_MCI_HS_CLOCK);
+	if (m < 2 || m > 255 ||
+		(base / m) <= lpc313x_mci_max_clock(cur))
+		return;
+
+	if (!lpc313x_mci_fdiv_private()) {
+		printk(KERN_INFO "lpc313x_mmc: MCI clock divider is shared, "
+			"keeping %uHz\n", cur);
+		return;
+	}
+
+	fdiv_cfg.stretch = 1;
+	fdiv_cfg.n = 1;
+	fdiv_cfg.m = m;
+
+	local_irq_save(flags);
+	cgu_set_subdomain_freq(CGU_SB_SD_MMC_CCLK_IN_ID, fdiv_cfg);
+	local_irq_restore(flags);
+}
+
 static int lpc313x_mci_probe(struct platform_device *pdev)
 {
 	struct lpc313x_mci		*host;
@@ -1454,13 +1961,26 @@ static int lpc313x_mci_probe(struct platform_device *pdev)
 
 #ifdef USE_DMA
 	host->dma_chn = dma_request_sg_channel("MCI",  lpc313x_mci_dma_complete, host, 1);
-	host->sg_cpu = dma_alloc_coherent(&pdev->dev, PAGE_SIZE, &host->sg_dma, GFP_KERNEL);
-	if (host->sg_cpu == NULL) {
+	host->bounce_cpu = dma_alloc_coherent(&pdev->dev,
+		LPC313x_MCI_DMA_DESCS * LPC313x_MCI_BOUNCE_SIZE,
+		&host->bounce_dma, GFP_KERNEL);
+	if (host->bounce_cpu == NULL) {
 		dev_err(&pdev->dev,
 			 "%s: could not alloc dma memory \n", __func__);
 		goto err_freemap;
 	}
+
+	/* One bounce buffer per set, the linked lists come from the
+	   shared DMA descriptor pool */
+	for (i = 0; i < LPC313x_MCI_DMA_DESCS; i++) {
+		host->dma_desc[i].bounce_cpu = host->bounce_cpu +
+			i * LPC313x_MCI_BOUNCE_SIZE;
+		host->dma_desc[i].bounce_dma = host->bounce_dma +
+			i * LPC313x_MCI_BOUNCE_SIZE;
+	}
 #endif
+	if (highspeed)
+		lpc313x_mci_setup_cclk_in();
 	host->bus_hz = cgu_get_clk_freq(CGU_SB_SD_MMC_CCLK_IN_ID); //40000000;
 
 	/* Set IOCONF to MCI pins */
@@ -1532,7 +2052,9 @@ err_init_slot:
 	free_irq(irq, host);
 err_dmaunmap:
 #ifdef USE_DMA
-	dma_free_coherent(&pdev->dev, PAGE_SIZE, host->sg_cpu, host->sg_dma);
+	dma_free_coherent(&pdev->dev,
+		LPC313x_MCI_DMA_DESCS * LPC313x_MCI_BOUNCE_SIZE,
+		host->bounce_cpu, host->bounce_dma);
 	dma_release_sg_channel(host->dma_chn);
 #endif
 err_freemap:
@@ -1570,7 +2092,9 @@ static int __exit lpc313x_mci_remove(struct platform_device *pdev)
 
 	free_irq(platform_get_irq(pdev, 0), host);
 #ifdef USE_DMA
-	dma_free_coherent(&pdev->dev, PAGE_SIZE, host->sg_cpu, host->sg_dma);
+	dma_free_coherent(&pdev->dev,
+		LPC313x_MCI_DMA_DESCS * LPC313x_MCI_BOUNCE_SIZE,
+		host->bounce_cpu, host->bounce_dma);
 	dma_release_sg_channel(host->dma_chn);
 #endif
 	iounmap(host->regs);
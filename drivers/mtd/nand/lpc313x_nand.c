@@ -34,8 +34,15 @@
 #include <linux/delay.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
 #include <linux/clk.h>
 #include <linux/cpufreq.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/cache.h>
 
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
@@ -50,6 +57,7 @@
 #include <mach/gpio.h>
 #include <mach/cgu.h>
 #include <mach/board.h>
+#include <mach/dma.h>
 
 /* Register access macros */
 #define nand_readl(reg)		__raw_readl(&NAND_##reg)
@@ -58,21 +66,128 @@
 
 #define OOB_FREE_OFFSET 4
 
-/* Enable for polling support only. Polling support will compile the
-   code without interrupts during read and write cycles. Device ready
-   status, buffer status, and ECC status are all polled. This may give
-   a slight performance improvement at the expense of CPU usage. For
-   very slow NAND devices, you wouldn't want to use polling. */
-//#define STATUS_POLLING
+/* Status wait modes. Polling gives a slight performance improvement at
+   the expense of CPU usage, for very slow NAND devices you wouldn't want
+   to use it. The hybrid mode spins for a time based on the measured
+   latency of each kind of wait and falls back to the interrupt when the
+   event takes longer. It only enables a buffer interrupt for the last
+   ECC step of a page, earlier steps are overlapped with the copy of the
+   previous step and are polled. The mode can be changed at runtime
+   through /sys/module/lpc313x_nand/parameters/wait_mode. */
+#define LPC313X_NAND_WAIT_IRQ		0
+#define LPC313X_NAND_WAIT_POLL		1
+#define LPC313X_NAND_WAIT_HYBRID	2
+
+static int wait_mode = LPC313X_NAND_WAIT_HYBRID;
+module_param(wait_mode, int, 0644);
+MODULE_PARM_DESC(wait_mode, "Status wait mode: 0 = interrupt, 1 = polling, 2 = spin then interrupt");
+
+/* Longest spin in hybrid mode, waits expected to take longer than this
+   go to sleep on the interrupt right away */
+static int spin_max_us = 60;
+module_param(spin_max_us, int, 0644);
+MODULE_PARM_DESC(spin_max_us, "Maximum spin time in hybrid wait mode (us)");
+
+/* Interrupt wait timeout, longer than any erase or program time */
+#define LPC313X_NAND_IRQ_TIMEOUT	(HZ / 2)
+
+/* Wait classes, each has its own spin time and latency histograms */
+enum {
+	LPC313X_NAND_LAT_RAM,		/* ECC step transfer through RAM0/1 */
+	LPC313X_NAND_LAT_READ,		/* Page read, tR */
+	LPC313X_NAND_LAT_PROG,		/* Page program, tPROG */
+	LPC313X_NAND_LAT_ERASE,		/* Block erase, tBERS */
+	LPC313X_NAND_LAT_CLASSES
+};
+
+/* How a wait completed */
+enum {
+	LPC313X_NAND_PATH_SPIN,
+	LPC313X_NAND_PATH_IRQ,
+	LPC313X_NAND_PATHS
+};
+
+/* How an ECC step payload was moved, for the throughput counters */
+enum {
+	LPC313X_NAND_XFER_CPU,
+	LPC313X_NAND_XFER_DMA,
+	LPC313X_NAND_XFERS
+};
+
+/* Give up on a 512 byte DMA transfer after this, and memcpy instead */
+#define LPC313X_NAND_DMA_TIMEOUT	(HZ / 10)
+
+/* Histogram buckets are powers of 2 in microseconds */
+#define LPC313X_NAND_HIST_BUCKETS	16
 
 /* Huge block support not working in 2.6.28.2 kernel, don't use this! */
 //#define HUGE_BLOCK_SUPPORT
 
+/* Move the payload part of each ECC step between SDRAM and the controller
+   RAM0/RAM1 buffers with the DMA controller instead of memcpy. Can be
+   changed at runtime through /sys/module/lpc313x_nand/parameters/use_dma.
+   Buffers that are not cache line aligned or not in the kernel linear
+   mapping (vmalloc'ed buffers from UBI, for example) always use memcpy.
+   debugfs lpc313x_nand/xfer shows the throughput of both paths. */
+static int use_dma;
+module_param(use_dma, bool, 0644);
+MODULE_PARM_DESC(use_dma, "Use DMA to transfer page data to/from the NAND controller buffers");
+
+/* Use the read cache commands (0x31/0x3F) for multi-page sequential reads
+   on large page devices. The next page is loaded into the device data
+   register while the current page is decoded and copied out of the cache
+   register. Only enable this for devices that support cache reads. */
+static int cache_read;
+module_param(cache_read, bool, 0644);
+MODULE_PARM_DESC(cache_read, "Use read cache commands for sequential page reads");
+
+/* Corrected symbol errors in one ECC step at which a read returns
+   -EUCLEAN, so UBI scrubs the block before the data becomes
+   uncorrectable. The hardware corrects up to 5 errors per step. */
+static int bitflip_threshold = 4;
+module_param(bitflip_threshold, int, 0644);
+MODULE_PARM_DESC(bitflip_threshold, "Corrected errors per ECC step at which -EUCLEAN is returned");
+
+/* Maximum number of errors the hardware corrects per ECC step */
+#define LPC313X_NAND_ECC_STRENGTH	5
+
+/* Read cache commands, not defined by the MTD layer */
+#define LPC313X_NAND_CMD_READCACHESEQ	0x31
+#define LPC313X_NAND_CMD_READCACHEEND	0x3F
+
+/* Per eraseblock ECC statistics, cleared when the block is erased */
+struct lpc313x_nand_blkstat {
+	u16 corrected;
+	u8 max_bitflips;
+	u8 failed;
+};
+
 /* Device specific MTD structure, 1 per chip select */
 struct lpc313x_nand_mtd {
 	struct mtd_info mtd;
 	struct nand_chip chip;
 	struct lpc313x_nand_info *host;
+	struct mutex read_lock;
+
+	/* ECC statistics */
+	int read_page;
+	int page_bitflips;
+	int page_failed;
+	int read_max_bitflips;
+	u32 page_hist[LPC313X_NAND_ECC_STRENGTH + 2];
+	int nr_blocks;
+	struct lpc313x_nand_blkstat *blkstats;
+	int (*nand_erase)(struct mtd_info *mtd, struct erase_info *instr);
+
+	/* Read cache pipeline state */
+	int cache_next;
+	int seq_end;
+	void (*cmdfunc)(struct mtd_info *mtd, unsigned command, int column,
+		int page_addr);
+	int (*nand_read)(struct mtd_info *mtd, loff_t from, size_t len,
+		size_t *retlen, u_char *buf);
+	int (*nand_read_oob)(struct mtd_info *mtd, loff_t from,
+		struct mtd_oob_ops *ops);
 };
 
 /* Local driver data structure */
@@ -86,6 +201,21 @@ struct lpc313x_nand_info {
 	int irq;
 	wait_queue_head_t irq_waitq;
 	volatile u32 intspending;
+	int dma_chn;
+	struct completion dma_done;
+
+	/* Average wait latencies in 1/8 us, used for the hybrid spin time */
+	u32 lat_avg8[LPC313X_NAND_LAT_CLASSES];
+	u32 lat_hist[LPC313X_NAND_LAT_CLASSES][LPC313X_NAND_PATHS]
+		[LPC313X_NAND_HIST_BUCKETS];
+
+	/* Bytes and time per direction (0 read, 1 write) and path */
+	u64 xfer_bytes[2][LPC313X_NAND_XFERS];
+	u64 xfer_ns[2][LPC313X_NAND_XFERS];
+	u32 dma_timeouts;
+#if defined (CONFIG_DEBUG_FS)
+	struct dentry *debugfs_root;
+#endif
 };
 
 /* Chip select specific ready check masks */
@@ -96,6 +226,17 @@ static const int rdymasks[4] = {
 	NAND_NANDCHECKSTS_RB4_LVL
 };
 
+/* Chip select specific ready rising edge interrupt masks */
+static const u32 rdyedgemasks[4] = {
+	NAND_NANDIRQSTATUS1_RB1_POS_EDGE,
+	NAND_NANDIRQSTATUS1_RB2_POS_EDGE,
+	NAND_NANDIRQSTATUS1_RB3_POS_EDGE,
+	NAND_NANDIRQSTATUS1_RB4_POS_EDGE
+};
+
+/* Initial latency estimates in us, per wait class */
+static const u32 lat_initial[LPC313X_NAND_LAT_CLASSES] = {20, 25, 250, 2000};
+
 /* Decode and encode buffer ECC status masks */
 static const u32 nand_buff_dec_mask[2] = {
 	NAND_NANDIRQSTATUS1_ECC_DEC_RAM0, NAND_NANDIRQSTATUS1_ECC_DEC_RAM1};
@@ -108,6 +249,10 @@ static const u32 nand_buff_wr_mask[2] = {NAND_NANDIRQSTATUS1_WR_RAM0,
 static const void *nand_buff_addr[2] = {
 	(void *) &NAND_BUFFER_ADRESS, (void *) (&NAND_BUFFER_ADRESS + 256)};
 
+/* Decode buffer physical addresses, used for DMA */
+static const u32 nand_buff_phys[2] = {
+	IO_NAND_BUF_PHYS, IO_NAND_BUF_PHYS + 0x400};
+
 /*
  *
  * OOB data placement structures for small/large/huge block FLASH
@@ -222,16 +367,50 @@ static struct nand_bbt_descr lpc313x_largepage_flashbased = {
  *
  */
 
+/* NAND controller clocks, shared with the LPC3143/54 AES driver */
+static const char *lpc313x_nand_clk_names[] = {
+	"nandflash_s0_clk",
+	"nandflash_ecc_clk",
+	"nandflash_nand_clk",
+	"nandflash_pclk",
+	/* Needed for LPC315x series only */
+	"nandflash_aes_clk",
+};
+static struct clk *lpc313x_nand_clks[ARRAY_SIZE(lpc313x_nand_clk_names)];
+
+static int lpc313x_nand_clocks_get(struct device *dev) {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nand_clk_names); i++) {
+		lpc313x_nand_clks[i] = clk_get(dev, lpc313x_nand_clk_names[i]);
+		if (IS_ERR(lpc313x_nand_clks[i])) {
+			while (--i >= 0)
+				clk_put(lpc313x_nand_clks[i]);
+			return -ENOENT;
+		}
+	}
+
+	return 0;
+}
+
+static void lpc313x_nand_clocks_put(void) {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nand_clk_names); i++)
+		clk_put(lpc313x_nand_clks[i]);
+}
+
 /* Enable or disable NAND controller clocks */
 static void lpc313x_nand_clocks_disen(int en) {
-	/* Enable or disable clocks for NAND Controller */
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_S0_CLK_ID, en);
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_ECC_CLK_ID, en);
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_NAND_CLK_ID, en);
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_PCLK_ID, en);
+	int i;
 
-	/* Needed for LPC315x series only */
-	cgu_clk_en_dis(CGU_SB_NANDFLASH_AES_CLK_ID, en);
+	/* Enable or disable clocks for NAND Controller */
+	for (i = 0; i < ARRAY_SIZE(lpc313x_nand_clk_names); i++) {
+		if (en)
+			clk_enable(lpc313x_nand_clks[i]);
+		else
+			clk_disable(lpc313x_nand_clks[i]);
+	}
 }
 
 /*
@@ -327,22 +506,18 @@ static int lpc313x_nand_inithw(struct lpc313x_nand_info *host) {
  * Enable NAND interrupts
  */
 static inline void lpc313x_nand_int_en(u32 mask) {
-#if !defined(STATUS_POLLING)
 	u32 tmp = nand_readl(IRQMASK1) & ~mask;
 
 	nand_writel(IRQMASK1, tmp);
-#endif
 }
 
 /*
  * Disable NAND interrupts
  */
 static inline void lpc313x_nand_int_dis(u32 mask) {
-#if !defined(STATUS_POLLING)
 	u32 tmp = nand_readl(IRQMASK1) | mask;
 
 	nand_writel(IRQMASK1, tmp);
-#endif
 }
 
 /*
@@ -367,10 +542,82 @@ static inline u32 lpc313x_nand_raw_get(void) {
 }
 
 /*
- * Wait for NAND event
+ * Wait for a NAND event with the interrupt, returns 0 on timeout
+ */
+static inline int lpc313x_wait_irq(struct lpc313x_nand_info *host, u32 mask) {
+	int ret;
+
+	host->intspending = 0;
+	lpc313x_nand_int_en(mask);
+	ret = wait_event_timeout(host->irq_waitq, host->intspending,
+		LPC313X_NAND_IRQ_TIMEOUT);
+	lpc313x_nand_int_dis(mask);
+
+	return ret;
+}
+
+/*
+ * Wait for one of the events in mask to show up in the raw status. The
+ * latency is added to the histograms and to the average for lat_class.
+ */
+static void lpc313x_nand_wait_event(struct lpc313x_nand_info *host,
+				    u32 mask, int lat_class, int mode) {
+	ktime_t start = ktime_get();
+	s64 spin_us = 0;
+	u32 lat, bucket;
+	int path = LPC313X_NAND_PATH_SPIN;
+
+	if (mode == LPC313X_NAND_WAIT_HYBRID) {
+		/* Spin a bit longer than the average, unless the event is
+		   expected to take too long to be worth spinning for */
+		spin_us = host->lat_avg8[lat_class] >> 3;
+		spin_us += spin_us >> 2;
+		if (spin_us > spin_max_us)
+			spin_us = 0;
+
+		mode = LPC313X_NAND_WAIT_IRQ;
+		while (spin_us) {
+			if (lpc313x_nand_raw_get() & mask) {
+				mode = LPC313X_NAND_WAIT_HYBRID;
+				break;
+			}
+			if (ktime_us_delta(ktime_get(), start) >= spin_us)
+				break;
+			cpu_relax();
+		}
+	}
+
+	if (mode == LPC313X_NAND_WAIT_POLL) {
+		while (!(lpc313x_nand_raw_get() & mask))
+			cpu_relax();
+	}
+	else if (mode == LPC313X_NAND_WAIT_IRQ) {
+		path = LPC313X_NAND_PATH_IRQ;
+		if (!lpc313x_wait_irq(host, mask))
+			dev_dbg(host->dev, "Timeout waiting for 0x%08x\n", mask);
+	}
+
+	/* Update the average and the histogram */
+	lat = (u32) ktime_us_delta(ktime_get(), start);
+	host->lat_avg8[lat_class] += lat - (host->lat_avg8[lat_class] >> 3);
+	bucket = fls(lat);
+	if (bucket >= LPC313X_NAND_HIST_BUCKETS)
+		bucket = LPC313X_NAND_HIST_BUCKETS - 1;
+	host->lat_hist[lat_class][path][bucket]++;
+}
+
+/*
+ * Wait for a RAM0/RAM1 buffer event. In hybrid mode only the last ECC
+ * step of a page may use the interrupt.
  */
-static inline void lpc313x_wait_irq(struct lpc313x_nand_info *host) {
-	wait_event(host->irq_waitq, host->intspending);
+static inline void lpc313x_nand_wait_ram(struct lpc313x_nand_info *host,
+					 u32 mask, int last) {
+	int mode = wait_mode;
+
+	if ((mode == LPC313X_NAND_WAIT_HYBRID) && !last)
+		mode = LPC313X_NAND_WAIT_POLL;
+
+	lpc313x_nand_wait_event(host, mask, LPC313X_NAND_LAT_RAM, mode);
 }
 
 /*
@@ -391,6 +638,221 @@ static irqreturn_t lpc313x_nandc_irq(int irq, void *dev_id)
 	return IRQ_HANDLED;
 }
 
+#if defined (CONFIG_DEBUG_FS)
+/*
+ * Show the wait latency histograms, one line per wait class and
+ * completion path
+ */
+static int lpc313x_nand_latency_show(struct seq_file *s, void *v)
+{
+	struct lpc313x_nand_info *host = s->private;
+	static const char *lat_names[] = {"ram", "read", "prog", "erase"};
+	static const char *modes[] = {"irq", "poll", "hybrid"};
+	static const char *paths[] = {"spin", "irq"};
+	char label[8];
+	int c, p, b;
+
+	seq_printf(s, "mode: %s spin_max_us: %d\n",
+		((wait_mode >= 0) && (wait_mode <= 2)) ? modes[wait_mode] : "?",
+		spin_max_us);
+
+	/* Bucket n holds latencies of 2^(n-1) to 2^n - 1 us */
+	seq_printf(s, "%-6s %-5s %6s", "class", "path", "avg");
+	for (b = 0; b < LPC313X_NAND_HIST_BUCKETS - 1; b++) {
+		snprintf(label, sizeof(label), "<%u", 1 << b);
+		seq_printf(s, " %7s", label);
+	}
+	snprintf(label, sizeof(label), ">=%u", 1 << (b - 1));
+	seq_printf(s, " %7s\n", label);
+
+	for (c = 0; c < LPC313X_NAND_LAT_CLASSES; c++) {
+		for (p = 0; p < LPC313X_NAND_PATHS; p++) {
+			seq_printf(s, "%-6s %-5s %6u", lat_names[c], paths[p],
+				host->lat_avg8[c] >> 3);
+			for (b = 0; b < LPC313X_NAND_HIST_BUCKETS; b++)
+				seq_printf(s, " %7u", host->lat_hist[c][p][b]);
+			seq_printf(s, "\n");
+		}
+	}
+
+	return 0;
+}
+
+static int lpc313x_nand_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lpc313x_nand_latency_show, inode->i_private);
+}
+
+/*
+ * Any write clears the histograms
+ */
+static ssize_t lpc313x_nand_latency_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct lpc313x_nand_info *host = s->private;
+
+	memset(host->lat_hist, 0, sizeof(host->lat_hist));
+
+	return count;
+}
+
+static const struct file_operations lpc313x_nand_latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lpc313x_nand_latency_open,
+	.read		= seq_read,
+	.write		= lpc313x_nand_latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Show the ECC step transfer throughput of the memcpy and DMA paths, in
+ * KiB/s of time spent moving the data. Both include the OOB copy.
+ */
+static int lpc313x_nand_xfer_show(struct seq_file *s, void *v)
+{
+	struct lpc313x_nand_info *host = s->private;
+	static const char *dirs[] = {"read", "write"};
+	static const char *paths[] = {"cpu", "dma"};
+	u64 us, kbps;
+	int d, p;
+
+	seq_printf(s, "use_dma: %d dma_timeouts: %u\n", use_dma,
+		host->dma_timeouts);
+	seq_printf(s, "%-5s %-4s %12s %12s %8s\n", "dir", "path", "bytes",
+		"us", "KiB/s");
+
+	for (d = 0; d < 2; d++) {
+		for (p = 0; p < LPC313X_NAND_XFERS; p++) {
+			us = div_u64(host->xfer_ns[d][p], 1000);
+			kbps = 0;
+			if (us)
+				kbps = div64_u64(host->xfer_bytes[d][p] *
+					1000000, us) >> 10;
+			seq_printf(s, "%-5s %-4s %12llu %12llu %8llu\n",
+				dirs[d], paths[p],
+				(unsigned long long) host->xfer_bytes[d][p],
+				(unsigned long long) us,
+				(unsigned long long) kbps);
+		}
+	}
+
+	return 0;
+}
+
+static int lpc313x_nand_xfer_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lpc313x_nand_xfer_show, inode->i_private);
+}
+
+/*
+ * Any write clears the counters
+ */
+static ssize_t lpc313x_nand_xfer_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct lpc313x_nand_info *host = s->private;
+
+	memset(host->xfer_bytes, 0, sizeof(host->xfer_bytes));
+	memset(host->xfer_ns, 0, sizeof(host->xfer_ns));
+	host->dma_timeouts = 0;
+
+	return count;
+}
+
+static const struct file_operations lpc313x_nand_xfer_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lpc313x_nand_xfer_open,
+	.read		= seq_read,
+	.write		= lpc313x_nand_xfer_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * Show the ECC statistics of one device, the per-page maximum error
+ * histogram and the blocks with corrected or failed reads since their
+ * last erase
+ */
+static int lpc313x_nand_ecc_show(struct seq_file *s, void *v)
+{
+	struct lpc313x_nand_mtd *nmtd = s->private;
+	struct lpc313x_nand_blkstat *bs;
+	int i;
+
+	seq_printf(s, "threshold: %d corrected: %u failed: %u\n",
+		bitflip_threshold, nmtd->mtd.ecc_stats.corrected,
+		nmtd->mtd.ecc_stats.failed);
+
+	seq_printf(s, "pages by max errors per step:");
+	for (i = 0; i <= LPC313X_NAND_ECC_STRENGTH; i++)
+		seq_printf(s, " %d:%u", i, nmtd->page_hist[i]);
+	seq_printf(s, " failed:%u\n",
+		nmtd->page_hist[LPC313X_NAND_ECC_STRENGTH + 1]);
+
+	if (nmtd->blkstats == NULL)
+		return 0;
+
+	seq_printf(s, "block corrected max failed\n");
+	for (i = 0; i < nmtd->nr_blocks; i++) {
+		bs = &nmtd->blkstats[i];
+		if (bs->corrected || bs->failed)
+			seq_printf(s, "%5d %9u %3u %6u\n", i, bs->corrected,
+				bs->max_bitflips, bs->failed);
+	}
+
+	return 0;
+}
+
+static int lpc313x_nand_ecc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lpc313x_nand_ecc_show, inode->i_private);
+}
+
+static const struct file_operations lpc313x_nand_ecc_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lpc313x_nand_ecc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void lpc313x_nand_ecc_debugfs(struct lpc313x_nand_info *host,
+				     struct lpc313x_nand_mtd *nmtd, int cs)
+{
+	char name[8];
+
+	if (host->debugfs_root == NULL)
+		return;
+
+	snprintf(name, sizeof(name), "ecc%d", cs);
+	if (!debugfs_create_file(name, S_IRUSR, host->debugfs_root, nmtd,
+		&lpc313x_nand_ecc_fops))
+		dev_err(host->dev, "failed to initialize debugfs\n");
+}
+
+static void lpc313x_nand_init_debugfs(struct lpc313x_nand_info *host)
+{
+	struct dentry *node;
+
+	host->debugfs_root = debugfs_create_dir("lpc313x_nand", NULL);
+	if (IS_ERR(host->debugfs_root) || !host->debugfs_root) {
+		host->debugfs_root = NULL;
+		return;
+	}
+
+	node = debugfs_create_file("latency", S_IRUSR | S_IWUSR,
+		host->debugfs_root, host, &lpc313x_nand_latency_fops);
+	if (node)
+		node = debugfs_create_file("xfer", S_IRUSR | S_IWUSR,
+			host->debugfs_root, host, &lpc313x_nand_xfer_fops);
+	if (!node)
+		dev_err(host->dev, "failed to initialize debugfs\n");
+}
+#endif
+
 /*
  * Start a RAM read operation on RAM0 or RAM1
  */
@@ -403,8 +865,6 @@ static inline void lpc313x_ram_read(int bufnum) {
 		/* Use RAM buffer 1 */
 		nand_writel(CONTROLFLOW, NAND_CTRL_RD_RAM1);
 	}
-
-	lpc313x_nand_int_en(nand_buff_dec_mask[bufnum]);
 }
 
 /*
@@ -419,8 +879,133 @@ static inline void lpc313x_ram_write(int bufnum) {
 		/* Use RAM buffer 1 */
 		nand_writel(CONTROLFLOW, NAND_CTRL_WR_RAM1);
 	}
+}
+
+/*
+ * Handle the DMA channel interrupt
+ */
+static void lpc313x_nand_dma_irq(int chn, dma_irq_type_t type, void *handle)
+{
+	struct lpc313x_nand_info *host = (struct lpc313x_nand_info *) handle;
+
+	if ((type == DMA_IRQ_FINISHED) || (type == DMA_IRQ_DMAABORT))
+		complete(&host->dma_done);
+}
+
+/*
+ * Check if a page buffer can be transferred with DMA. The buffer is a
+ * whole number of 512 byte steps, so if it starts on a cache line it
+ * doesn't share a line with anything else, and the invalidate done by
+ * dma_map_single() for reads can't throw away a neighbour's data.
+ */
+static inline int lpc313x_nand_dma_ok(struct lpc313x_nand_info *host,
+				      const void *buf) {
+	return use_dma && (host->dma_chn >= 0) && virt_addr_valid(buf) &&
+		!((unsigned long) buf & (L1_CACHE_BYTES - 1));
+}
+
+/*
+ * Start a DMA transfer of len bytes, len must be a multiple of 16
+ */
+static void lpc313x_nand_dma_start(struct lpc313x_nand_info *host,
+				   u32 src, u32 dst, int len) {
+	dma_setup_t dmasetup;
+
+	dmasetup.src_address = src;
+	dmasetup.dest_address = dst;
+	dmasetup.trans_length = (len / 16) - 1;
+	dmasetup.cfg = DMA_CFG_TX_BURST;
+
+	INIT_COMPLETION(host->dma_done);
+	dma_prog_channel(host->dma_chn, &dmasetup);
+	dma_start_channel(host->dma_chn);
+}
+
+/*
+ * Wait for the payload DMA. If it never finishes the channel is stopped
+ * and the caller moves the step with memcpy instead.
+ */
+static int lpc313x_nand_dma_wait(struct lpc313x_nand_info *host) {
+	if (wait_for_completion_timeout(&host->dma_done,
+		LPC313X_NAND_DMA_TIMEOUT))
+		return 0;
+
+	dma_stop_channel(host->dma_chn);
+	host->dma_timeouts++;
+	if (printk_ratelimit())
+		dev_warn(host->dev, "DMA timeout, using memcpy\n");
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Account one ECC step to the throughput counters
+ */
+static inline void lpc313x_nand_xfer_account(struct lpc313x_nand_info *host,
+	int dir, int path, ktime_t start, int len) {
+	host->xfer_bytes[dir][path] += len;
+	host->xfer_ns[dir][path] += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * Copy one ECC step out of RAM0 or RAM1. With DMA, the OOB bytes are
+ * copied by the CPU while the payload is transferring.
+ */
+static void lpc313x_nand_ram_copyout(struct lpc313x_nand_info *host,
+	int bufnum, uint8_t *p, dma_addr_t dmabuf, uint8_t *oob, int eccsize,
+	int eccbytes) {
+	ktime_t start = ktime_get();
+
+	if (dmabuf) {
+		lpc313x_nand_dma_start(host, nand_buff_phys[bufnum], dmabuf,
+			eccsize);
+		memcpy((void *)oob, nand_buff_addr[bufnum] + eccsize, eccbytes);
+		if (!lpc313x_nand_dma_wait(host)) {
+			lpc313x_nand_xfer_account(host, 0,
+				LPC313X_NAND_XFER_DMA, start, eccsize);
+			return;
+		}
+
+		/* The step is still mapped for the device */
+		dma_sync_single_for_cpu(host->dev, dmabuf, eccsize,
+			DMA_FROM_DEVICE);
+		memcpy((void *)p, nand_buff_addr[bufnum], eccsize);
+		return;
+	}
+
+	memcpy((void *)p, nand_buff_addr[bufnum], eccsize);
+	memcpy((void *)oob, nand_buff_addr[bufnum] + eccsize, eccbytes);
+	lpc313x_nand_xfer_account(host, 0, LPC313X_NAND_XFER_CPU, start,
+		eccsize);
+}
+
+/*
+ * Copy one ECC step into RAM0 or RAM1. The OOB bytes must be written
+ * after the payload, as the last write starts the ECC encoder.
+ */
+static void lpc313x_nand_ram_copyin(struct lpc313x_nand_info *host,
+	int bufnum, const uint8_t *p, dma_addr_t dmabuf, const uint8_t *oob,
+	int eccsize) {
+	ktime_t start = ktime_get();
+	int path = LPC313X_NAND_XFER_CPU;
+
+	if (dmabuf) {
+		lpc313x_nand_dma_start(host, dmabuf, nand_buff_phys[bufnum],
+			eccsize);
+		if (!lpc313x_nand_dma_wait(host))
+			path = LPC313X_NAND_XFER_DMA;
+		else
+			memcpy((void *) nand_buff_addr[bufnum], p, eccsize);
+	}
+	else {
+		memcpy((void *) nand_buff_addr[bufnum], p, eccsize);
+	}
 
-	lpc313x_nand_int_en(nand_buff_wr_mask[bufnum]);
+	memcpy((void *) nand_buff_addr[bufnum] + eccsize, oob, OOB_FREE_OFFSET);
+
+	/* Timed out steps only count as timeouts */
+	if (!dmabuf || (path == LPC313X_NAND_XFER_DMA))
+		lpc313x_nand_xfer_account(host, 1, path, start, eccsize);
 }
 
 /*
@@ -429,6 +1014,174 @@ static inline void lpc313x_ram_write(int bufnum) {
  *
  */
 
+/*
+ * Issue a read cache command and wait for the cache register to be loaded
+ */
+static void lpc313x_nand_cache_cmd(struct mtd_info *mtd, int cmd) {
+	struct nand_chip *chip = mtd->priv;
+
+	chip->cmd_ctrl(mtd, cmd, NAND_NCE | NAND_CLE | NAND_CTRL_CHANGE);
+	chip->cmd_ctrl(mtd, NAND_CMD_NONE, NAND_NCE | NAND_CTRL_CHANGE);
+	ndelay(100);
+	nand_wait_ready(mtd);
+}
+
+/*
+ * Terminate an active read cache sequence
+ */
+static void lpc313x_nand_cache_end(struct mtd_info *mtd) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+
+	if (nmtd->cache_next >= 0) {
+		lpc313x_nand_cache_cmd(mtd, LPC313X_NAND_CMD_READCACHEEND);
+		nmtd->cache_next = -1;
+	}
+}
+
+/*
+ * Check if the page after page_addr should be loaded ahead. Prefetch
+ * stops at the end of the current read request and at block boundaries.
+ */
+static inline int lpc313x_nand_cache_more(struct mtd_info *mtd, int page_addr) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+	int blkmask = (1 << (chip->phys_erase_shift - chip->page_shift)) - 1;
+
+	return cache_read && (mtd->writesize > 512) &&
+		((page_addr + 1) < nmtd->seq_end) && ((page_addr + 1) & blkmask);
+}
+
+/*
+ * Command function wrapper (callback). Records the page being read for
+ * the ECC statistics. On large page devices with read cache support,
+ * page reads at column 0 are turned into a read cache sequence while a
+ * multi-page read is in progress, any other command ends the sequence
+ * first.
+ */
+static void lpc313x_nand_command(struct mtd_info *mtd, unsigned int command,
+				 int column, int page_addr) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+
+	if ((command == NAND_CMD_READ0) && (page_addr != -1))
+		nmtd->read_page = page_addr;
+
+	if ((command == NAND_CMD_READ0) && (column == 0) &&
+		(chip->state == FL_READING)) {
+		if (page_addr == nmtd->cache_next) {
+			/* Page is already in (or loading into) the data
+			   register, move it to the cache register */
+			if (lpc313x_nand_cache_more(mtd, page_addr)) {
+				lpc313x_nand_cache_cmd(mtd,
+					LPC313X_NAND_CMD_READCACHESEQ);
+				nmtd->cache_next = page_addr + 1;
+			}
+			else {
+				lpc313x_nand_cache_cmd(mtd,
+					LPC313X_NAND_CMD_READCACHEEND);
+				nmtd->cache_next = -1;
+			}
+
+			return;
+		}
+
+		/* Out of sequence, start over with a normal page read */
+		lpc313x_nand_cache_end(mtd);
+		nmtd->cmdfunc(mtd, command, column, page_addr);
+
+		/* Start loading the next page while this one is read out */
+		if (lpc313x_nand_cache_more(mtd, page_addr)) {
+			lpc313x_nand_cache_cmd(mtd, LPC313X_NAND_CMD_READCACHESEQ);
+			nmtd->cache_next = page_addr + 1;
+		}
+
+		return;
+	}
+
+	lpc313x_nand_cache_end(mtd);
+	nmtd->cmdfunc(mtd, command, column, page_addr);
+}
+
+/*
+ * MTD read wrapper, records the extent of the read for the read cache
+ * pipeline. Corrected errors only return -EUCLEAN when a step of the
+ * read reached bitflip_threshold.
+ */
+static int lpc313x_nand_read(struct mtd_info *mtd, loff_t from, size_t len,
+			     size_t *retlen, u_char *buf) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+	int ret;
+
+	mutex_lock(&nmtd->read_lock);
+
+	nmtd->seq_end = (int) ((from + len + mtd->writesize - 1) >>
+		chip->page_shift);
+	nmtd->read_max_bitflips = 0;
+
+	ret = nmtd->nand_read(mtd, from, len, retlen, buf);
+	if ((ret == -EUCLEAN) &&
+		(nmtd->read_max_bitflips < bitflip_threshold))
+		ret = 0;
+
+	mutex_unlock(&nmtd->read_lock);
+
+	return ret;
+}
+
+/*
+ * MTD read_oob wrapper. With a data buffer this reads pages just like
+ * lpc313x_nand_read() and gets the same treatment; OOB only reads never
+ * run the read cache pipeline.
+ */
+static int lpc313x_nand_read_oob(struct mtd_info *mtd, loff_t from,
+				 struct mtd_oob_ops *ops) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+	int ret;
+
+	mutex_lock(&nmtd->read_lock);
+
+	if (ops->datbuf)
+		nmtd->seq_end = (int) ((from + ops->len + mtd->writesize - 1) >>
+			chip->page_shift);
+	else
+		nmtd->seq_end = 0;
+	nmtd->read_max_bitflips = 0;
+
+	ret = nmtd->nand_read_oob(mtd, from, ops);
+	if ((ret == -EUCLEAN) &&
+		(nmtd->read_max_bitflips < bitflip_threshold))
+		ret = 0;
+
+	mutex_unlock(&nmtd->read_lock);
+
+	return ret;
+}
+
+/*
+ * MTD erase wrapper, clears the ECC statistics of erased blocks
+ */
+static int lpc313x_nand_erase(struct mtd_info *mtd, struct erase_info *instr) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+	int ret, first, last;
+
+	ret = nmtd->nand_erase(mtd, instr);
+	if ((ret == 0) && (nmtd->blkstats != NULL) && instr->len) {
+		first = instr->addr >> chip->phys_erase_shift;
+		last = (instr->addr + instr->len - 1) >> chip->phys_erase_shift;
+		if (last >= nmtd->nr_blocks)
+			last = nmtd->nr_blocks - 1;
+		if (first <= last)
+			memset(&nmtd->blkstats[first], 0,
+				(last - first + 1) * sizeof(*nmtd->blkstats));
+	}
+
+	return ret;
+}
+
 /*
  * Asserts and deasserts chip selects (callback)
  */
@@ -442,6 +1195,9 @@ static void lpc313x_nand_select_chip(struct mtd_info *mtd, int chip_sel) {
 	host = nmtd->host;
 
 	if (chip_sel == -1) {
+		/* Finish any read cache sequence before the chip is released */
+		lpc313x_nand_cache_end(mtd);
+
 		/* De-assert all the chip selects */
 		nand_writel(SETCE, NAND_NANDSETCE_CV_MASK);
 	}
@@ -485,18 +1241,49 @@ static void lpc313x_nand_hwcontrol(struct mtd_info *mtd, int cmd, unsigned int c
 }
 
 /*
- * Returns NAND busy(0)/ready(!0) status callback
+ * Returns NAND busy(0)/ready(!0) status callback. If the device is busy
+ * with a read, program or erase, the ready rising edge is waited for here
+ * as selected by wait_mode instead of returning to the polling loop in
+ * the MTD layer.
  */
-
 static int lpc313x_nand_devready(struct mtd_info *mtd) {
 	struct nand_chip *chip = mtd->priv;
 	struct lpc313x_nand_mtd *nmtd;
 	struct lpc313x_nand_info *host;
+	u32 rdymask, edgemask;
+	int lat_class;
 
 	nmtd = chip->priv;
 	host = nmtd->host;
+	rdymask = rdymasks[host->current_cs];
+	edgemask = rdyedgemasks[host->current_cs];
+
+	if ((nand_readl(CHECKSTS) & rdymask) ||
+		(wait_mode == LPC313X_NAND_WAIT_POLL) || in_interrupt() ||
+		oops_in_progress)
+		return nand_readl(CHECKSTS) & rdymask;
+
+	switch (chip->state) {
+	case FL_READING:
+		lat_class = LPC313X_NAND_LAT_READ;
+		break;
+	case FL_WRITING:
+		lat_class = LPC313X_NAND_LAT_PROG;
+		break;
+	case FL_ERASING:
+		lat_class = LPC313X_NAND_LAT_ERASE;
+		break;
+	default:
+		return 0;
+	}
+
+	/* The rising edge can't be missed, the device was still busy
+	   after the edge status was cleared */
+	lpc313x_nand_int_clear(edgemask);
+	if (!(nand_readl(CHECKSTS) & rdymask))
+		lpc313x_nand_wait_event(host, edgemask, lat_class, wait_mode);
 
-	return nand_readl(CHECKSTS) & rdymasks[host->current_cs];
+	return nand_readl(CHECKSTS) & rdymask;
 }
 
 /*
@@ -515,21 +1302,33 @@ static void lpc313x_nand_enable_hwecc(struct mtd_info *mtd, int mode) {
 static int lpc313x_nand_correct_data(struct mtd_info *mtd, u_char *dat,
 				     u_char *read_ecc, u_char *calc_ecc)
 {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_mtd *nmtd = chip->priv;
+	const u8 *ram;
 	u32 tmp;
 	int errs_corrected = 0;
 
-	(void) mtd;
 	(void) dat;
+	(void) read_ecc;
 	(void) calc_ecc;
 
-	/* Data is corrected in hardware, just verify that data is correct per HW */
-	if ((nand_readl(IRQSTATUSRAW1) & NAND_NANDIRQSTATUS1_ERR_UNR_RAM0) &
-		(read_ecc[OOB_FREE_OFFSET] != 0xFF)) {
-		return -1;
+	/* Data is corrected in hardware, just verify that data is correct
+	   per HW. An erased step also fails to decode, it is told apart by
+	   its free OOB bytes still in the RAM buffer. */
+	tmp = lpc313x_nand_raw_get();
+	if (tmp & (NAND_NANDIRQSTATUS1_ERR_UNR_RAM0 |
+		NAND_NANDIRQSTATUS1_ERR_UNR_RAM1)) {
+		ram = nand_buff_addr[(tmp & NAND_NANDIRQSTATUS1_ERR_UNR_RAM0) ?
+			0 : 1];
+		if (ram[chip->ecc.size + OOB_FREE_OFFSET] == 0xFF)
+			return 0;
+
+		mtd->ecc_stats.failed++;
+		nmtd->page_failed = 1;
+		return -EBADMSG;
 	}
 
 	/* Generate correction statistics */
-	tmp = lpc313x_nand_raw_get();
 	if (!(tmp & (NAND_NANDIRQSTATUS1_NOERR_RAM0 | NAND_NANDIRQSTATUS1_NOERR_RAM1))) {
 		if (tmp & (NAND_NANDIRQSTATUS1_ERR1_RAM0 | NAND_NANDIRQSTATUS1_ERR1_RAM1)) {
 			errs_corrected = 1;
@@ -548,12 +1347,13 @@ static int lpc313x_nand_correct_data(struct mtd_info *mtd, u_char *dat,
 		}
 
 		mtd->ecc_stats.corrected += errs_corrected;
-	}
-	else if (tmp & (NAND_NANDIRQSTATUS1_ERR_UNR_RAM0 | NAND_NANDIRQSTATUS1_ERR_UNR_RAM1)) {
-		mtd->ecc_stats.failed++;
+
+		/* Keep the worst step of the page */
+		if (errs_corrected > nmtd->page_bitflips)
+			nmtd->page_bitflips = errs_corrected;
 	}
 
-	return 0;
+	return errs_corrected;
 }
 
 /*
@@ -588,9 +1388,6 @@ static int lpc313x_nand_verify_hwecc(struct mtd_info *mtd, const uint8_t *buf, i
 		lpc313x_nand_int_clear(~0);
 
 		/* Start read into RAM0 or RAM1 */
-#if !defined(STATUS_POLLING)
-		host->intspending = 0;
-#endif
 		lpc313x_ram_read(curbuf);
 
 		/* Compare current buffer while next buffer is loading */
@@ -602,14 +1399,9 @@ static int lpc313x_nand_verify_hwecc(struct mtd_info *mtd, const uint8_t *buf, i
 			buf += chip->ecc.size;
 		}
 
-#if defined(STATUS_POLLING)
-		/* Polling for buffer loaded and decoded */
-		while (!((nand_readl(IRQSTATUSRAW1)) & nand_buff_dec_mask[curbuf]));
-
-#else
-		/* Interrupt based wait operation */
-		lpc313x_wait_irq(host);
-#endif
+		/* Wait for buffer loaded and decoded */
+		lpc313x_nand_wait_ram(host, nand_buff_dec_mask[curbuf],
+			(i + chip->ecc.size) >= len);
 
 		bufrdy = curbuf;
 		curbuf = 1 - curbuf;
@@ -666,6 +1458,40 @@ static void lpc313x_nand_write_buf16(struct mtd_info *mtd, const u_char *buf,
 	__raw_writesw(chip->IO_ADDR_W, buf, len);
 }
 
+/*
+ * Add the ECC results of the page just read to the statistics
+ */
+static void lpc313x_nand_ecc_account(struct mtd_info *mtd,
+				     struct lpc313x_nand_mtd *nmtd) {
+	struct nand_chip *chip = mtd->priv;
+	struct lpc313x_nand_blkstat *bs;
+	int blk;
+
+	if (nmtd->page_bitflips > nmtd->read_max_bitflips)
+		nmtd->read_max_bitflips = nmtd->page_bitflips;
+
+	if (nmtd->page_failed)
+		nmtd->page_hist[LPC313X_NAND_ECC_STRENGTH + 1]++;
+	else
+		nmtd->page_hist[nmtd->page_bitflips]++;
+
+	if (!nmtd->page_bitflips && !nmtd->page_failed)
+		return;
+	if ((nmtd->blkstats == NULL) || (nmtd->read_page < 0))
+		return;
+
+	blk = nmtd->read_page >> (chip->phys_erase_shift - chip->page_shift);
+	if (blk >= nmtd->nr_blocks)
+		return;
+
+	bs = &nmtd->blkstats[blk];
+	bs->corrected = min_t(u32, bs->corrected + nmtd->page_bitflips, 0xFFFF);
+	if (nmtd->page_bitflips > bs->max_bitflips)
+		bs->max_bitflips = nmtd->page_bitflips;
+	if (nmtd->page_failed && (bs->failed < 0xFF))
+		bs->failed++;
+}
+
 /*
  * Read the payload and OOB data from the device in the hardware storage format
  */
@@ -675,63 +1501,77 @@ static int lpc313x_nand_read_page_syndrome(struct mtd_info *mtd, struct nand_chi
 	int i, curbuf = 0, bufrdy = -1, eccsize = chip->ecc.size;
 	int eccbytes = chip->ecc.bytes;
 	int eccsteps = chip->ecc.steps;
+	int ret = 0;
 	uint8_t *p = buf;
 	uint8_t *oob = chip->oob_poi;
-
-#if !defined(STATUS_POLLING)
 	struct lpc313x_nand_mtd *nmtd;
 	struct lpc313x_nand_info *host;
+	dma_addr_t dmabuf = 0, dmap = 0;
 
 	nmtd = chip->priv;
 	host = nmtd->host;
-#endif
+	nmtd->page_bitflips = 0;
+	nmtd->page_failed = 0;
+
+	if (lpc313x_nand_dma_ok(host, buf)) {
+		dmabuf = dma_map_single(host->dev, buf, eccsize * eccsteps,
+			DMA_FROM_DEVICE);
+		dmap = dmabuf;
+	}
 
 	for (i = eccsteps; i > 0; i--) {
 		/* Clear all current statuses */
 		lpc313x_nand_int_clear(~0);
 
 		/* Start read into RAM0 or RAM1 */
-#if !defined(STATUS_POLLING)
-		host->intspending = 0;
-#endif
 		lpc313x_ram_read(curbuf);
 
 		/* Read current buffer while next buffer is loading */
 		if (bufrdy >= 0) {
-
-			/* Read payload portion of the transfer */
-			memcpy((void *)p, nand_buff_addr[bufrdy], eccsize);
+			/* Read payload and OOB data portions of the transfer */
+			lpc313x_nand_ram_copyout(host, bufrdy, p, dmap, oob,
+				eccsize, eccbytes);
 			p += eccsize;
-
-			/* Read OOB data portion of the transfer */
-			memcpy((void *)oob, nand_buff_addr[bufrdy] + eccsize, eccbytes);
 			oob += eccbytes;
+			if (dmap)
+				dmap += eccsize;
 		}
 
-#if defined(STATUS_POLLING)
-		/* Polling for buffer loaded and decoded */
-		while (!((nand_readl(IRQSTATUSRAW1)) & nand_buff_dec_mask[curbuf]));
-
-#else
-		/* Interrupt based wait operation */
-		lpc313x_wait_irq(host);
-#endif
+		/* Wait for buffer loaded and decoded */
+		lpc313x_nand_wait_ram(host, nand_buff_dec_mask[curbuf], (i == 1));
 
 		bufrdy = curbuf;
 		curbuf = 1 - curbuf;
 
-		chip->ecc.correct(mtd, p, oob, NULL);
+		/* Keep going on a failed step, the pipeline must be drained */
+		if (chip->ecc.correct(mtd, p, oob, NULL) < 0)
+			ret = -EBADMSG;
 	}
 
-	/* Read payload portion of the transfer */
-	memcpy((void *)p, nand_buff_addr[bufrdy], eccsize);
+	/* Read payload and OOB data portions of the transfer */
+	lpc313x_nand_ram_copyout(host, bufrdy, p, dmap, oob, eccsize, eccbytes);
 
-	/* Read OOB data portion of the transfer */
-	memcpy((void *)oob, nand_buff_addr[bufrdy] + eccsize, eccbytes);
+	if (dmabuf)
+		dma_unmap_single(host->dev, dmabuf, eccsize * eccsteps,
+			DMA_FROM_DEVICE);
 
 	/* Disable all interrupts */
 	lpc313x_nand_int_dis(~0);
 
+	lpc313x_nand_ecc_account(mtd, nmtd);
+
+	return ret;
+}
+
+/*
+ * Raw page reads go through the same path, but hand back uncorrectable
+ * pages as they are
+ */
+static int lpc313x_nand_read_page_raw_syndrome(struct mtd_info *mtd,
+				   struct nand_chip *chip, uint8_t *buf)
+{
+	lpc313x_nand_read_page_syndrome(mtd, chip, buf);
+
 	return 0;
 }
 
@@ -783,23 +1623,28 @@ static void lpc313x_nand_write_page_syndrome(struct mtd_info *mtd,
 	int eccsteps = chip->ecc.steps;
 	const uint8_t *p = buf;
 	uint8_t *oob = chip->oob_poi;
-
-#if !defined(STATUS_POLLING)
 	struct lpc313x_nand_mtd *nmtd;
 	struct lpc313x_nand_info *host;
+	dma_addr_t dmabuf = 0, dmap = 0;
 
 	nmtd = chip->priv;
 	host = nmtd->host;
-#endif
+
+	if (lpc313x_nand_dma_ok(host, buf)) {
+		dmabuf = dma_map_single(host->dev, (void *) buf,
+			eccsize * eccsteps, DMA_TO_DEVICE);
+		dmap = dmabuf;
+	}
 
 	/* Clear all current statuses */
 	lpc313x_nand_int_clear(~0);
 
 	/* Copy payload and OOB data to the buffer */
-	memcpy((void *) nand_buff_addr[bufrdy], p, eccsize);
-	memcpy((void *) nand_buff_addr[bufrdy] + eccsize, oob, OOB_FREE_OFFSET);
+	lpc313x_nand_ram_copyin(host, bufrdy, p, dmap, oob, eccsize);
 	p += eccsize;
 	oob += eccbytes;
+	if (dmap)
+		dmap += eccsize;
 	while(!((nand_readl(IRQSTATUSRAW1)) & nand_buff_enc_mask[bufrdy]));
 
 	for (i = eccsteps; i > 0; i--) {
@@ -809,31 +1654,28 @@ static void lpc313x_nand_write_page_syndrome(struct mtd_info *mtd,
 
 		/* Start the transfer to the device */
 		lpc313x_nand_int_clear(~0);
-#if !defined(STATUS_POLLING)
-		host->intspending = 0;
-#endif
 		lpc313x_ram_write(curbuf);
 
 		/* Copy next payload and OOB data to the buffer while current
 		   buffer is transferring */
 		if (i > 1) {
-			memcpy((void *) nand_buff_addr[bufrdy], p, eccsize);
-			memcpy((void *) nand_buff_addr[bufrdy] + eccsize, oob, OOB_FREE_OFFSET);
+			lpc313x_nand_ram_copyin(host, bufrdy, p, dmap, oob,
+				eccsize);
 			p += eccsize;
 			oob += eccbytes;
+			if (dmap)
+				dmap += eccsize;
 			while(!((nand_readl(IRQSTATUSRAW1)) & nand_buff_enc_mask[bufrdy]));
 		}
 
-#if defined(STATUS_POLLING)
-		/* Polling for buffer loaded and decoded */
-		while (!((nand_readl(IRQSTATUSRAW1)) & nand_buff_wr_mask[curbuf]));
-
-#else
-		/* Interrupt based wait operation */
-		lpc313x_wait_irq(host);
-#endif
+		/* Wait for buffer written to the device */
+		lpc313x_nand_wait_ram(host, nand_buff_wr_mask[curbuf], (i == 1));
 	}
 
+	if (dmabuf)
+		dma_unmap_single(host->dev, dmabuf, eccsize * eccsteps,
+			DMA_TO_DEVICE);
+
 	/* Calculate remaining oob bytes */
 	i = mtd->oobsize - (oob - chip->oob_poi);
 	if (i)
@@ -960,9 +1802,13 @@ static void lpc313x_nand_init_chip(struct lpc313x_nand_info *host,
 	nmtd->host = host;
 	nmtd->mtd.priv = chip;
 	nmtd->mtd.owner = THIS_MODULE;
+	nmtd->cache_next = -1;
+	nmtd->seq_end = 0;
+	nmtd->read_page = -1;
+	mutex_init(&nmtd->read_lock);
 
 	chip->ecc.mode = NAND_ECC_HW_SYNDROME;
-	chip->ecc.read_page_raw = lpc313x_nand_read_page_syndrome;
+	chip->ecc.read_page_raw = lpc313x_nand_read_page_raw_syndrome;
 	chip->ecc.read_page = lpc313x_nand_read_page_syndrome;
 	chip->ecc.write_page = lpc313x_nand_write_page_syndrome;
 	chip->ecc.write_oob = lpc313x_nand_write_oob_syndrome;
@@ -1014,6 +1860,11 @@ static void lpc313x_nand_update_chip(struct lpc313x_nand_info *info,
 		chip->badblock_pattern = &lpc313x_largepage_flashbased;
 	}
 
+	/* Hook the command function for read cache support and ECC
+	   statistics */
+	nmtd->cmdfunc = chip->cmdfunc;
+	chip->cmdfunc = lpc313x_nand_command;
+
 	/* These sizes remain the same regardless of page/block size */
 	chip->ecc.size = 512;
 	chip->ecc.bytes = 16;
@@ -1065,6 +1916,11 @@ static int lpc313x_nand_probe(struct platform_device *pdev) {
 	init_waitqueue_head(&host->controller.wq);
 
 	/* Enable clocks for NAND Controller */
+	err = lpc313x_nand_clocks_get(&pdev->dev);
+	if (err) {
+		dev_err(&pdev->dev, "Can't get the NAND controller clocks\n");
+		goto exit_error;
+	}
 	lpc313x_nand_clocks_disen(1);
 
 	/* Reset NAND controller */
@@ -1092,19 +1948,34 @@ static int lpc313x_nand_probe(struct platform_device *pdev) {
 	/* Initialize the hardware */
 	err = lpc313x_nand_inithw(host);
 	if (err != 0)
-		goto exit_error;
+		goto exit_clocks;
 
 	/* Attach interrupt handler */
 	err = request_irq(host->irq, lpc313x_nandc_irq,
 		IRQF_DISABLED, "nandirq", host);
 	if (err)
 	{
-		goto exit_error;
+		goto exit_clocks;
 	}
 
 	/* IRQ event queue */
 	init_waitqueue_head(&host->irq_waitq);
 
+	/* Start the hybrid wait spin times from typical device timings */
+	for (i = 0; i < LPC313X_NAND_LAT_CLASSES; i++)
+		host->lat_avg8[i] = lat_initial[i] << 3;
+
+#if defined (CONFIG_DEBUG_FS)
+	lpc313x_nand_init_debugfs(host);
+#endif
+
+	/* DMA channel for buffer transfers, memcpy is used without it */
+	init_completion(&host->dma_done);
+	host->dma_chn = dma_request_channel("nanddma", lpc313x_nand_dma_irq,
+		host);
+	if (host->dma_chn < 0)
+		dev_warn(&pdev->dev, "No DMA channel, using memcpy transfers\n");
+
 	/* Allocate space for the MTD data */
 	mtdsize = sizeof(struct lpc313x_nand_mtd) * host->platform->nr_devices;
 	host->mtds = kmalloc(mtdsize, GFP_KERNEL);
@@ -1134,10 +2005,30 @@ static int lpc313x_nand_probe(struct platform_device *pdev) {
 			/* Post architecture MTD init */
 			nand_scan_tail(&host->mtds[i].mtd);
 
+			/* Track sequential reads for the read cache pipeline
+			   and ECC statistics */
+			host->mtds[i].nand_read = host->mtds[i].mtd.read;
+			host->mtds[i].mtd.read = lpc313x_nand_read;
+			host->mtds[i].nand_read_oob = host->mtds[i].mtd.read_oob;
+			host->mtds[i].mtd.read_oob = lpc313x_nand_read_oob;
+			host->mtds[i].nand_erase = host->mtds[i].mtd.erase;
+			host->mtds[i].mtd.erase = lpc313x_nand_erase;
+
+			/* Per eraseblock ECC statistics, optional */
+			host->mtds[i].nr_blocks = host->mtds[i].mtd.size >>
+				host->mtds[i].chip.phys_erase_shift;
+			host->mtds[i].blkstats = kzalloc(host->mtds[i].nr_blocks *
+				sizeof(struct lpc313x_nand_blkstat), GFP_KERNEL);
+#if defined (CONFIG_DEBUG_FS)
+			lpc313x_nand_ecc_debugfs(host, &host->mtds[i], i);
+#endif
+
 			/* Add partitions and MTD device */
 			if (lpc313x_nand_add_partition(host, &host->mtds[i],
 				(plat->devices + i)) < 0) {
 				nand_release(&host->mtds[i].mtd);
+				kfree(host->mtds[i].blkstats);
+				host->mtds[i].blkstats = NULL;
 			}
 		}
 		else {
@@ -1149,16 +2040,24 @@ static int lpc313x_nand_probe(struct platform_device *pdev) {
 	return 0;
 
 exit_error2:
+#if defined (CONFIG_DEBUG_FS)
+	debugfs_remove_recursive(host->debugfs_root);
+#endif
+	if (host->dma_chn >= 0)
+		dma_release_channel(host->dma_chn);
+
 	/* Release IRQ */
 	free_irq(host->irq, pdev);
 
+exit_clocks:
+	/* Disable clocks for NAND Controller */
+	lpc313x_nand_clocks_disen(0);
+	lpc313x_nand_clocks_put();
+
 exit_error:
 	if (host != NULL)
 		kfree(host);
 
-	/* Disable clocks for NAND Controller */
-	lpc313x_nand_clocks_disen(0);
-
 	return err;
 }
 
@@ -1179,10 +2078,19 @@ static int lpc313x_nand_remove(struct platform_device *pdev) {
 		dev_dbg(&pdev->dev, "Releasing mtd device %d (%s)\n", i,
 			host->platform->devices[i].name);
 		nand_release(&host->mtds[i].mtd);
+		kfree(host->mtds[i].blkstats);
 	}
 
 	/* Disable clocks for NAND Controller */
-	lpc313x_nand_clocks_disen(1);
+	lpc313x_nand_clocks_disen(0);
+	lpc313x_nand_clocks_put();
+
+	if (host->dma_chn >= 0)
+		dma_release_channel(host->dma_chn);
+
+#if defined (CONFIG_DEBUG_FS)
+	debugfs_remove_recursive(host->debugfs_root);
+#endif
 
 	/* Release IRQ */
 	free_irq(host->irq, pdev);
@@ -32,12 +32,16 @@
 #include <linux/platform_device.h>
 #include <linux/sched.h>
 #include <linux/spinlock.h>
+#include <linux/slab.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
 #include <linux/spi/spi.h>
 #include <linux/err.h>
 #include <linux/clk.h>
 #include <linux/io.h>
 #include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/cache.h>
 
 #include <mach/registers.h>
 #include <mach/dma.h>
@@ -47,12 +51,45 @@
 #define spi_readl(reg) __raw_readl(&SPI_##reg)
 #define spi_writel(reg,value) __raw_writel((value),&SPI_##reg)
 
+/* Size of each of the dummy TX and RX DMA buffers */
+#define LPC313X_SPI_DMA_BUF_SIZE	4096
+
+/* Most segments in the linked lists of one DMA batch */
+#define LPC313X_SPI_DMA_SEGS		32
+
+/* Run the message pump in a dedicated SCHED_FIFO thread at this priority
+   instead of the driver workqueue */
+static int pump_prio;
+module_param(pump_prio, int, 0444);
+MODULE_PARM_DESC(pump_prio, "SCHED_FIFO priority of the message pump thread (0 = workqueue)");
+
+/* Messages up to this many bytes are run directly in the context of the
+   caller when the controller is idle. This blocks until the message has
+   completed, so it must only be used when all SPI device drivers on the
+   bus submit messages from process context (spi_sync() and friends). */
+static int inline_max;
+module_param(inline_max, int, 0644);
+MODULE_PARM_DESC(inline_max, "Run messages up to this size inline when idle (0 = off)");
+
+/* Controller setup for a chip select, computed when the clock rate or
+   data width used with it changes */
+struct lpc313x_spi_cs
+{
+	u32 speed_hz;
+	u8 bits_wd;
+	u32 slv_set1;
+	u32 slv_set2;
+};
+
 struct lpc313xspi
 {
 	spinlock_t lock;
 	struct platform_device *pdev;
 	struct workqueue_struct	*workqueue;
 	struct work_struct work;
+	struct task_struct *pump_task;
+	wait_queue_head_t pumpq;
+	int busy;
 	struct list_head queue;
 	wait_queue_head_t waitq;
 	struct spi_master *master;
@@ -60,8 +97,12 @@ struct lpc313xspi
 	int id;
 	u32 spi_base_clock;
 	struct lpc313x_spi_cfg *psppcfg;
-	u32 current_speed_hz [3]; /* Per CS */
-	u8 current_bits_wd [3]; /* Per CS */
+	struct lpc313x_spi_cs *cs_state; /* Per CS */
+
+	/* Slave settings currently in the controller */
+	u32 slv_set1_base;
+	u32 hw_slv_set1, hw_slv_set2;
+	int spi_enabled;
 
 	/* DMA allocated regions */
 	u32 dma_base_v;
@@ -70,11 +111,35 @@ struct lpc313xspi
 	/* DMA TX and RX physical and mapped spaces */
 	u32 dma_tx_base_v, dma_rx_base_v, dma_tx_base_p, dma_rx_base_p;
 
-	/* Allocated DMA channels */
+	/* Allocated DMA SG channels */
 	int tx_dma_ch, rx_dma_ch;
 
 	/* DMA event flah */
 	volatile int rxdmaevent;
+
+	/* DMA run state, the RX callback starts the next batch */
+	struct spi_message *dma_msg;
+	struct spi_transfer *dma_t, *dma_last;
+	unsigned int dma_off;
+	unsigned int dma_unit;
+	u32 dma_rx_cfg, dma_tx_cfg;
+	int dma_status;
+
+	/* Linked lists of the current batch, and the RX segments received
+	   in the dummy buffer that are copied out when it completes */
+	dma_lli_t *rx_lli, *tx_lli;
+	struct scatterlist rx_sg[LPC313X_SPI_DMA_SEGS];
+	struct scatterlist tx_sg[LPC313X_SPI_DMA_SEGS];
+	struct
+	{
+		void *buf;
+		unsigned int off;
+		unsigned int len;
+	} dma_copy[LPC313X_SPI_DMA_SEGS];
+	int dma_ncopy;
+
+	/* Bytes of TX data copied to the bottom of the dummy TX buffer */
+	unsigned int dma_tx_used;
 };
 
 /*
@@ -140,33 +205,38 @@ static inline void spi_force_cs(struct lpc313xspi *spidat, u8 cs, uint cs_state)
 }
 
 /*
- * Set data width for the SPI chip select
+ * Enable or disable the SPI interface
  */
-static void lpc313x_set_cs_data_bits(struct lpc313xspi *spidat, u8 cs, u8 data_width)
+static void lpc313x_spi_enable(struct lpc313xspi *spidat, int enable)
 {
-	if (spidat->current_bits_wd[cs] != data_width)
-	{
-		u32 tmp = spi_readl(SLV_SET2_REG(0));
-		tmp &= ~SPI_SLV2_WD_SZ(0x1F);
-		tmp |= SPI_SLV2_WD_SZ((u32) (data_width - 1));
-		spi_writel(SLV_SET2_REG(0), tmp);
+	u32 tmp;
 
-		spidat->current_bits_wd[cs] = data_width;
+	if (spidat->spi_enabled == enable)
+		return;
+
+	tmp = spi_readl(CONFIG_REG) & ~SPI_CFG_ENABLE;
+	if (enable)
+	{
+		tmp |= SPI_CFG_ENABLE;
 	}
+	spi_writel(CONFIG_REG, tmp);
+
+	spidat->spi_enabled = enable;
 }
 
 /*
- * Set clock rate and delays for the SPI chip select
+ * Setup clock rate, data width and clock levels for the SPI chip select.
+ * Only chip select 0 of the controller is used, so the slave settings are
+ * only written when they differ from those of the last chip select used.
  */
-static void lpc313x_set_cs_clock(struct lpc313xspi *spidat, u8 cs, u32 clockrate)
+static void lpc313x_set_cs(struct lpc313xspi *spidat, u8 cs, u32 clockrate,
+				u8 data_width)
 {
-	u32 reg, div, ps, div1;
+	struct lpc313x_spi_cs *csd = &spidat->cs_state[cs];
+	u32 div, ps, div1;
 
-	if (clockrate != spidat->current_speed_hz[cs])
+	if (clockrate != csd->speed_hz)
 	{
-		reg = spi_readl(SLV_SET1_REG(0));
-		reg &= ~0xFFFF;
-
 		div = (spidat->spi_base_clock + clockrate / 2) / clockrate;
 		if (div > SPI_MAX_DIVIDER)
 			div = SPI_MAX_DIVIDER;
@@ -176,10 +246,44 @@ static void lpc313x_set_cs_clock(struct lpc313xspi *spidat, u8 cs, u32 clockrate
 		ps = (((div - 1) / 512) + 1) * 2;
 		div1 = (((div + ps / 2) / ps) - 1);
 
-		spi_writel(SLV_SET1_REG(0),
-			(reg | SPI_SLV1_CLK_PS(ps) | SPI_SLV1_CLK_DIV1(div1)));
+		csd->slv_set1 = spidat->slv_set1_base | SPI_SLV1_CLK_PS(ps) |
+			SPI_SLV1_CLK_DIV1(div1);
+		csd->speed_hz = clockrate;
+	}
 
-		spidat->current_speed_hz[cs] = clockrate;
+	if (data_width != csd->bits_wd)
+	{
+		csd->slv_set2 = SPI_SLV2_PPCS_DLY(0) | SPI_SLV2_CS_HIGH |
+			SPI_SLV2_WD_SZ((u32) (data_width - 1));
+		if (spidat->psppcfg->spics_cfg[cs].spi_spo != 0)
+		{
+			/* Clock high between transfers */
+			csd->slv_set2 |= SPI_SLV2_SPO;
+		}
+		if (spidat->psppcfg->spics_cfg[cs].spi_sph != 0)
+		{
+			/* Data captured on 2nd clock edge */
+			csd->slv_set2 |= SPI_SLV2_SPH;
+		}
+		csd->bits_wd = data_width;
+	}
+
+	if ((csd->slv_set1 == spidat->hw_slv_set1) &&
+		(csd->slv_set2 == spidat->hw_slv_set2))
+		return;
+
+	/* New slave settings are taken over when the interface is enabled */
+	lpc313x_spi_enable(spidat, 0);
+
+	if (csd->slv_set1 != spidat->hw_slv_set1)
+	{
+		spi_writel(SLV_SET1_REG(0), csd->slv_set1);
+		spidat->hw_slv_set1 = csd->slv_set1;
+	}
+	if (csd->slv_set2 != spidat->hw_slv_set2)
+	{
+		spi_writel(SLV_SET2_REG(0), csd->slv_set2);
+		spidat->hw_slv_set2 = csd->slv_set2;
 	}
 }
 
@@ -217,14 +321,21 @@ static void lpc313x_spi_prep(struct lpc313xspi *spidat)
 	tmp = spi_readl(SLV_SET1_REG(0));
 	tmp &= ~SPI_SLV1_INTER_TX_DLY(0xFF);
 	spi_writel(SLV_SET1_REG(0), (tmp | SPI_SLV1_INTER_TX_DLY(0)));
+	spidat->slv_set1_base = (tmp | SPI_SLV1_INTER_TX_DLY(0)) & ~0xFFFF;
 
 	/* Configure enabled chip select slave setting 2 */
 	tmp = SPI_SLV2_PPCS_DLY(0) | SPI_SLV2_CS_HIGH | SPI_SLV2_SPO;
 	spi_writel(SLV_SET2_REG(0), tmp);
 
+	/* The per chip select settings are computed on first use */
+	spidat->hw_slv_set1 = spi_readl(SLV_SET1_REG(0));
+	spidat->hw_slv_set2 = spi_readl(SLV_SET2_REG(0));
+	spidat->spi_enabled = 0;
+	memset(spidat->cs_state, 0,
+		spidat->psppcfg->num_cs * sizeof(struct lpc313x_spi_cs));
+
 	/* Use a default of 8 data bits and a 100K clock for now */
-	lpc313x_set_cs_data_bits(spidat, 0, 8);
-	lpc313x_set_cs_clock(spidat, 0, 100000);
+	lpc313x_set_cs(spidat, 0, 100000, 8);
 
 	/* We'll always use CS0 for this driver. Since the chip select is generated
 	   by a GPO, it doesn't matter which one we use */
@@ -243,7 +354,7 @@ static int lpc313x_spi_setup(struct spi_device *spi)
 
 	/* There really isn't anuthing to do in this function, so verify the
 	   parameters are correct for the transfer */
-	if (spi->chip_select > spi->master->num_chipselect)
+	if (spi->chip_select >= spi->master->num_chipselect)
 	{
 		dev_dbg(&spi->dev,
 			"setup: invalid chipselect %u (%u defined)\n",
@@ -281,181 +392,466 @@ static irqreturn_t lpc313x_spi_irq(int irq, void *dev_id)
 	return IRQ_HANDLED;
 }
 
+static int lpc313x_spi_dma_next(struct lpc313xspi *spidat);
+
 /*
- * SPI DMA TX callback
+ * SPI DMA RX callback, called when the RX list of a batch has completed.
+ * Nothing needs to be done for TX, the SPI will stall the clock if the TX
+ * FIFO becomes empty so there is no chance of some type of underflow.
  */
-static void lpc313x_dma_tx_spi_irq(int ch, dma_irq_type_t dtype, void *handle)
+static void lpc313x_dma_rx_spi_irq(int ch, dma_irq_type_t dtype, void *handle)
 {
-	/* Nothing really needs to be done with the DMA TX interrupt, all the work
-	   is done with RX, so just return and let the DMA handler clear it. The
-	   SPI will stall the clock if the TX FIFO becomes empty so there is no
-	   chance of some type of underflow. */
+	struct lpc313xspi *spidat = (struct lpc313xspi *) handle;
+	int i;
+
+	/* Copy out the segments received in the dummy buffer */
+	for (i = 0; i < spidat->dma_ncopy; i++)
+	{
+		memcpy(spidat->dma_copy[i].buf,
+			(void *) spidat->dma_rx_base_v + spidat->dma_copy[i].off,
+			spidat->dma_copy[i].len);
+	}
+	spidat->dma_ncopy = 0;
+
+	/* Start the next batch of the run */
+	if (lpc313x_spi_dma_next(spidat))
+		return;
+
+	/* Flag event and wakeup */
+	spidat->rxdmaevent = 1;
+	wake_up(&spidat->waitq);
 }
 
 /*
- * SPI DMA RX callback
+ * Map the buffers of a transfer for DMA. NULL buffers get a zero address
+ * and use the dummy DMA buffers.
  */
-static void lpc313x_dma_rx_spi_irq(int ch, dma_irq_type_t dtype, void *handle)
+static int lpc313x_spi_map_xfer(struct lpc313xspi *spidat, struct spi_transfer *t)
 {
-	struct lpc313xspi *spidat = (struct lpc313xspi *) handle;
+	struct device *dev = &spidat->pdev->dev;
 
-	if (dtype == DMA_IRQ_FINISHED)
-	{
-		/* Disable interrupts for now */
-		dma_set_irq_mask(spidat->rx_dma_ch, 1, 1);
+	t->tx_dma = t->rx_dma = 0;
 
-		/* Flag event and wakeup */
-		spidat->rxdmaevent = 1;
-		wake_up(&spidat->waitq);
+	if (t->tx_buf != NULL)
+	{
+		t->tx_dma = dma_map_single(dev, (void *) t->tx_buf,
+			t->len, DMA_TO_DEVICE);
+		if (dma_mapping_error(dev, t->tx_dma))
+		{
+			t->tx_dma = 0;
+			return -ENOMEM;
+		}
 	}
-	else if (dtype == DMA_IRQS_ABORT)
+
+	/* Cache lines only partly covered by the RX buffer are never
+	   written by DMA, see lpc313x_spi_dma_next() */
+	if (t->rx_buf != NULL)
 	{
-		/* DMA data abort - this is global for the entire DMA
-		   peripheral. Do nothing, as this might not be a
-		   error for this channel. */
+		t->rx_dma = dma_map_single(dev, t->rx_buf,
+			t->len, DMA_FROM_DEVICE);
+		if (dma_mapping_error(dev, t->rx_dma))
+		{
+			t->rx_dma = 0;
+			return -ENOMEM;
+		}
 	}
+
+	return 0;
 }
 
-/*
- * Handle a DMA transfer
- */
-static int lpc313x_spi_dma_transfer(struct lpc313xspi *spidat, struct spi_transfer *t,
-					u8 bits_per_word, int dmamapped)
+static void lpc313x_spi_unmap_xfer(struct lpc313xspi *spidat, struct spi_transfer *t)
 {
-	dma_setup_t dmarx, dmatx;
-	int status = 0;
-	u32 src, dest, srcmapped = 0, destmapped = 0;
 	struct device *dev = &spidat->pdev->dev;
 
-	/* Set the FIFO trip level to the transfer size */
-	spi_writel(INT_TRSH_REG, (SPI_INT_TSHLD_TX(16) |
-		SPI_INT_TSHLD_RX(1)));
-	spi_writel(DMA_SET_REG, (SPI_DMA_TX_EN | SPI_DMA_RX_EN));
-	lpc313x_int_dis(spidat, SPI_ALL_INTS);
-	lpc313x_int_en(spidat, SPI_OVR_INT);
-
-	/* Setup transfer */
-	if (bits_per_word > 8)
+	if (t->tx_dma != 0)
 	{
-		dmarx.cfg = DMA_CFG_TX_HWORD | DMA_CFG_RD_SLV_NR(DMA_SLV_SPI_RX) |
-			DMA_CFG_WR_SLV_NR(0);
-		dmatx.cfg = DMA_CFG_TX_HWORD | DMA_CFG_RD_SLV_NR(0) |
-			DMA_CFG_WR_SLV_NR(DMA_SLV_SPI_TX);
+		dma_unmap_single(dev, t->tx_dma, t->len, DMA_TO_DEVICE);
 	}
-	else
+	if (t->rx_dma != 0)
 	{
-		dmarx.cfg = DMA_CFG_TX_BYTE | DMA_CFG_RD_SLV_NR(DMA_SLV_SPI_RX) |
-			DMA_CFG_WR_SLV_NR(0);
-		dmatx.cfg = DMA_CFG_TX_BYTE | DMA_CFG_RD_SLV_NR(0) |
-			DMA_CFG_WR_SLV_NR(DMA_SLV_SPI_TX);
+		dma_unmap_single(dev, t->rx_dma, t->len, DMA_FROM_DEVICE);
+	}
+}
+
+/*
+ * Find the next DMA segment of the current run. Data moves directly
+ * between the FIFO and the transfer buffers. The parts of a mapped RX
+ * buffer that share a cache line with other data, and words a buffer
+ * does not provide, go through the dummy buffers (*bounce set). Returns
+ * the length of the segment, 0 when the run is complete.
+ */
+static unsigned int lpc313x_spi_dma_seg(struct lpc313xspi *spidat, int *bounce)
+{
+	struct spi_transfer *t = spidat->dma_t;
+	unsigned int off, len, end, a, b;
+	u32 rx_start;
+
+	/* Skip empty transfers */
+	while ((t != NULL) && (t->len == 0))
+	{
+		if (t == spidat->dma_last)
+		{
+			t = NULL;
+		}
+		else
+		{
+			t = list_entry(t->transfer_list.next,
+				struct spi_transfer, transfer_list);
+		}
 	}
+	spidat->dma_t = t;
+
+	if (t == NULL)
+		return 0;
 
-	/* Determine the DMA source and destination addresses. If DMA buffers weren't
-	   passed to this handler, they need to be mapped */
-	if (dmamapped)
+	off = spidat->dma_off;
+	len = t->len;
+
+	/* Find the range of the RX buffer the offset is in */
+	end = len;
+	*bounce = (t->rx_dma == 0);
+	if (!*bounce && !spidat->dma_msg->is_dma_mapped)
 	{
-		src = t->tx_dma;
-		dest = t->rx_dma;
-		if ((src == 0) && (dest == 0))
+		rx_start = (u32) t->rx_buf;
+		if (rx_start & (spidat->dma_unit - 1))
+		{
+			a = b = len;
+		}
+		else
 		{
-			/* DMA mapped flag set, but not mapped */
-			status = -ENOMEM;
-			goto exit;
+			a = min(len, (unsigned int) (ALIGN(rx_start, L1_CACHE_BYTES) -
+				rx_start));
+			b = ((rx_start + len) & ~(L1_CACHE_BYTES - 1)) - rx_start;
+			if (b < a)
+				b = a;
 		}
 
-                /* At least one of the DMA buffers are already mapped */
-		if (src == 0)
+		if (off < a)
 		{
-			/* Use temporary buffer for TX */
-			src = spidat->dma_tx_base_p;
+			end = a;
+			*bounce = 1;
+		}
+		else if (off < b)
+		{
+			end = b;
 		}
 		else
 		{
-			dest = spidat->dma_rx_base_p;
+			*bounce = 1;
 		}
 	}
-	else
+
+	return min(end - off, (DMA_MAX_TRANSFERS + 1) * spidat->dma_unit);
+}
+
+/* Advance the run past a segment of n bytes */
+static void lpc313x_spi_dma_advance(struct lpc313xspi *spidat, unsigned int n)
+{
+	struct spi_transfer *t = spidat->dma_t;
+
+	spidat->dma_off += n;
+	if (spidat->dma_off >= t->len)
 	{
-		/* Does TX buffer need to be DMA mapped */
-		if (t->tx_buf == NULL)
+		spidat->dma_off = 0;
+		if (t == spidat->dma_last)
 		{
-			/* Use the temporary buffer for this transfer */
-			src = spidat->dma_tx_base_p;
+			spidat->dma_t = NULL;
 		}
 		else
 		{
-			/* Map DMA buffer */
-			src = (u32) dma_map_single(dev, (void *) t->tx_buf,
-				t->len, DMA_TO_DEVICE);
-			if (dma_mapping_error(dev, src))
-			{
-				status = -ENOMEM;
-				goto exit;
-			}
+			spidat->dma_t = list_entry(t->transfer_list.next,
+				struct spi_transfer, transfer_list);
+		}
+	}
+}
+
+static void lpc313x_spi_dma_free_lli(struct lpc313xspi *spidat)
+{
+	dma_lli_free(spidat->rx_lli);
+	dma_lli_free(spidat->tx_lli);
+	spidat->rx_lli = spidat->tx_lli = NULL;
+}
+
+/*
+ * Build the linked lists of the next DMA batch of the current run and
+ * start them. A batch takes segments until the lists are full or a
+ * dummy buffer has no room left: RX data that is copied out gets its
+ * own area from the bottom, data nobody wants shares one area at the
+ * top. The TX buffer works the same way, with halfword data at an odd
+ * address copied in at the bottom and the zeros sent for transfers
+ * without TX data at the top. Returns 0 when the run is complete or has
+ * failed (dma_status).
+ */
+static int lpc313x_spi_dma_next(struct lpc313xspi *spidat)
+{
+	struct spi_transfer *t;
+	unsigned int n, sz, used = 0, discard = 0, tx_used = 0, tx_zero = 0;
+	unsigned int tx_need;
+	u32 rx_addr, tx_addr;
+	int bounce, tx_bounce, nseg = 0;
+
+	lpc313x_spi_dma_free_lli(spidat);
+	sg_init_table(spidat->rx_sg, LPC313X_SPI_DMA_SEGS);
+	sg_init_table(spidat->tx_sg, LPC313X_SPI_DMA_SEGS);
 
-			srcmapped = src;
+	/* The last batch is done with its TX copies, zero them again */
+	memset((void *) spidat->dma_tx_base_v, 0, spidat->dma_tx_used);
+	spidat->dma_tx_used = 0;
+
+	while (nseg < LPC313X_SPI_DMA_SEGS)
+	{
+		n = lpc313x_spi_dma_seg(spidat, &bounce);
+		if (n == 0)
+			break;
+
+		t = spidat->dma_t;
+		sz = ALIGN(n, 4);
+
+		/* The DMA can't read halfwords from an odd address */
+		tx_bounce = (t->tx_dma != 0) && !spidat->dma_msg->is_dma_mapped &&
+			((u32) t->tx_buf & (spidat->dma_unit - 1));
+		if (t->tx_dma == 0)
+			tx_need = tx_used + max(sz, tx_zero);
+		else if (tx_bounce)
+			tx_need = tx_used + sz + tx_zero;
+		else
+			tx_need = 0;
+		if ((nseg != 0) && (tx_need > LPC313X_SPI_DMA_BUF_SIZE))
+			break;
+
+		if (!bounce)
+		{
+			rx_addr = t->rx_dma + spidat->dma_off;
+		}
+		else if (t->rx_dma != 0)
+		{
+			if ((nseg != 0) &&
+				(used + sz + discard > LPC313X_SPI_DMA_BUF_SIZE))
+				break;
+
+			rx_addr = spidat->dma_rx_base_p + used;
+			spidat->dma_copy[spidat->dma_ncopy].buf =
+				t->rx_buf + spidat->dma_off;
+			spidat->dma_copy[spidat->dma_ncopy].off = used;
+			spidat->dma_copy[spidat->dma_ncopy].len = n;
+			spidat->dma_ncopy++;
+			used += sz;
+		}
+		else
+		{
+			if ((nseg != 0) &&
+				(used + max(sz, discard) > LPC313X_SPI_DMA_BUF_SIZE))
+				break;
+
+			rx_addr = spidat->dma_rx_base_p +
+				LPC313X_SPI_DMA_BUF_SIZE - sz;
+			discard = max(sz, discard);
 		}
 
-		/* Does RX buffer need to be DMA mapped */
-		if (t->rx_buf == NULL)
+		if (t->tx_dma == 0)
+		{
+			tx_addr = spidat->dma_tx_base_p +
+				LPC313X_SPI_DMA_BUF_SIZE - sz;
+			tx_zero = max(sz, tx_zero);
+		}
+		else if (tx_bounce)
 		{
-			/* Use the temporary buffer for this transfer */
-			dest = spidat->dma_rx_base_p;
+			tx_addr = spidat->dma_tx_base_p + tx_used;
+			memcpy((void *) spidat->dma_tx_base_v + tx_used,
+				t->tx_buf + spidat->dma_off, n);
+			tx_used += sz;
 		}
 		else
 		{
-			/* Map DMA buffer */
-			dest = (u32) dma_map_single(dev, (void *) t->rx_buf,
-				t->len, DMA_FROM_DEVICE);
-			if (dma_mapping_error(dev, dest))
+			tx_addr = t->tx_dma + spidat->dma_off;
+		}
+
+		sg_dma_address(&spidat->rx_sg[nseg]) = rx_addr;
+		sg_dma_len(&spidat->rx_sg[nseg]) = n;
+		sg_dma_address(&spidat->tx_sg[nseg]) = tx_addr;
+		sg_dma_len(&spidat->tx_sg[nseg]) = n;
+		nseg++;
+
+		lpc313x_spi_dma_advance(spidat, n);
+	}
+	spidat->dma_tx_used = tx_used;
+
+	if (nseg == 0)
+		return 0;
+
+	spidat->rx_lli = dma_lli_from_sg(spidat->rx_dma_ch, spidat->rx_sg,
+		nseg, (SPI_PHYS + 0x0C), spidat->dma_rx_cfg, 0, 0, GFP_ATOMIC);
+	spidat->tx_lli = dma_lli_from_sg(spidat->tx_dma_ch, spidat->tx_sg,
+		nseg, (SPI_PHYS + 0x0C), spidat->dma_tx_cfg, 1, 0, GFP_ATOMIC);
+	if (IS_ERR(spidat->rx_lli) || IS_ERR(spidat->tx_lli))
+	{
+		spidat->dma_status = IS_ERR(spidat->rx_lli) ?
+			PTR_ERR(spidat->rx_lli) : PTR_ERR(spidat->tx_lli);
+		if (IS_ERR(spidat->rx_lli))
+			spidat->rx_lli = NULL;
+		if (IS_ERR(spidat->tx_lli))
+			spidat->tx_lli = NULL;
+		lpc313x_spi_dma_free_lli(spidat);
+		spidat->dma_t = NULL;
+		spidat->dma_ncopy = 0;
+		return 0;
+	}
+
+	/* Start the transfer, RX first */
+	dma_start_lli(spidat->rx_dma_ch, spidat->rx_lli,
+		lpc313x_dma_rx_spi_irq, spidat);
+	dma_prog_sg_channel(spidat->tx_dma_ch, spidat->tx_lli->dma);
+	dma_start_channel(spidat->tx_dma_ch);
+
+	return 1;
+}
+
+/*
+ * Handle a run of DMA transfers. All transfers from first to last share
+ * clock, word size and chip select state, so their segments are chained
+ * in linked lists, batch after batch from the RX DMA callback, without
+ * waking up the worker in between.
+ */
+static int lpc313x_spi_dma_transfer(struct lpc313xspi *spidat, struct spi_message *m,
+					struct spi_transfer *first, struct spi_transfer *last,
+					u8 bits_per_word)
+{
+	struct spi_transfer *t, *mapped = NULL;
+	unsigned long flags;
+	int status = 0;
+
+	/* Map the buffers of the run, unless the caller has done it */
+	if (!m->is_dma_mapped)
+	{
+		for (t = first; ; t = list_entry(t->transfer_list.next,
+			struct spi_transfer, transfer_list))
+		{
+			status = lpc313x_spi_map_xfer(spidat, t);
+			if (status < 0)
 			{
-				status = -ENOMEM;
-				goto exit;
+				lpc313x_spi_unmap_xfer(spidat, t);
+				goto unmap;
 			}
+			mapped = t;
 
-			destmapped = dest;
+			if (t == last)
+				break;
 		}
 	}
+	else
+	{
+		for (t = first; ; t = list_entry(t->transfer_list.next,
+			struct spi_transfer, transfer_list))
+		{
+			if ((t->tx_dma == 0) && (t->rx_dma == 0) && (t->len))
+			{
+				/* DMA mapped flag set, but not mapped */
+				return -ENOMEM;
+			}
 
-	/* Setup transfer data for DMA */
-	dmarx.trans_length = (t->len - 1);
-	dmarx.src_address = (SPI_PHYS + 0x0C);
-	dmarx.dest_address = dest;
-	dmatx.trans_length = (t->len - 1);
-	dmatx.src_address = src;
-	dmatx.dest_address = (SPI_PHYS + 0x0C);
-
-	/* Setup the channels */
-	dma_prog_channel(spidat->rx_dma_ch, &dmarx);
-	dma_prog_channel(spidat->tx_dma_ch, &dmatx);
+			if (t == last)
+				break;
+		}
+	}
 
-	/* Make sure the completion interrupt is enabled for RX, TX disabled */
-	dma_set_irq_mask(spidat->rx_dma_ch, 1, 0);
-	dma_set_irq_mask(spidat->tx_dma_ch, 1, 1);
+	/* Set the FIFO trip level to the transfer size */
+	spi_writel(INT_TRSH_REG, (SPI_INT_TSHLD_TX(16) |
+		SPI_INT_TSHLD_RX(1)));
+	spi_writel(DMA_SET_REG, (SPI_DMA_TX_EN | SPI_DMA_RX_EN));
+	lpc313x_int_dis(spidat, SPI_ALL_INTS);
+	lpc313x_int_en(spidat, SPI_OVR_INT);
 
-	/* Start the transfer */
-	spidat->rxdmaevent = 0;
-	dma_start_channel(spidat->rx_dma_ch);
-	dma_start_channel(spidat->tx_dma_ch);
+	/* Setup transfer, the length of a segment is counted in words */
+	if (bits_per_word > 8)
+	{
+		spidat->dma_rx_cfg = DMA_CFG_TX_HWORD | DMA_CFG_RD_SLV_NR(DMA_SLV_SPI_RX) |
+			DMA_CFG_WR_SLV_NR(0);
+		spidat->dma_tx_cfg = DMA_CFG_TX_HWORD | DMA_CFG_RD_SLV_NR(0) |
+			DMA_CFG_WR_SLV_NR(DMA_SLV_SPI_TX);
+		spidat->dma_unit = 2;
+	}
+	else
+	{
+		spidat->dma_rx_cfg = DMA_CFG_TX_BYTE | DMA_CFG_RD_SLV_NR(DMA_SLV_SPI_RX) |
+			DMA_CFG_WR_SLV_NR(0);
+		spidat->dma_tx_cfg = DMA_CFG_TX_BYTE | DMA_CFG_RD_SLV_NR(0) |
+			DMA_CFG_WR_SLV_NR(DMA_SLV_SPI_TX);
+		spidat->dma_unit = 1;
+	}
 
-	/* Wait for DMA to complete */
-	wait_event_interruptible(spidat->waitq, spidat->rxdmaevent);
+	spidat->dma_msg = m;
+	spidat->dma_t = first;
+	spidat->dma_last = last;
+	spidat->dma_off = 0;
+	spidat->dma_status = 0;
+	spidat->dma_ncopy = 0;
 
-exit:
-	dma_stop_channel(spidat->tx_dma_ch);
-	dma_stop_channel(spidat->rx_dma_ch);
+	/* Start the first batch, the RX callback starts the others */
+	spidat->rxdmaevent = 0;
+	if (lpc313x_spi_dma_next(spidat))
+	{
+		/* Wait for DMA to complete */
+		wait_event(spidat->waitq, spidat->rxdmaevent);
+	}
 
+	/* The run may have been cut short by an overflow */
+	local_irq_save(flags);
+	dma_stop_lli(spidat->rx_dma_ch);
+	dma_stop_lli(spidat->tx_dma_ch);
+	spidat->dma_t = NULL;
+	spidat->dma_ncopy = 0;
+	lpc313x_spi_dma_free_lli(spidat);
+	local_irq_restore(flags);
+	status = spidat->dma_status;
+
+unmap:
 	/* Unmap buffers */
-	if (srcmapped != 0)
+	if (mapped != NULL)
 	{
-		dma_unmap_single(dev, srcmapped, t->len, DMA_TO_DEVICE);
+		for (t = first; ; t = list_entry(t->transfer_list.next,
+			struct spi_transfer, transfer_list))
+		{
+			lpc313x_spi_unmap_xfer(spidat, t);
+
+			if (t == mapped)
+				break;
+		}
 	}
-	if (destmapped != 0)
+
+	return status;
+}
+
+/*
+ * Find the last transfer that can be chained in one DMA run with t
+ */
+static struct spi_transfer *lpc313x_spi_run_end(struct spi_message *m,
+					struct spi_transfer *t)
+{
+	struct spi_device *spi = m->spi;
+	struct spi_transfer *next;
+	u32 speed_hz = t->speed_hz ? : spi->max_speed_hz;
+	u8 bits_per_word = t->bits_per_word ? : spi->bits_per_word;
+
+	bits_per_word = bits_per_word ? : 8;
+
+	while (t->transfer_list.next != &m->transfers)
 	{
-		dma_unmap_single(dev, destmapped, t->len, DMA_FROM_DEVICE);
+		next = list_entry(t->transfer_list.next, struct spi_transfer,
+			transfer_list);
+
+		/* Chip select changes and delays are done by the worker */
+		if (t->cs_change || t->delay_usecs)
+			break;
+		if ((next->speed_hz ? : spi->max_speed_hz) != speed_hz)
+			break;
+		if (((next->bits_per_word ? : spi->bits_per_word) ? : 8) !=
+			bits_per_word)
+			break;
+
+		t = next;
 	}
 
-	return status;
+	return t;
 }
 
 /*
@@ -465,16 +861,13 @@ exit:
 static void lpc313x_work_one(struct lpc313xspi *spidat, struct spi_message *m)
 {
 	struct spi_device *spi = m->spi;
-	struct spi_transfer *t;
+	struct spi_transfer *t, *last;
 	unsigned int wsize, cs_change = 1;
 	int status = 0;
 	unsigned long flags;
-	u32 tmp;
 
-	/* Enable SPI clock and interrupts */
+	/* The controller is powered by lpc313x_work() */
 	spin_lock_irqsave(&spidat->lock, flags);
-	lpc313x_spi_clks_disen(spidat, 1);
-	enable_irq(spidat->irq);
 
 	/* Make sure FIFO is flushed and clear any pending interrupts */
 	lpc313x_fifo_flush(spidat);
@@ -494,29 +887,15 @@ static void lpc313x_work_one(struct lpc313xspi *spidat, struct spi_message *m)
 		wsize = bits_per_word >> 3;
 		rlen = tlen;
 
-		/* Setup the appropriate chip select */
-		lpc313x_set_cs_clock(spidat, spi->chip_select, speed_hz);
-		lpc313x_set_cs_data_bits(spidat, spi->chip_select, bits_per_word);
- 
-		/* Setup timing and levels before initial chip select */
-		tmp = spi_readl(SLV_SET2_REG(0)) & ~(SPI_SLV2_SPO | SPI_SLV2_SPH);
-		if (spidat->psppcfg->spics_cfg[spi->chip_select].spi_spo != 0)
-		{
-			/* Clock high between transfers */
-			tmp |= SPI_SLV2_SPO;
-		}
-		if (spidat->psppcfg->spics_cfg[spi->chip_select].spi_sph != 0)
-		{
-			/* Data captured on 2nd clock edge */
-			tmp |= SPI_SLV2_SPH;
-		}
-		spi_writel(SLV_SET2_REG(0), tmp);
+		/* Setup the appropriate chip select, timing and levels before
+		   initial chip select */
+		lpc313x_set_cs(spidat, spi->chip_select, speed_hz, bits_per_word);
 
 		lpc313x_int_clr(spidat, SPI_ALL_INTS);  /****fix from JPP*** */
 
 		/* Make sure FIFO is flushed, clear pending interrupts, DMA
 		   initially disabled, and then enable SPI interface */
-		spi_writel(CONFIG_REG, (spi_readl(CONFIG_REG) | SPI_CFG_ENABLE));
+		lpc313x_spi_enable(spidat, 1);
 
 		/* Assert selected chip select */
 		if (cs_change)
@@ -524,7 +903,10 @@ static void lpc313x_work_one(struct lpc313xspi *spidat, struct spi_message *m)
 			/* Force CS assertion */
 			spi_force_cs(spidat, spi->chip_select, 0);
 		}
-		cs_change = t->cs_change;
+
+		/* Following transfers with the same setup share the DMA run */
+		last = lpc313x_spi_run_end(m, t);
+		cs_change = last->cs_change;
 
 		/* The driver will pick the best transfer method based on the
 		   current transfer size. For sizes smaller than the FIFO depth,
@@ -616,8 +998,8 @@ static void lpc313x_work_one(struct lpc313xspi *spidat, struct spi_message *m)
 		#endif
 			/* DMA will be used for the transfer */
 			spin_unlock_irqrestore(&spidat->lock, flags);
-			status = lpc313x_spi_dma_transfer(spidat, t, bits_per_word,
-				m->is_dma_mapped);
+			status = lpc313x_spi_dma_transfer(spidat, m, t, last,
+				bits_per_word);
 			spin_lock_irqsave(&spidat->lock, flags);
 			if (status < 0)
 				goto exit;
@@ -625,6 +1007,12 @@ static void lpc313x_work_one(struct lpc313xspi *spidat, struct spi_message *m)
 		}
 		#endif
 
+		while (t != last)
+		{
+			m->actual_length += t->len;
+			t = list_entry(t->transfer_list.next, struct spi_transfer,
+				transfer_list);
+		}
 		m->actual_length += t->len;
 		if (t->delay_usecs)
 		{
@@ -644,26 +1032,51 @@ exit:
 		spi_force_cs(spidat, spi->chip_select, 1);
 	}
 
-	/* Disable SPI, stop SPI clock to save power */
-	spi_writel(CONFIG_REG, (spi_readl(CONFIG_REG) & ~SPI_CFG_ENABLE));
-	disable_irq(spidat->irq);
-	lpc313x_spi_clks_disen(spidat, 0);
-
 	spin_unlock_irqrestore(&spidat->lock, flags);
 	m->status = status;
 	m->complete(m->context);
 }
 
 /*
- * Work queue function
+ * Power the controller up or down, called with the lock held
  */
-static void lpc313x_work(struct work_struct *work)
+static void lpc313x_spi_power(struct lpc313xspi *spidat, int on)
+{
+	if (on)
+	{
+		/* Enable SPI clock and interrupts */
+		lpc313x_spi_clks_disen(spidat, 1);
+		enable_irq(spidat->irq);
+	}
+	else
+	{
+		/* Disable SPI, stop SPI clock to save power */
+		lpc313x_spi_enable(spidat, 0);
+		disable_irq(spidat->irq);
+		lpc313x_spi_clks_disen(spidat, 0);
+	}
+}
+
+/*
+ * Process all queued messages. The controller stays powered until the
+ * queue has been drained.
+ */
+static void lpc313x_spi_pump(struct lpc313xspi *spidat)
 {
-	struct lpc313xspi *spidat = container_of(work, struct lpc313xspi, work);
 	unsigned long flags;
 
 	spin_lock_irqsave(&spidat->lock, flags);
 
+	/* An inline message restarts the pump when it is done */
+	if (list_empty(&spidat->queue) || spidat->busy)
+	{
+		spin_unlock_irqrestore(&spidat->lock, flags);
+		return;
+	}
+
+	spidat->busy = 1;
+	lpc313x_spi_power(spidat, 1);
+
 	while (!list_empty(&spidat->queue))
 	{
 		struct spi_message *m;
@@ -676,9 +1089,102 @@ static void lpc313x_work(struct work_struct *work)
 		spin_lock_irqsave(&spidat->lock, flags);
 	}
 
+	lpc313x_spi_power(spidat, 0);
+	spidat->busy = 0;
+
 	spin_unlock_irqrestore(&spidat->lock, flags);
 }
 
+/*
+ * Start the message pump, called with the lock held
+ */
+static void lpc313x_spi_kick(struct lpc313xspi *spidat)
+{
+	if (spidat->pump_task != NULL)
+	{
+		wake_up(&spidat->pumpq);
+	}
+	else
+	{
+		queue_work(spidat->workqueue, &spidat->work);
+	}
+}
+
+/*
+ * Work queue function
+ */
+static void lpc313x_work(struct work_struct *work)
+{
+	struct lpc313xspi *spidat = container_of(work, struct lpc313xspi, work);
+
+	lpc313x_spi_pump(spidat);
+}
+
+/*
+ * Real-time message pump thread
+ */
+static int lpc313x_spi_pump_thread(void *data)
+{
+	struct lpc313xspi *spidat = data;
+
+	while (!kthread_should_stop())
+	{
+		wait_event_interruptible(spidat->pumpq,
+			(!list_empty(&spidat->queue) && !spidat->busy) ||
+			kthread_should_stop());
+
+		lpc313x_spi_pump(spidat);
+	}
+
+	return 0;
+}
+
+/*
+ * Run a short message directly in the context of the caller if nothing
+ * else is queued or in progress. Returns 0 if the message was run.
+ */
+static int lpc313x_spi_transfer_inline(struct lpc313xspi *spidat, struct spi_message *m)
+{
+	struct spi_transfer *t;
+	unsigned int len = 0;
+	unsigned long flags;
+
+	if (in_interrupt() || irqs_disabled())
+		return -EBUSY;
+
+	list_for_each_entry (t, &m->transfers, transfer_list)
+	{
+		len += t->len;
+	}
+	if (len > inline_max)
+		return -EBUSY;
+
+	spin_lock_irqsave(&spidat->lock, flags);
+	if (spidat->busy || !list_empty(&spidat->queue))
+	{
+		spin_unlock_irqrestore(&spidat->lock, flags);
+		return -EBUSY;
+	}
+	spidat->busy = 1;
+	lpc313x_spi_power(spidat, 1);
+	spin_unlock_irqrestore(&spidat->lock, flags);
+
+	lpc313x_work_one(spidat, m);
+
+	spin_lock_irqsave(&spidat->lock, flags);
+	lpc313x_spi_power(spidat, 0);
+	spidat->busy = 0;
+
+	/* Pick up messages queued in the meantime */
+	if (!list_empty(&spidat->queue))
+	{
+		lpc313x_spi_kick(spidat);
+	}
+	spin_unlock_irqrestore(&spidat->lock, flags);
+
+	return 0;
+}
+
 /*
  * Kick off a SPI transfer
  */
@@ -713,9 +1219,15 @@ static int lpc313x_spi_transfer(struct spi_device *spi, struct spi_message *m)
 			t->rx_buf, t->rx_dma, m->is_dma_mapped);*/		//***MOD-
 	}
 
+	/* Short messages skip the queue when the controller is idle */
+	if ((inline_max > 0) && (lpc313x_spi_transfer_inline(spidat, m) == 0))
+	{
+		return 0;
+	}
+
 	spin_lock_irqsave(&spidat->lock, flags);
 	list_add_tail(&m->queue, &spidat->queue);
-	queue_work(spidat->workqueue, &spidat->work);
+	lpc313x_spi_kick(spidat);
 	spin_unlock_irqrestore(&spidat->lock, flags);
 
 	return 0;
@@ -775,6 +1287,14 @@ static int __init lpc313x_spi_probe(struct platform_device *pdev)
 		}
 	}
 
+	spidat->cs_state = kcalloc(spidat->psppcfg->num_cs,
+		sizeof(struct lpc313x_spi_cs), GFP_KERNEL);
+	if (spidat->cs_state == NULL)
+	{
+		ret = -ENOMEM;
+		goto errout;
+	}
+
 	/* Save ID for this device */
 	spidat->pdev = pdev;
 	spidat->id = pdev->id;
@@ -784,6 +1304,7 @@ static int __init lpc313x_spi_probe(struct platform_device *pdev)
 	INIT_WORK(&spidat->work, lpc313x_work);
 	INIT_LIST_HEAD(&spidat->queue);
 	init_waitqueue_head(&spidat->waitq);
+	init_waitqueue_head(&spidat->pumpq);
 	spidat->workqueue = create_singlethread_workqueue(dev_name(master->dev.parent));	//***MOD:Fix from JPP to compile to latest versions of Linux	
 	if (!spidat->workqueue)
 	{
@@ -813,7 +1334,7 @@ static int __init lpc313x_spi_probe(struct platform_device *pdev)
 	/* Setup several work DMA buffers for dummy TX and RX data. These buffers just
 	   hold the temporary TX or RX data for the unused half of the transfer and have
 	   a size of 4K (the maximum size of a transfer) */
-	spidat->dma_base_v = (u32) dma_alloc_coherent(&pdev->dev, (4096 << 1),
+	spidat->dma_base_v = (u32) dma_alloc_coherent(&pdev->dev, (LPC313X_SPI_DMA_BUF_SIZE << 1),
 		&dma_handle, GFP_KERNEL);
 	if (spidat->dma_base_v == (u32) NULL)
 	{
@@ -825,11 +1346,11 @@ static int __init lpc313x_spi_probe(struct platform_device *pdev)
 
 	spidat->dma_tx_base_p = (u32) spidat->dma_base_p;
 	spidat->dma_tx_base_v = spidat->dma_base_v;
-	spidat->dma_rx_base_p = (u32) spidat->dma_base_p + 4096;
-	spidat->dma_rx_base_v = spidat->dma_base_v + 4096;
+	spidat->dma_rx_base_p = (u32) spidat->dma_base_p + LPC313X_SPI_DMA_BUF_SIZE;
+	spidat->dma_rx_base_v = spidat->dma_base_v + LPC313X_SPI_DMA_BUF_SIZE;
 
 	/* Fill dummy TX buffer with 0 */
-	memset((void *) spidat->dma_tx_base_v, 0, 4096);
+	memset((void *) spidat->dma_tx_base_v, 0, LPC313X_SPI_DMA_BUF_SIZE);
 
 	/* Initial setup of SPI */
 	spidat->spi_base_clock = cgu_get_clk_freq(CGU_SB_SPI_CLK_ID);
@@ -840,14 +1361,14 @@ static int __init lpc313x_spi_probe(struct platform_device *pdev)
 
 	/* Request RX and TX DMA channels */
 	spidat->tx_dma_ch = spidat->rx_dma_ch = -1;
-	spidat->tx_dma_ch = dma_request_channel("spi_tx", lpc313x_dma_tx_spi_irq, spidat);
+	spidat->tx_dma_ch = dma_request_sg_channel("spi_tx", NULL, NULL, 0);
 	if (spidat->tx_dma_ch < 0)
 	{
 		dev_err(&pdev->dev, "error getting TX DMA channel.\n");
 		ret = -EBUSY;
 		goto errout4;
 	}
-	spidat->rx_dma_ch = dma_request_channel("spi_rx", lpc313x_dma_rx_spi_irq, spidat);
+	spidat->rx_dma_ch = dma_request_sg_channel("spi_rx", NULL, NULL, 0);
 	if (spidat->rx_dma_ch < 0)
 	{
 		dev_err(&pdev->dev, "error getting RX DMA channel.\n");
@@ -855,22 +1376,42 @@ static int __init lpc313x_spi_probe(struct platform_device *pdev)
 		goto errout4;
 	}
 
+	/* Optional real-time message pump */
+	if (pump_prio > 0)
+	{
+		struct sched_param param = { .sched_priority = pump_prio };
+
+		spidat->pump_task = kthread_run(lpc313x_spi_pump_thread, spidat,
+			"spi_lpc313x/%d", spidat->id);
+		if (IS_ERR(spidat->pump_task))
+		{
+			dev_err(&pdev->dev, "error creating pump thread.\n");
+			ret = PTR_ERR(spidat->pump_task);
+			spidat->pump_task = NULL;
+			goto errout4;
+		}
+		sched_setscheduler(spidat->pump_task, SCHED_FIFO, &param);
+	}
+
 	ret = spi_register_master(master);
 	if (ret)
 	{
-		goto errout4;
+		goto errout5;
 	}
 
 	dev_info(&pdev->dev, "LPC313x SPI driver\n");
 
 	return 0;
 
+errout5:
+	if (spidat->pump_task != NULL)
+		kthread_stop(spidat->pump_task);
 errout4:
-	if (spidat->tx_dma_ch != -1)
-		dma_release_channel(spidat->tx_dma_ch);
-	if (spidat->rx_dma_ch != -1)
-		dma_release_channel(spidat->rx_dma_ch);
-	dma_free_coherent(&pdev->dev, (4096 << 1), (void *) spidat->dma_base_v,
+	if (spidat->tx_dma_ch >= 0)
+		dma_release_sg_channel(spidat->tx_dma_ch);
+	if (spidat->rx_dma_ch >= 0)
+		dma_release_sg_channel(spidat->rx_dma_ch);
+	dma_free_coherent(&pdev->dev, (LPC313X_SPI_DMA_BUF_SIZE << 1), (void *) spidat->dma_base_v,
 		spidat->dma_base_p);
 errout3:
 	free_irq(spidat->irq, pdev);
@@ -878,6 +1419,7 @@ errout2:
 	lpc313x_spi_clks_disen(spidat, 0);
 	destroy_workqueue(spidat->workqueue);
 errout:
+	kfree(spidat->cs_state);
 	platform_set_drvdata(pdev, NULL);
 	spi_master_put(master);
 
@@ -899,18 +1441,22 @@ static int __devexit lpc313x_spi_remove(struct platform_device *pdev)
 	spi_unregister_master(master);
 	platform_set_drvdata(pdev, NULL);
 
-	if (spidat->tx_dma_ch != -1)
-		dma_release_channel(spidat->tx_dma_ch);
-	if (spidat->rx_dma_ch != -1)
-		dma_release_channel(spidat->rx_dma_ch);
+	if (spidat->pump_task != NULL)
+		kthread_stop(spidat->pump_task);
+
+	if (spidat->tx_dma_ch >= 0)
+		dma_release_sg_channel(spidat->tx_dma_ch);
+	if (spidat->rx_dma_ch >= 0)
+		dma_release_sg_channel(spidat->rx_dma_ch);
 
-	dma_free_coherent(&pdev->dev, (4096 << 1), (void *) spidat->dma_base_v,
+	dma_free_coherent(&pdev->dev, (LPC313X_SPI_DMA_BUF_SIZE << 1), (void *) spidat->dma_base_v,
 		spidat->dma_base_p);
 
 	/* Free resources */
 	free_irq(spidat->irq, pdev);
 
 	destroy_workqueue(spidat->workqueue);
+	kfree(spidat->cs_state);
 	spi_master_put(master);
 
 	return 0;
@@ -24,6 +24,7 @@
 #include <linux/platform_device.h>
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
+#include <linux/err.h>
 
 #include <sound/core.h>
 #include <sound/pcm.h>
@@ -37,15 +38,12 @@
 static u64 lpc313x_pcm_dmamask = DMA_32BIT_MASK;
 
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
-/* The DMA controller in the LPC31XX has limited interrupt support
-   for DMA. A timer is used instead to update the current buffer
-   position */
+/* The buffer is played from a cyclic linked list with one entry per
+   period, the data channel interrupts at the end of each period */
 #define MIN_PERIODS 8
 #define MAX_PERIODS 250
-#define DMA_LIST_SIZE (MAX_PERIODS * sizeof(dma_sg_ll_t))
 #define MIN_BYTES_PERIOD 2048
 #define MAX_BYTES_PERIOD 4096
-#define MINTICKINC ((MIN_BYTES_PERIOD * HZ * (MIN_PERIODS / 4)) / (48000 * 2 * 2))
 
 #else
 #define MIN_PERIODS 2
@@ -93,54 +91,52 @@ struct lpc313x_dma_data {
 	volatile dma_addr_t dma_cur;
 	u32 dma_cfg_base;
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
-	dma_sg_ll_t *p_sg_cpu;
-	dma_sg_ll_t *p_sg_dma;
-	struct timer_list timer[2];
-	int inccount;
+	dma_lli_t *ring;
 #endif
 };
 
+#if defined (CONFIG_SND_USE_DMA_LINKLIST)
 /*
- * DMA ISR - occurs when a new DMA buffer is needed
+ * Cyclic DMA period callback - the period is finished, the DMA is in
+ * the next one
  */
-static void lpc313x_pcm_dma_irq(int ch, dma_irq_type_t dtype, void *handle) {
+static void lpc313x_pcm_period_done(int ch, int period, void *handle) {
 	struct snd_pcm_substream *substream = (struct snd_pcm_substream *) handle;
 	struct snd_pcm_runtime *rtd = substream->runtime;
 	struct lpc313x_dma_data *prtd = rtd->private_data;
 
-	(void) dtype;
 	(void) ch;
 
-	/* Last buffer is finished */
-	prtd->dma_cur += prtd->period_size;
-	if (prtd->dma_cur >= prtd->dma_buffer_end)
-		prtd->dma_cur = prtd->dma_buffer;
+	if (++period == prtd->num_periods)
+		period = 0;
+	prtd->dma_cur = prtd->dma_buffer + period * prtd->period_size;
 
 	/* Tell audio system more buffer space is available */
 	snd_pcm_period_elapsed(substream);
 }
+#endif
 
-#if defined (CONFIG_SND_USE_DMA_LINKLIST)
-static void lpc313x_check_dmall(unsigned long data) {
-	struct snd_pcm_substream *substream = (struct snd_pcm_substream *) data;
+#else
+/*
+ * DMA ISR - occurs when a new DMA buffer is needed
+ */
+static void lpc313x_pcm_dma_irq(int ch, dma_irq_type_t dtype, void *handle) {
+	struct snd_pcm_substream *substream = (struct snd_pcm_substream *) handle;
 	struct snd_pcm_runtime *rtd = substream->runtime;
 	struct lpc313x_dma_data *prtd = rtd->private_data;
 
-	/* Determine buffer position from current DMA position. We don't need
-	   the exact address, just the last finished period */
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		mod_timer(&prtd->timer[0], jiffies + MINTICKINC);
-		prtd->dma_cur = (dma_addr_t) DMACH_SRC_ADDR(prtd->dmach - 1);
-	}
-	else {
-		mod_timer(&prtd->timer[1], jiffies + MINTICKINC);
-		prtd->dma_cur = (dma_addr_t) DMACH_DST_ADDR(prtd->dmach - 1);
-	}
+	(void) dtype;
+	(void) ch;
+
+	/* Last buffer is finished */
+	prtd->dma_cur += prtd->period_size;
+	if (prtd->dma_cur >= prtd->dma_buffer_end)
+		prtd->dma_cur = prtd->dma_buffer;
 
 	/* Tell audio system more buffer space is available */
 	snd_pcm_period_elapsed(substream);
 }
-#endif
+
 
 static int lpc313x_pcm_allocate_dma_buffer(struct snd_pcm *pcm, int stream)
 {
@@ -194,8 +190,9 @@ static int lpc313x_pcm_hw_free(struct snd_pcm_substream *substream)
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
 		dma_release_sg_channel(prtd->dmach);
 
-		/* Return the linked list area */
-		dma_free_coherent(NULL, DMA_LIST_SIZE, prtd->p_sg_cpu, 0);
+		/* Return the linked list entries */
+		dma_lli_free(prtd->ring);
+		prtd->ring = NULL;
 #else
 		dma_release_channel((unsigned int) prtd->dmach);
 #endif
@@ -215,13 +212,12 @@ static int lpc313x_pcm_prepare(struct snd_pcm_substream *substream)
 		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
 			prtd->dmach = dma_request_sg_channel("I2STX",
-				lpc313x_pcm_dma_irq, substream, 0);
+				NULL, NULL, 0);
 
 			printk(KERN_CRIT "I2STX DMA: %d\n",prtd->dmach);
 			prtd->dma_cfg_base = DMA_CFG_TX_WORD |
-				DMA_CFG_RD_SLV_NR(0) | DMA_CFG_CMP_CH_EN |
-				DMA_CFG_WR_SLV_NR(TX_DMA_CHCFG) |
-				DMA_CFG_CMP_CH_NR(prtd->dmach);
+				DMA_CFG_RD_SLV_NR(0) |
+				DMA_CFG_WR_SLV_NR(TX_DMA_CHCFG);
 
 #else
 			prtd->dmach = dma_request_channel("I2STX",
@@ -234,12 +230,11 @@ static int lpc313x_pcm_prepare(struct snd_pcm_substream *substream)
 		else {
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
 			prtd->dmach = dma_request_sg_channel("I2SRX",
-				lpc313x_pcm_dma_irq, substream, 0);
+				NULL, NULL, 0);
 			printk(KERN_CRIT "I2SRX DMA: %d\n",prtd->dmach);
 			prtd->dma_cfg_base = DMA_CFG_TX_WORD |
-				DMA_CFG_WR_SLV_NR(0) | DMA_CFG_CMP_CH_EN |
-				DMA_CFG_RD_SLV_NR(RX_DMA_CHCFG) |
-				DMA_CFG_CMP_CH_NR(prtd->dmach);
+				DMA_CFG_WR_SLV_NR(0) |
+				DMA_CFG_RD_SLV_NR(RX_DMA_CHCFG);
 
 #else
 			prtd->dmach = dma_request_channel("I2SRX",
@@ -254,20 +249,24 @@ static int lpc313x_pcm_prepare(struct snd_pcm_substream *substream)
 			pr_err("Error allocating DMA channel\n");
 			return prtd->dmach;
 		}
+	}
 
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
-		/* Allocate space for a DMA linked list */
-		prtd->p_sg_cpu = (dma_sg_ll_t *) dma_alloc_coherent(
-			NULL, DMA_LIST_SIZE,
-			(dma_addr_t *) &prtd->p_sg_dma, GFP_KERNEL);
-
-		if (prtd->p_sg_cpu == NULL) {
-			dma_release_sg_channel(prtd->dmach);
-			prtd->dmach = -1;
-			return -ENOMEM;
-		}
-#endif
+	/* Build the linked list that wraps around the buffer, the period
+	   size and count may have changed since the last prepare */
+	dma_lli_free(prtd->ring);
+	prtd->ring = dma_lli_cyclic(prtd->dmach, prtd->dma_buffer,
+		prtd->period_size, prtd->num_periods,
+		(substream->stream == SNDRV_PCM_STREAM_PLAYBACK) ?
+		TX_FIFO_ADDR : RX_FIFO_ADDR, prtd->dma_cfg_base,
+		(substream->stream == SNDRV_PCM_STREAM_PLAYBACK), GFP_KERNEL);
+	if (IS_ERR(prtd->ring)) {
+		int ret = PTR_ERR(prtd->ring);
+
+		prtd->ring = NULL;
+		return ret;
 	}
+#endif
 
 	return 0;
 }
@@ -279,63 +278,22 @@ static int lpc313x_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 	struct snd_pcm_runtime *rtd = substream->runtime;
 	struct lpc313x_dma_data *prtd = rtd->private_data;
 	int ret = 0;
-	unsigned long timeout;
 #if defined (CONFIG_SND_USE_DMA_LINKLIST)
-	int i, tch;
-	u32 addr;
-	dma_sg_ll_t *p_sg_cpuw, *p_sg_dmaw;
-
-
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		tch = 0;
-	}
-	else {
-		tch = 1;
-	}
-
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
 		prtd->dma_cur = prtd->dma_buffer;
-		p_sg_cpuw = prtd->p_sg_cpu;
-		p_sg_dmaw = prtd->p_sg_dma;
-
-		/* Build a linked list that wraps around */
-		addr = (u32) prtd->dma_buffer;
-		for (i = 0; i < prtd->num_periods; i++) {
-			p_sg_cpuw->setup.trans_length = (prtd->period_size / 4) - 1;
-			p_sg_cpuw->setup.cfg = prtd->dma_cfg_base;
-			p_sg_cpuw->next_entry = (u32) (p_sg_dmaw + 1);
-
-			if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-				p_sg_cpuw->setup.src_address = addr;
-				p_sg_cpuw->setup.dest_address = TX_FIFO_ADDR;
-			}
-			else {
-				p_sg_cpuw->setup.dest_address = addr;
-				p_sg_cpuw->setup.src_address = RX_FIFO_ADDR;
-			}
-
-			/* Wrap end of list back to start? */
-			if (i == (prtd->num_periods - 1))
-				p_sg_cpuw->next_entry = (u32) prtd->p_sg_dma;
-
-			p_sg_cpuw++;
-			p_sg_dmaw++;
-			addr += prtd->period_size;
-		}
 
-		/* Add and start audio data position timer */
-		init_timer(&prtd->timer[tch]);
-		prtd->timer[tch].data = (unsigned long) substream;
-		prtd->timer[tch].function = lpc313x_check_dmall;
-		prtd->timer[tch].expires = jiffies + MINTICKINC;
-		add_timer(&prtd->timer[tch]);
+		/* Start the ring, the data channel reports each period */
+		ret = dma_start_cyclic(prtd->dmach, prtd->ring,
+			lpc313x_pcm_period_done, substream);
+		break;
 
-		/* Program DMA channel and start it */
-		dma_prog_sg_channel(prtd->dmach, (u32) prtd->p_sg_dma);
-		dma_set_irq_mask(prtd->dmach, 1, 1);
+	case SNDRV_PCM_TRIGGER_STOP:
+		dma_stop_cyclic(prtd->dmach);
+		break;
 #else
 	dma_setup_t dmasetup;
+	unsigned long timeout;
 
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
@@ -356,14 +314,10 @@ static int lpc313x_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		/* Program DMA channel and start it */
 		dma_prog_channel(prtd->dmach, &dmasetup);
 		dma_set_irq_mask(prtd->dmach, 0, 0);
-#endif
 		dma_start_channel(prtd->dmach);
 		break;
 
 	case SNDRV_PCM_TRIGGER_STOP:
-#if defined (CONFIG_SND_USE_DMA_LINKLIST)
-		del_timer_sync(&prtd->timer[tch]);
-#endif
 		/* Stop the companion channel and let the current DMA
 		   transfer finish */
 		dma_stop_channel_sg(prtd->dmach);
@@ -375,6 +329,7 @@ static int lpc313x_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 
 //		dma_stop_channel(prtd->dmach);
 		break;
+#endif
 
 	case SNDRV_PCM_TRIGGER_SUSPEND:
 	case SNDRV_PCM_TRIGGER_RESUME: